@@ -0,0 +1,56 @@
+#
+# Copyright 2016 Fraser Adams
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+# Script run by cmake -P to embed a source file in the library as a byte array.
+# Writes OUTPUT, a C++ file defining
+#   const unsigned char NAME[]   - the bytes of INPUT followed by a '\0'
+#   const std::size_t NAME_SIZE  - the size of INPUT, excluding the '\0'
+# in namespace gimbatuluk, as declared by src/program-cache.h.
+
+file(READ ${INPUT} content HEX)
+string(LENGTH "${content}" hex_length)
+math(EXPR size "${hex_length} / 2")
+
+# Convert each pair of hex digits into a 0x.., initialiser, 16 per line. CMake
+# regular expressions have no {n} repetition so the line pattern is built up.
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${content}")
+set(line "")
+foreach(i RANGE 15)
+    set(line "${line}0x..,")
+endforeach()
+string(REGEX REPLACE "(${line})" "\\1\n    " bytes "${bytes}")
+
+get_filename_component(input_name ${INPUT} NAME)
+file(WRITE ${OUTPUT}
+"// Generated from ${input_name} by EmbedSource.cmake, do not edit.
+
+#include \"program-cache.h\"
+
+namespace gimbatuluk {
+
+const unsigned char ${NAME}[] = {
+    ${bytes}0x00
+};
+
+const std::size_t ${NAME}_SIZE = ${size};
+
+} // namespace gimbatuluk
+")
@@ -0,0 +1,89 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include "pfac.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+/**
+ * Dictionary compiler. Parses command line arguments then reads and compiles
+ * the dictionary, writing the compiled tables to a precompiled dictionary file
+ * that may be installed using PFAC::installCompiledDictionary.
+ */
+int main(int argc, char** argv) {
+    std::string dictionary = "words";
+    std::string output;
+    std::string _usage = 
+        "Usage: " + std::string(argv[0]) + " [OPTIONS]\n" \
+        "Options:\n" \
+        "  -h, --help                     show this help message and exit\n" \
+        "  -d <dict>, --dictionary <dict> dictionary file to compile, default = " + dictionary + "\n" \
+        "  -o <file>, --output <file>     compiled dictionary file, default = <dict>.gbc\n" \
+        "  -b, --bigram                   include the bigram transition table\n";
+
+    bool bigramTable = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            std::cout << _usage;
+            std::exit(EXIT_SUCCESS);
+        } else if (arg == "-b" || arg == "--bigram") {
+            bigramTable = true;
+        } else if (arg[0] == '-' && i + 1 < argc) {
+            i++;
+            std::string val = argv[i];
+            if (arg == "-d" || arg == "--dictionary") {
+                dictionary = val;
+            } else if (arg == "-o" || arg == "--output") {
+                output = val;
+            }
+        }
+    }
+
+    if (output.empty()) {
+        output = dictionary + ".gbc";
+    }
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+
+        const auto tableBytes = gimbatuluk::compileDictionary(
+            gimbatuluk::readFile(dictionary), output, bigramTable);
+
+        auto end = std::chrono::steady_clock::now();
+        auto duration = std::chrono::
+             duration_cast<std::chrono::milliseconds>(end - start).count();
+
+        std::cout << "Compiled " << dictionary << " to " << output << std::endl;
+        std::cout << "bigram table = " << (bigramTable ? "on" : "off") << std::endl;
+        std::cout << "compiled table size (bytes) = " << tableBytes << std::endl;
+        std::cout << "compile time (ms) = " << duration << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Fatal error, caught exception: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
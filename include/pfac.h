@@ -25,6 +25,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -40,13 +41,134 @@ struct MatchEntry {
     std::int32_t value;
 };
 
+/**
+ * The extended compact scan adds the end of each match, the index one past its
+ * last byte, so end - index is the length of the pattern matched.
+ */
+struct MatchSpan {
+    std::int32_t index;
+    std::int32_t end;
+    std::int32_t value;
+};
+
+/**
+ * The outcome of a compact scan. count matches were written to the output and
+ * truncated is set if there were more matches than the limit allowed. total
+ * is the number of matches found, which is exact unless truncated. Devices
+ * stop scanning early once the limit is passed, so total is then only a lower
+ * bound, greater than the limit, and countMatches gives the exact number.
+ */
+struct CompactResult {
+    std::size_t count;
+    std::size_t total;
+    bool truncated;
+};
+
+/**
+ * The ScanStream reports matches as an offset from the start of the stream,
+ * which may be far larger than the range of MatchEntry's index.
+ */
+struct StreamMatchEntry {
+    std::uint64_t offset;
+    std::int32_t value;
+};
+
+/**
+ * Wall clock time in milliseconds spent in each step of compiling a dictionary.
+ * The load time accumulates over every loadDictionary since clearDictionary.
+ */
+struct CompileTimings {
+    double load;
+    double hashTable;
+    double failureLinks;
+};
+
+/**
+ * Counts of the state machine table reads needed to scan an input, as returned
+ * by PFAC::profile. initialLookups, bigramLookups and hashLookups count lookups
+ * in each table and tableReads counts the individual memory reads, noting that
+ * a hashed lookup reads both hashRow and (usually) hashVal.
+ */
+struct ScanProfile {
+    std::size_t bytes;
+    std::size_t initialLookups;
+    std::size_t bigramLookups;
+    std::size_t hashLookups;
+    std::size_t tableReads;
+};
+
 using Callback = std::function<void(const std::vector<char>& input, 
                                std::vector<std::int32_t>& output)>;
 
+using CompactCallback = std::function<void(const std::vector<char>& input,
+                                      std::vector<MatchEntry>& output,
+                                      const CompactResult& result)>;
+
 std::vector<char> readFile(const std::string& fileName);
 
+// Directory of the OpenCL program binary cache, which avoids recompiling the
+// Kernels in every process. Defaults to $GIMBATULUK_CACHE_DIR if set, else
+// $XDG_CACHE_HOME/gimbatuluk or $HOME/.cache/gimbatuluk. Empty disables it.
+// Affects PFAC instances whose OpenCL Device is initialised after the call.
+void setProgramCacheDirectory(const std::string& directory);
+std::string getProgramCacheDirectory();
+
+// If set, installing a dictionary on an OpenCL Device builds a Program variant
+// specialised for it, with its initial state, bigram table use and longest
+// pattern compiled in, so the Kernels' local input buffers are sized to fit.
+// Each variant is compiled once then loaded from the program cache, but the
+// first install of each new variant pays for a compile. Default false.
+void setSpecialisedPrograms(const bool specialise);
+bool getSpecialisedPrograms();
+
+// Force OpenCL Devices to hold the state machine tables of dictionaries
+// installed after the call in "image", "global", "constant" or "local" memory,
+// or "" (the default) to choose by table size and Device type. Installing a
+// dictionary too large for a forced strategy throws std::runtime_error.
+void setTableStorage(const std::string& storage);
+
+/**
+ * Read only memory mapping of a whole file. The mapping is shared, so every
+ * process mapping the same file shares the same page cache copy of its data.
+ * The mapping is released when the MappedFile is destroyed. A file no larger
+ * than the PFAC buffer may be scanned in place via the pointer scans, avoiding
+ * the copy into a std::vector that readFile makes.
+ */
+class MappedFile {
+public:
+    MappedFile(const std::string& fileName);
+    ~MappedFile();
+
+    MappedFile(MappedFile&&) = delete;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(MappedFile&&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const {
+        return address;
+    }
+
+    std::size_t size() const {
+        return length;
+    }
+private:
+    const char* address;
+    std::size_t length;
+};
+
+std::shared_ptr<const MappedFile> mapFile(const std::string& fileName);
+
+// Compile the newline separated patterns in buffer and write them to fileName
+// as a precompiled dictionary for PFAC::installCompiledDictionary. Returns the
+// size in bytes of the compiled state machine tables.
+std::size_t compileDictionary(const std::vector<char>& buffer,
+                              const std::string& fileName,
+                              const bool bigramTable = false);
+
 struct Dictionary;
+struct DictionaryVersions;
 class Scanner;
+class ThreadPool;
 class PFAC {
 public:
     static std::vector<std::string> getAvailableDevices();
@@ -55,6 +177,25 @@ public:
     PFAC(const std::size_t maxBufferSze);
     PFAC(const std::string deviceName);
     PFAC(const std::string deviceName, const std::size_t bufferSize);
+    // pipelineDepth is the number of async scans that may be in flight, each
+    // with its own bufferSize Device buffers, default 3. Deeper pipelines hide
+    // more transfer latency for small scans at the cost of Device memory. On
+    // Devices without unified memory each slot also stages its transfers
+    // through page locked host buffers of the same sizes.
+    // Once a dictionary is installed, any number of threads may scan using
+    // one PFAC, with up to pipelineDepth scans, sync or async, in flight at
+    // once and the rest waiting for a slot. swapDictionary may be used while
+    // they scan, but the getInputBuffer family is for one thread at a time.
+    PFAC(const std::string deviceName, const std::size_t bufferSize,
+         const std::size_t pipelineDepth);
+    // maxMatches is the most matches a compact, span or scanAll scan may
+    // return on any Device, default bufferSize. Larger limits and capacities
+    // are reduced to it, and the scan reports that its output was truncated.
+    // It may exceed bufferSize, as scanAll can find several matches per byte.
+    // On OpenCL Devices it sizes the Device output buffers. Batch scans always
+    // report every match of each message.
+    PFAC(const std::string deviceName, const std::size_t bufferSize,
+         const std::size_t pipelineDepth, const std::size_t maxMatches);
     ~PFAC();
 
     PFAC(PFAC&&);
@@ -63,9 +204,44 @@ public:
     PFAC& operator=(const PFAC&) = delete;
 
     std::string getDeviceName();
+    std::size_t getBufferSize();
     void clearDictionary();
     void loadDictionary(const std::vector<char>& buffer);
-    void installDictionary();
+    // If bigramTable is true the first two characters of each match are
+    // resolved via a single lookup in a 65536 entry table. Returns the size in
+    // bytes of the compiled state machine tables installed onto the Device.
+    // The loaded patterns are kept, so further patterns may be loaded and the
+    // dictionary installed again with them all, until clearDictionary.
+    std::size_t installDictionary(const bool bigramTable = false);
+
+    // Install a dictionary precompiled by compileDictionary. The file is memory
+    // mapped, not read, so processes using the same file share its tables.
+    std::size_t installCompiledDictionary(const std::string& fileName);
+
+    // Compile buffer as a new dictionary version in the background, then switch
+    // to it atomically. Scans already started, including async scans awaiting
+    // their callback, complete with the previous version and scans started
+    // after the returned future is ready use the new version. Swaps and
+    // installs take effect in the order they are called, so if several are
+    // outstanding the last called is left installed, and an earlier one that
+    // finishes compiling after it is discarded, though its future is ready.
+    std::future<std::size_t> swapDictionary(const std::vector<char>& buffer,
+                                            const bool bigramTable = false);
+
+    // Length in bytes of the longest pattern in the installed dictionary.
+    std::size_t getMaxPatternLength();
+
+    // Where the installed dictionary's state machine tables are held: "image",
+    // "global", "constant" or "local" memory on OpenCL Devices, see
+    // setTableStorage, "host" for host scanners, or empty if none installed.
+    std::string getTableStorage();
+
+    // Time spent loading and compiling the dictionary, for benchmarking.
+    CompileTimings getCompileTimings();
+
+    // Count the state machine table reads needed to scan input with the
+    // installed dictionary. This is a host side diagnostic for benchmarking.
+    ScanProfile profile(const std::vector<char>& input);
 
     // Scan producing output of pattern IDs at the index of the match location.
     void scan(const std::vector<char>& input,
@@ -75,12 +251,204 @@ public:
 
     // Scan producing compact output of index/value pairs, limit is the maximum
     // number of matches to be populated in order to constrain bandwidth.
+    CompactResult scan(const std::vector<char>& input,
+                       std::vector<MatchEntry>& output,
+                       const std::int32_t limit = -1);
+
+    // As above but returning immediately, as the async dense scan does, with
+    // callback invoked once output has been resized to the number of matches
+    // and populated. input and output must not be touched until then. If
+    // the scan fails on the Device, the async scans still invoke callback,
+    // with empty output and, for the compact scan, a truncated result.
     void scan(const std::vector<char>& input,
-              std::vector<MatchEntry>& output,
+              std::vector<MatchEntry>& output, CompactCallback callback,
               const std::int32_t limit = -1);
+
+    // As above but scanning size bytes of caller owned memory, such as a
+    // MappedFile or a slice of a larger buffer, in place. The dense scan writes
+    // size pattern IDs to output. The compact scan writes at most capacity
+    // matches to output, and its CompactResult says how many it wrote and
+    // whether capacity (or maxMatches) truncated them.
+    void scan(const char* input, const std::size_t size,
+              std::int32_t* output);
+    CompactResult scan(const char* input, const std::size_t size,
+                       MatchEntry* output, const std::size_t capacity);
+
+    // As the compact scan, but reporting every pattern matching at each
+    // position rather than only the longest, e.g. both "he" and "hers" at the
+    // start of "hers". The matches are in position order, and shorter before
+    // longer at the same position. A position may match several patterns, so
+    // the number of matches is bounded only by limit (or capacity), not by
+    // the input size.
+    CompactResult scanAll(const std::vector<char>& input,
+                          std::vector<MatchEntry>& output,
+                          const std::int32_t limit = -1);
+    CompactResult scanAll(const char* input, const std::size_t size,
+                          MatchEntry* output, const std::size_t capacity);
+
+    // As the compact scan but reporting MatchSpans, whose end offsets are
+    // taken from the pattern lengths stored in the compiled dictionary.
+    CompactResult scan(const std::vector<char>& input,
+                       std::vector<MatchSpan>& output,
+                       const std::int32_t limit = -1);
+
+    // Scan reporting only non-overlapping matches, chosen leftmost-longest as
+    // a regex engine would: the longest match at the earliest position, then
+    // the same from its end onwards. limit bounds the spans selected.
+    CompactResult scanLeftmostLongest(const std::vector<char>& input,
+                                      std::vector<MatchSpan>& output,
+                                      const std::int32_t limit = -1);
+
+    // Scan a batch of messages, producing output for each message as though
+    // it had been scanned on its own, so no match spans two messages. The
+    // messages are packed together and scanned by a single Kernel launch, so
+    // many small messages cost one round trip to the Device instead of one
+    // each. Batches larger than getBufferSize() are scanned in several parts.
+    void scan(const std::vector<std::vector<char>>& messages,
+              std::vector<std::vector<std::int32_t>>& output);
+    void scan(const std::vector<std::vector<char>>& messages,
+              std::vector<std::vector<MatchEntry>>& output);
+
+    // Reduced output scans for rules needing less than every match, so only a
+    // few bytes are read back from the Device. countMatches returns the number
+    // of matches, as the compact scan with no limit would find. matchHistogram
+    // sets output[id] to the number of matches of pattern id for every pattern
+    // in the dictionary. firstMatch returns the earliest match, or a MatchEntry
+    // with index and value INVALID (-1) if there are no matches.
+    std::size_t countMatches(const std::vector<char>& input);
+    std::size_t countMatches(const char* input, const std::size_t size);
+    void matchHistogram(const std::vector<char>& input,
+                       std::vector<std::uint32_t>& output);
+    void matchHistogram(const char* input, const std::size_t size,
+                       std::vector<std::uint32_t>& output);
+    MatchEntry firstMatch(const std::vector<char>& input);
+    MatchEntry firstMatch(const char* input, const std::size_t size);
+
+    // Buffers owned by the scanner, which are read and written in place by
+    // the scanBuffer methods. The input buffer holds getBufferSize() bytes.
+    // For OpenCL Devices they are page locked (pinned) host memory, so they
+    // transfer at full DMA speed, and on Devices sharing memory with the host
+    // the Kernels use them directly. The match buffer holds maxMatches
+    // entries. The pointers are only valid until the next scanBuffer or
+    // scanBufferCompact call, so get them again after each.
+    char* getInputBuffer();
+    const std::int32_t* getOutputBuffer();
+    const MatchEntry* getMatchBuffer();
+
+    // Scan the first size bytes of the input buffer, writing the pattern IDs
+    // to the output buffer, or the compact matches to the match buffer and
+    // returning their CompactResult, as for the compact scan.
+    void scanBuffer(const std::size_t size);
+    CompactResult scanBufferCompact(const std::size_t size,
+                                    const std::int32_t limit = -1);
+private:
+    std::unique_ptr<Dictionary> dictionary; // Patterns loaded but not installed.
+    std::shared_ptr<Scanner> scanner;
+    std::shared_ptr<DictionaryVersions> versions; // Orders swaps and installs.
+};
+
+/**
+ * Scan a stream of data presented as a sequence of arbitrarily sized chunks,
+ * such as successive reads from a socket or file, reporting the same matches
+ * as a scan of the whole stream in one buffer would. The stream retains the
+ * last getMaxPatternLength() - 1 bytes scanned, because a match starting in
+ * them may continue in the next chunk, and reports the matches starting there
+ * once the following chunk (or finish) shows which is the longest. Each match
+ * is therefore reported exactly once, with its offset from the stream start.
+ * Chunks larger than the PFAC buffer are split, so memory use is bounded by
+ * the buffer size whatever the stream length. The PFAC instance must outlive
+ * the ScanStream and must not be moved while it is in use.
+ */
+class ScanStream {
+public:
+    ScanStream(PFAC& pfac);
+
+    // Scan the next chunk, appending the matches now known to be complete.
+    void scan(const std::vector<char>& chunk,
+              std::vector<StreamMatchEntry>& output);
+    void scan(const char* chunk, const std::size_t size,
+              std::vector<StreamMatchEntry>& output);
+
+    // End of stream, append the matches starting in the retained bytes.
+    void finish(std::vector<StreamMatchEntry>& output);
+
+    // Number of bytes of the stream passed to scan so far.
+    std::uint64_t getOffset() const;
+private:
+    void scanBuffer(std::size_t complete,
+                    std::vector<StreamMatchEntry>& output);
+
+    PFAC& pfac;
+    std::uint64_t bufferOffset; // Stream offset of the start of buffer.
+    std::vector<char> buffer;   // Bytes retained from the previous chunk(s).
+    std::vector<MatchEntry> matches;
+};
+
+/**
+ * Scan using several Devices at once, e.g. every GPU in the machine together
+ * with the host CPU scanner. The same compiled dictionary is shared by every
+ * Device. A large input is split into pieces, or a list of messages routed
+ * whole, which the Devices take from a shared queue as each becomes free, so
+ * faster Devices scan more of the input. The size of each piece is weighted
+ * by the throughput measured for the Device on earlier pieces and shrinks as
+ * the input is consumed, so the Devices finish at about the same time. Pieces
+ * overlap by getMaxPatternLength() - 1 bytes, so matches spanning pieces are
+ * found, and the results are merged in input order, matching a single PFAC.
+ */
+class MultiScanner {
+public:
+    // An empty deviceNames selects every available OpenCL Device and a single
+    // host scanner, Host:CPU[0], as each host scanner uses every hardware
+    // thread. Each Device has its own bufferSize buffer, which bounds the piece
+    // and message sizes.
+    MultiScanner(const std::vector<std::string>& deviceNames,
+                 const std::size_t bufferSize);
+    ~MultiScanner();
+
+    MultiScanner(MultiScanner&&) = delete;
+    MultiScanner(const MultiScanner&) = delete;
+    MultiScanner& operator=(MultiScanner&&) = delete;
+    MultiScanner& operator=(const MultiScanner&) = delete;
+
+    std::vector<std::string> getDeviceNames();
+    std::size_t getBufferSize();
+    void clearDictionary();
+    void loadDictionary(const std::vector<char>& buffer);
+    // Compile the loaded patterns once and install them on every Device. As
+    // for PFAC::installDictionary the loaded patterns are kept.
+    std::size_t installDictionary(const bool bigramTable = false);
+    std::size_t installCompiledDictionary(const std::string& fileName);
+    std::size_t getMaxPatternLength();
+
+    // Throughput in MB/s measured for each Device, in getDeviceNames order.
+    std::vector<double> getThroughput();
+
+    // Scan an input of any size, as PFAC::scan but split across the Devices.
+    void scan(const std::vector<char>& input,
+              std::vector<std::int32_t>& output);
+    CompactResult scan(const std::vector<char>& input,
+                       std::vector<MatchEntry>& output,
+                       const std::int32_t limit = -1);
+
+    // Scan each message separately producing compact output per message. The
+    // CompactResult sums the counts and totals of every message and is
+    // truncated if any message's matches were.
+    CompactResult scan(const std::vector<std::vector<char>>& messages,
+                       std::vector<std::vector<MatchEntry>>& output);
 private:
-    std::unique_ptr<Dictionary> dictionary;
-    std::unique_ptr<Scanner> scanner;
+    struct Device;
+
+    std::size_t distribute(const std::size_t size, const std::size_t maxPiece,
+                           const std::function<std::size_t(Device& device,
+                                                           std::size_t piece,
+                                                           std::size_t begin,
+                                                           std::size_t end)>& f);
+    std::size_t getOverlap();
+
+    const std::size_t bufferSize;
+    std::unique_ptr<Dictionary> dictionary; // Patterns loaded but not installed.
+    std::vector<std::unique_ptr<Device>> devices;
+    std::unique_ptr<ThreadPool> pool; // A thread per Device.
 };
 
 } // namespace gimbatuluk
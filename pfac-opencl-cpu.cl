@@ -23,20 +23,103 @@
 /**
  * The following constants have been passed to the OpenCL program by the Host.
  * INVALID
- * MASKBITS
- * MASK
+ * ROW_OFFSET_SHIFT
+ * ROW_K_SHIFT
+ * ROW_FIELD_MASK
+ * NO_TRANSITIONS
+ * VAL_STATE_SHIFT
+ * VAL_CHAR_MASK
  * WORK_GROUP_SIZE
  * MAX_PATTERN_SIZE
  * WARP_SIZE
  * WARP_SHIFT
+ * REDUCE_COUNT
+ * REDUCE_HISTOGRAM
+ * REDUCE_FIRST
+ * STORAGE_IMAGE
+ * STORAGE_GLOBAL
+ * STORAGE_CONSTANT
+ * STORAGE_LOCAL
+ * TABLE_STORAGE
+ *
+ * With TABLE_STORAGE == STORAGE_LOCAL the hash table sizes are also passed.
+ * HASH_ROW_SIZE
+ * HASH_VAL_SIZE
+ *
+ * A Program specialised for one Dictionary is also passed the following, and
+ * MAX_PATTERN_SIZE just covers its longest pattern rather than 512 bytes.
+ * DICTIONARY_INITIAL_STATE
+ * DICTIONARY_BIGRAM_TABLE
+ * DICTIONARY_LONG_PATTERNS
  */
 
+/**
+ * The Dictionary dependent Kernel arguments, replaced by the Dictionary's own
+ * values in a specialised Program so that the compiler can fold them, e.g.
+ * removing the bigram and long pattern paths entirely when they are unused.
+ * The Kernels of either Program take the same arguments.
+ */
+#ifdef DICTIONARY_INITIAL_STATE
+#define INITIAL_STATE(initialState) DICTIONARY_INITIAL_STATE
+#define USE_BIGRAM_TABLE(useBigramTable) DICTIONARY_BIGRAM_TABLE
+#define LONG_PATTERNS(longPatterns) DICTIONARY_LONG_PATTERNS
+#else
+#define INITIAL_STATE(initialState) (initialState)
+#define USE_BIGRAM_TABLE(useBigramTable) (useBigramTable)
+#define LONG_PATTERNS(longPatterns) (longPatterns)
+#endif
+
+/**
+ * Where the state machine tables are held, chosen by the Host per Dictionary.
+ * STORAGE_IMAGE:    image1d_buffer_t objects, read via the texture cache.
+ * STORAGE_GLOBAL:   plain global buffers, best where images are emulated, as
+ *                   on CPU Devices, or for tables too large for an image.
+ * STORAGE_CONSTANT: hashRow and hashVal in constant memory, the transition
+ *                   tables in global buffers.
+ * STORAGE_LOCAL:    as STORAGE_GLOBAL but each Work Group first copies hashRow
+ *                   and hashVal to local memory, for small tables.
+ * TRANSITION_TABLE and HASH_TABLE are the Kernel argument types of the
+ * transition and hash tables, LOOKUP_TABLE the type lookup() reads hashRow and
+ * hashVal through, and HASH_ROW and HASH_VAL select the copies it reads.
+ */
+#if TABLE_STORAGE == STORAGE_IMAGE
+#define TRANSITION_TABLE image1d_buffer_t
+#define HASH_TABLE image1d_buffer_t
+#define LOOKUP_TABLE image1d_buffer_t
+#define READ_TRANSITION(table, index) read_imagei(table, index).x
+#define READ_HASH(table, index) read_imageui(table, index).x
+#else
+#define TRANSITION_TABLE global const int*
+#define READ_TRANSITION(table, index) table[index]
+#define READ_HASH(table, index) table[index]
+#if TABLE_STORAGE == STORAGE_CONSTANT
+#define HASH_TABLE constant uint*
+#define LOOKUP_TABLE constant uint*
+#elif TABLE_STORAGE == STORAGE_LOCAL
+#define HASH_TABLE global const uint*
+#define LOOKUP_TABLE local const uint*
+#else
+#define HASH_TABLE global const uint*
+#define LOOKUP_TABLE global const uint*
+#endif
+#endif
+
+#if TABLE_STORAGE == STORAGE_LOCAL
+#define HASH_ROW(hashRow) hashRowCache
+#define HASH_VAL(hashVal) hashValCache
+#else
+#define HASH_ROW(hashRow) hashRow
+#define HASH_VAL(hashVal) hashVal
+#endif
+
 /**
  * TODO this program is fairly sub-optimal for a CPU as the use of images and
  * local memory are only really GPU optimisations and are likely to actually
- * slow down a CPU Kernel. The pfacCompact Kernel seems particularly slow, which
- * is most likely due to the synchronisation across Work Groups where it looks
- * like the spinlock sometimes spins for a large number of iterations.
+ * slow down a CPU Kernel. The Host avoids images on CPU Devices by choosing
+ * STORAGE_GLOBAL, but the input is still copied to local memory. The
+ * pfacCompact Kernel seems particularly slow, which is most likely due to the
+ * synchronisation across Work Groups where it looks like the spinlock
+ * sometimes spins for a large number of iterations.
  */
 
 /**
@@ -59,6 +142,15 @@ typedef struct MatchEntry_t {
     int value;
 } MatchEntry;
 
+/**
+ * The pfacSpans Kernel adds the end of each match, one past its last byte.
+ */
+typedef struct MatchSpan_t {
+    int index;
+    int end;
+    int value;
+} MatchSpan;
+
 /**
  * 257 is the prime number used in the hash function and has the useful
  * property that we can do reduction modulo 257 using (x & 255) - (x >> 8)
@@ -74,46 +166,193 @@ static inline int mod257(int x) {
 
 /**
  * Look up the next state in the hash table given the current state and the
- * transition (input) character. The hash table is held in image1d_buffer_t
- * objects accessed via read_imagei. Note that the initial transition is
- * accessed separately via the initialTransitionsCache in the main Kernel code.
+ * transition (input) character. The hash table is held as TABLE_STORAGE
+ * selects and read via READ_HASH, each hashRow entry is packed as
+ * offset << ROW_OFFSET_SHIFT | (k - 1) << ROW_K_SHIFT | log2(Si) and each
+ * hashVal entry as nextState << VAL_STATE_SHIFT | ch. Note that the initial
+ * transition is accessed separately via the initialTransitionsCache in the
+ * main Kernel code.
  */
-static inline int lookup(image1d_buffer_t hashRow,
-                         image1d_buffer_t hashVal,
+static inline int lookup(LOOKUP_TABLE hashRow,
+                         LOOKUP_TABLE hashVal,
                          int state,
                          int inputChar) {
-    const int2 row = read_imagei(hashRow, state).xy; // hashRow[state]
-    const int offset  = row.x;
+    const uint row = READ_HASH(hashRow, state); // hashRow[state]
     int nextState = INVALID;
-    if (offset >= 0) {
-        const int k_sminus1 = row.y;
-        const int sminus1 = k_sminus1 & MASK;
-        const int k = k_sminus1 >> MASKBITS; 
+    if (row != NO_TRANSITIONS) {
+        const int offset = (int)(row >> ROW_OFFSET_SHIFT);
+        const int k = (int)((row >> ROW_K_SHIFT) & ROW_FIELD_MASK) + 1;
+        const int sminus1 = (1 << (row & ROW_FIELD_MASK)) - 1;
 
         const int p = mod257(k * inputChar) & sminus1;
-        const int2 value = read_imagei(hashVal, offset + p).xy; // hashVal[offset + p]
-        if (inputChar == value.x) {
-            nextState = value.y;
+        const uint value = READ_HASH(hashVal, offset + p); // hashVal[offset + p]
+        if (inputChar == (int)(value & VAL_CHAR_MASK)) {
+            nextState = (int)(value >> VAL_STATE_SHIFT);
         }
     }
     return nextState;
 }
 
+#if TABLE_STORAGE == STORAGE_LOCAL
+/**
+ * Copy hashRow and hashVal to the Work Group's local memory, each Work Item
+ * copying every WORK_GROUP_SIZE'th entry. The caller must barrier before use.
+ */
+static inline void loadHashTables(global const uint* hashRow,
+                                  global const uint* hashVal,
+                                  local uint* hashRowCache,
+                                  local uint* hashValCache,
+                                  int tid) {
+    for (int i = tid; i < HASH_ROW_SIZE; i += WORK_GROUP_SIZE) {
+        hashRowCache[i] = hashRow[i];
+    }
+
+    for (int i = tid; i < HASH_VAL_SIZE; i += WORK_GROUP_SIZE) {
+        hashValCache[i] = hashVal[i];
+    }
+}
+#endif
+
+/**
+ * Run the PFAC state machine from position pos of the local memory buffer and
+ * return the ID of the longest pattern matched starting at pos, or -1 if there
+ * is no match. The initial transition uses initialTransitionsCache and, if
+ * useBigramTable is set, the second transition uses a single bigramTransitions
+ * read indexed by (firstChar << 8) | secondChar rather than a hashed lookup().
+ *
+ * The local buffer holds MAX_PATTERN_SIZE ints beyond the Work Group's own
+ * characters, so dictionaries with longer patterns may still be matching at
+ * its end. For those the walk continues reading the input from global memory
+ * until inputEnd, the input offset at which it must stop. This rare path is
+ * only taken by Work Items still in a live state at the end of the buffer, so
+ * the others carry on at full speed, and inputEnd is zero for dictionaries
+ * whose patterns all fit, so the check always fails for them.
+ */
+static inline int pfacMatch(local int* initialTransitionsCache,
+                            TRANSITION_TABLE bigramTransitions,
+                            LOOKUP_TABLE hashRow,
+                            LOOKUP_TABLE hashVal,
+                            int initialState,
+                            int useBigramTable,
+                            local unsigned char* buffer,
+                            int pos,
+                            int bufferSize,
+                            global const uchar* input,
+                            int firstCharInWorkGroup,
+                            int inputEnd) {
+    int match = -1;
+    int inputChar = buffer[pos];
+    int nextState = initialTransitionsCache[inputChar];
+    if (nextState != INVALID) {
+        if (nextState < initialState) {
+            match = nextState;
+        }
+        pos = pos + 1;
+
+        if (useBigramTable && pos < bufferSize) {
+            const int index = (inputChar << 8) | buffer[pos];
+            nextState = READ_TRANSITION(bigramTransitions, index);
+            if (nextState == INVALID) {
+                return match;
+            }
+
+            if (nextState < initialState) {
+                match = nextState;
+            }
+            pos = pos + 1;
+        }
+
+        while (pos < bufferSize) {
+            inputChar = buffer[pos];
+            nextState = lookup(hashRow, hashVal, nextState, inputChar);
+            if (nextState == INVALID) {
+                return match;
+            }
+
+            if (nextState < initialState) {
+                match = nextState;
+            }
+            pos = pos + 1;
+        }
+
+        // Continue a walk that is still live at the end of the local buffer.
+        for (pos += firstCharInWorkGroup; pos < inputEnd; pos++) {
+            nextState = lookup(hashRow, hashVal, nextState, input[pos]);
+            if (nextState == INVALID) {
+                break;
+            }
+
+            if (nextState < initialState) {
+                match = nextState;
+            }
+        }
+    }
+    return match;
+}
+
+/**
+ * Return the index of the first message in [lo, hi) whose exclusive end offset
+ * is greater than index, i.e. the packed message containing the byte at index,
+ * or hi if there is none. messageEnds is in ascending order so this is a
+ * binary search, which the callers narrow to the messages in their Work Group.
+ */
+static inline int findMessage(global const int* messageEnds,
+                              int lo,
+                              int hi,
+                              int index) {
+    while (lo < hi) {
+        const int mid = (lo + hi) >> 1;
+        if (messageEnds[mid] > index) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Return the input offset at which the state machine must stop for a match
+ * starting at local memory buffer position pos. For a batch of packed messages
+ * that is the end of the message containing pos, so no match spans two
+ * messages, otherwise it is simply the end of the input.
+ */
+static inline int matchEnd(global const int* messageEnds,
+                           int messageCount,
+                           local int* messageRange,
+                           int firstCharInWorkGroup,
+                           int pos,
+                           int inputSize) {
+    if (messageCount == 0) {
+        return inputSize;
+    }
+
+    const int message = findMessage(messageEnds, messageRange[0], messageRange[1],
+                                    firstCharInWorkGroup + pos);
+    return messageEnds[message];
+}
+
 /**
  * Simple PFAC Kernel. Copies WORK_GROUP_SIZE + MAX_PATTERN_SIZE integers from
  * global memory to local (shared) memory for each Work Group (thread block)
  * then transitions the state machine. The state machine holds the initial
- * transition in an array in local memory and the remainder in image1d_buffer_t
- * objects in order to make use of GPU texture memory, which is cached.
+ * transition in an array in local memory and the remainder as TABLE_STORAGE
+ * selects, by default image1d_buffer_t objects in order to make use of GPU
+ * texture memory, which is cached.
  */
-__kernel void pfac(image1d_buffer_t initialTransitions,
-                   image1d_buffer_t hashRow,
-                   image1d_buffer_t hashVal,
+__kernel void pfac(TRANSITION_TABLE initialTransitions,
+                   TRANSITION_TABLE bigramTransitions,
+                   HASH_TABLE hashRow,
+                   HASH_TABLE hashVal,
                    int initialState,
+                   int useBigramTable,
                    global int* input,
                    global int* output,
                    int inputSize, // Input size in bytes.
-                   int n) {
+                   int n,
+                   global const int* messageEnds,
+                   int messageCount,
+                   int longPatterns) {
     // Calculate the index of the first character in the Work Group.
     const int firstCharInWorkGroup = get_group_id(0) * WORK_GROUP_SIZE * sizeof(int);
 
@@ -136,7 +375,29 @@ __kernel void pfac(image1d_buffer_t initialTransitions,
     local unsigned char* buffer = (local unsigned char*)cache;
 
     // Load the initialTransitions table to local (shared) memory.
-    initialTransitionsCache[tid] = read_imagei(initialTransitions, tid).x;
+    initialTransitionsCache[tid] = READ_TRANSITION(initialTransitions, tid);
+
+#if TABLE_STORAGE == STORAGE_LOCAL
+    // Copy the hash tables to local memory, ordered by the barrier below.
+    local uint hashRowCache[HASH_ROW_SIZE];
+    local uint hashValCache[HASH_VAL_SIZE];
+    loadHashTables(hashRow, hashVal, hashRowCache, hashValCache, tid);
+#endif
+
+    /**
+     * For a batch of packed messages (messageCount > 0) find the range of
+     * messages containing the characters this Work Group starts matches from,
+     * which bounds each Work Item's search for the end of its message.
+     */
+    local int messageRange[2];
+    if (messageCount > 0 && tid == 0) {
+        const int lastChar = firstCharInWorkGroup + WORK_GROUP_SIZE*sizeof(int) - 1;
+        messageRange[0] = findMessage(messageEnds, 0, messageCount,
+                                      firstCharInWorkGroup);
+        messageRange[1] = min(findMessage(messageEnds, messageRange[0],
+                                          messageCount, lastChar) + 1,
+                              messageCount);
+    }
 
     // Read input data from global memory to local (shared) memory, n is the
     // number of OpenCL integers that would completely contain the input bytes.
@@ -162,29 +423,16 @@ __kernel void pfac(image1d_buffer_t initialTransitions,
 
         if (pos >= bufferSize) return;
 
-        int match = -1;
-        int inputChar = buffer[pos];
-        int nextState = initialTransitionsCache[inputChar];
-        if (nextState != INVALID) {
-            if (nextState < initialState) {
-                match = nextState;
-//printf("xx matched pattern %d at %d\n", nextState, j);
-            }
-            pos = pos + 1;
-            while (pos < bufferSize) {
-                inputChar = buffer[pos];
-                nextState = lookup(hashRow, hashVal, nextState, inputChar);
-                if (nextState == INVALID) {
-                    break;
-                }
+        const int end = matchEnd(messageEnds, messageCount, messageRange,
+                                 firstCharInWorkGroup, pos, inputSize);
 
-                if (nextState < initialState) {
-                    match = nextState;
-//printf("matched pattern %d at %d\n", nextState, j);
-                }
-                pos = pos + 1;
-            }
-        }
+        const int match = pfacMatch(initialTransitionsCache, bigramTransitions,
+                                    HASH_ROW(hashRow), HASH_VAL(hashVal),
+                                    INITIAL_STATE(initialState),
+                                    USE_BIGRAM_TABLE(useBigramTable),
+                                    buffer, pos, min(bufferSize, end - firstCharInWorkGroup),
+                                    (global const uchar*)input, firstCharInWorkGroup,
+                                    LONG_PATTERNS(longPatterns) ? end : 0);
 
         // Output results to global memory
         output[outputIndex] = match;
@@ -197,8 +445,9 @@ __kernel void pfac(image1d_buffer_t initialTransitions,
  * PFAC + Compaction Kernel. Copies WORK_GROUP_SIZE + MAX_PATTERN_SIZE integers
  * from global memory to local (shared) memory for each Work Group (thread block)
  * then transitions the state machine. The state machine holds the initial
- * transition in an array in local memory and the remainder in image1d_buffer_t
- * objects in order to make use of GPU texture memory, which is cached.
+ * transition in an array in local memory and the remainder as TABLE_STORAGE
+ * selects, by default image1d_buffer_t objects in order to make use of GPU
+ * texture memory, which is cached.
  *
  * With this kernel after the initial lookup has been performed compaction
  * is carried out to transform the sparse array containing matched pattern IDs
@@ -207,17 +456,32 @@ __kernel void pfac(image1d_buffer_t initialTransitions,
  * greatly reduce output bandwidth, however for very large numbers of matches
  * (> input size/2) the required bandwidth would actually be higher as each
  * match returns two ints (index + pattern ID).
+ *
+ * At most limit matches are written, so the output buffer need only hold that
+ * many. smem holds a WorkGroupSum per Work Group followed by a single int, the
+ * stop group, which must initially be INVALID. The first Work Group whose
+ * inclusive prefix exceeds limit stores its ID there, and Work Groups after it
+ * that start later skip the state machine walk. The inclusivePrefix of the last
+ * Work Group is then the number of matches found, which exceeds limit if and
+ * only if the output was truncated, but is a lower bound on the true count.
  */
-__kernel void pfacCompact(image1d_buffer_t initialTransitions,
-                          image1d_buffer_t hashRow,
-                          image1d_buffer_t hashVal,
+__kernel void pfacCompact(TRANSITION_TABLE initialTransitions,
+                          TRANSITION_TABLE bigramTransitions,
+                          HASH_TABLE hashRow,
+                          HASH_TABLE hashVal,
                           int initialState,
+                          int useBigramTable,
                           global int* input,
                           global MatchEntry* output,
                           global WorkGroupSum* smem,
                           int inputSize, // Input size in bytes.
                           int n,
-                          int limit) {
+                          global const int* messageEnds,
+                          int messageCount,
+                          int limit,
+                          global const int* prefixLink,
+                          int allMatches,
+                          int longPatterns) {
     const int gid = get_group_id(0); // Work Group ID
 
     // Calculate the index of the first character in the Work Group.
@@ -235,6 +499,8 @@ __kernel void pfacCompact(image1d_buffer_t initialTransitions,
 
     int inputIndex  = get_global_id(0);
 
+    global int* stopGroup = (global int*)(smem + get_num_groups(0));
+
     /**
      * Local (i.e. shared by all threads in the Work Group) memory arrays.
      * Note cache is bigger than the WORK_GROUP_SIZE + MAX_PATTERN_SIZE used in
@@ -246,7 +512,41 @@ __kernel void pfacCompact(image1d_buffer_t initialTransitions,
     local unsigned char* buffer = (local unsigned char*)cache;
 
     // Load the initialTransitions table to local (shared) memory.
-    initialTransitionsCache[tid] = read_imagei(initialTransitions, tid).x;
+    initialTransitionsCache[tid] = READ_TRANSITION(initialTransitions, tid);
+
+#if TABLE_STORAGE == STORAGE_LOCAL
+    // Copy the hash tables to local memory, ordered by the barrier below.
+    local uint hashRowCache[HASH_ROW_SIZE];
+    local uint hashValCache[HASH_VAL_SIZE];
+    loadHashTables(hashRow, hashVal, hashRowCache, hashValCache, tid);
+#endif
+
+    /**
+     * For a batch of packed messages (messageCount > 0) find the range of
+     * messages containing the characters this Work Group starts matches from,
+     * which bounds each Work Item's search for the end of its message.
+     */
+    local int messageRange[2];
+
+    /**
+     * If an earlier Work Group already took the match count past limit none of
+     * this Work Group's matches can be written, so it skips the walk and takes
+     * part in the prefix sum with no matches.
+     */
+    local int skip;
+    if (tid == 0) {
+        const int stop = atomic_add(stopGroup, 0); // Force atomic load.
+        skip = stop != INVALID && stop < gid;
+    }
+
+    if (messageCount > 0 && tid == 0) {
+        const int lastChar = firstCharInWorkGroup + WORK_GROUP_SIZE*sizeof(int) - 1;
+        messageRange[0] = findMessage(messageEnds, 0, messageCount,
+                                      firstCharInWorkGroup);
+        messageRange[1] = min(findMessage(messageEnds, messageRange[0],
+                                          messageCount, lastChar) + 1,
+                              messageCount);
+    }
 
     // Read input data from global memory to local (shared) memory, n is the
     // number of OpenCL integers that would completely contain the input bytes.
@@ -272,28 +572,33 @@ __kernel void pfacCompact(image1d_buffer_t initialTransitions,
         const int j = tid + i * WORK_GROUP_SIZE;
         int pos = j;
 
-        if (pos >= bufferSize) break;
+        if (pos >= bufferSize || skip) break;
 
-        int inputChar = buffer[pos];
-        int nextState = initialTransitionsCache[inputChar];
-        if (nextState != INVALID) {
-            if (nextState < initialState) {
-                match[i] = nextState;
-//printf("xx matched pattern %d at %d, i = %d\n", nextState, j, i);
-            }
-            pos = pos + 1;
-            while (pos < bufferSize) {
-                inputChar = buffer[pos];
-                nextState = lookup(hashRow, hashVal, nextState, inputChar);
-                if (nextState == INVALID) {
-                    break;
-                }
+        const int end = matchEnd(messageEnds, messageCount, messageRange,
+                                 firstCharInWorkGroup, pos, inputSize);
 
-                if (nextState < initialState) {
-                    match[i] = nextState;
-//printf("matched pattern %d at %d, i = %d\n", nextState, j, i);
-                }
-                pos = pos + 1;
+        match[i] = pfacMatch(initialTransitionsCache, bigramTransitions,
+                             HASH_ROW(hashRow), HASH_VAL(hashVal),
+                             INITIAL_STATE(initialState),
+                             USE_BIGRAM_TABLE(useBigramTable),
+                             buffer, pos, min(bufferSize, end - firstCharInWorkGroup),
+                             (global const uchar*)input, firstCharInWorkGroup,
+                             LONG_PATTERNS(longPatterns) ? end : 0);
+    }
+
+    /**
+     * The number of matches at each character, normally one if there is a
+     * match. With allMatches the shorter patterns that are prefixes of the
+     * longest match are reported too, so following the precomputed prefixLink
+     * chain from the longest match counts every pattern matching there.
+     */
+    int matchCount[4];
+    #pragma unroll
+    for (int i = 0; i < 4; i++) {
+        matchCount[i] = match[i] >= 0;
+        if (allMatches && match[i] >= 0) {
+            for (int prefix = prefixLink[match[i]]; prefix >= 0; prefix = prefixLink[prefix]) {
+                matchCount[i]++;
             }
         }
     }
@@ -367,6 +672,9 @@ __kernel void pfacCompact(image1d_buffer_t initialTransitions,
      *
      * The fifth step uses the inter Work Group prefix sum values computed in
      * step four as globalOffset to perform final compaction as detailed below.
+     *
+     * With allMatches the scan is of matchCount rather than boolean, so each
+     * scan entry (minus one) is the index of the last match at that character.
      */
     int scan[4]; // We need an array as we have four results per thread.
     //local int* warpSum = initialTransitionsCache; // Reuse shared memory.
@@ -375,7 +683,7 @@ __kernel void pfacCompact(image1d_buffer_t initialTransitions,
     #pragma unroll
     for (int i = 0; i < 4; i++) {
         const int id = tid + i*WORK_GROUP_SIZE;
-        cache[id] = (id == 0) ? (match[i] >= 0) : (match[i] >= 0) + cache[id - 1];
+        cache[id] = (id == 0) ? matchCount[i] : matchCount[i] + cache[id - 1];
         barrier(CLK_LOCAL_MEM_FENCE);
         scan[i] = cache[id] - 1;
 //printf("gid %d, tid %d, i %d, idata %d, scan %u\n", gid, tid, i, match[i] >= 0, scan[i]);
@@ -432,6 +740,10 @@ count++;
             cache[0] = exclusivePrefix; // Store global offset to shared memory.
             smem[gid].inclusivePrefix = workGroupSum + exclusivePrefix;
         }
+
+        if (workGroupSum + cache[0] > limit) {
+            atomic_cmpxchg(stopGroup, INVALID, gid); // Later Work Groups skip.
+        }
         write_mem_fence(CLK_GLOBAL_MEM_FENCE);
     }
  	barrier(CLK_LOCAL_MEM_FENCE);
@@ -439,6 +751,10 @@ count++;
     int globalOffset = cache[0];
  	barrier(CLK_LOCAL_MEM_FENCE);
 
+    if (globalOffset >= limit) {
+        return; // Uniform across the Work Group, so safe before the barrier below.
+    }
+
 //printf("gid %d, tid %d, globalOffset %d\n", gid, tid, globalOffset);
 //if (tid == 0) printf("gid %d, workGroupSum = %d, globalOffset = %d\n", gid, workGroupSum, globalOffset);
 
@@ -449,6 +765,28 @@ count++;
      * cache are copied to the output array, which uses globalOffset to provide
      * the correct global index.
      */
+    if (allMatches) {
+        /**
+         * A Work Group may then have more matches than the cache can hold, so
+         * each Work Item writes its matches straight to the output array. The
+         * prefixLink chain runs from longest to shortest, so it is written
+         * backwards from the last index, putting the shorter patterns first.
+         */
+        #pragma unroll
+        for (int i = 0; i < 4; i++) {
+            const int index = firstCharInWorkGroup + tid + i*WORK_GROUP_SIZE;
+            int outputIndex = globalOffset + scan[i];
+            for (int value = match[i]; value >= 0; value = prefixLink[value]) {
+                if (outputIndex < limit) {
+                    output[outputIndex].index = index;
+                    output[outputIndex].value = value;
+                }
+                outputIndex--;
+            }
+        }
+        return;
+    }
+
     local MatchEntry* outputCache = (local MatchEntry*)cache;
 
     #pragma unroll    
@@ -466,3 +804,206 @@ count++;
     }
 }
 
+
+/**
+ * PFAC + Reduction Kernel, for rules that only need a summary of the matches.
+ * The state machine is run as in the pfac Kernel but rather than writing a
+ * result per character only the reduction selected by mode is written:
+ *
+ * REDUCE_COUNT:     result[0] is incremented by the number of matches.
+ * REDUCE_HISTOGRAM: result[patternID] is incremented for each match.
+ * REDUCE_FIRST:     result[0] is reduced to the index of the earliest match
+ *                   via atomic_min, so should initially hold inputSize. The
+ *                   earliest match found by each Work Group is written to its
+ *                   groupFirst entry, so the pattern ID of the overall first
+ *                   match may be read from groupFirst[result[0]/(WORK_GROUP_SIZE*4)].
+ *                   Work Groups starting after a match already found exit early.
+ *
+ * The result buffer must be zeroed before REDUCE_COUNT and REDUCE_HISTOGRAM.
+ */
+__kernel void pfacReduce(TRANSITION_TABLE initialTransitions,
+                         TRANSITION_TABLE bigramTransitions,
+                         HASH_TABLE hashRow,
+                         HASH_TABLE hashVal,
+                         int initialState,
+                         int useBigramTable,
+                         global int* input,
+                         global int* result,
+                         global MatchEntry* groupFirst,
+                         int inputSize, // Input size in bytes.
+                         int n,
+                         int mode,
+                         int longPatterns) {
+    const int gid = get_group_id(0); // Work Group ID
+
+    // Calculate the index of the first character in the Work Group.
+    const int firstCharInWorkGroup = gid * WORK_GROUP_SIZE * sizeof(int);
+
+    // Calculate remaining characters, starting from firstCharInWorkGroup.
+    const int remaining = inputSize - firstCharInWorkGroup;
+
+    // Calculate the local memory buffer size in bytes, noting that the last
+    // work-group may contain fewer characters than the maximum buffer size.
+    const int MAX_BUFFER_SIZE = (WORK_GROUP_SIZE + MAX_PATTERN_SIZE) * sizeof(int);
+    const int bufferSize = min(remaining, MAX_BUFFER_SIZE);
+
+    const int tid = get_local_id(0); // Thread (Work Item) ID
+
+    int inputIndex  = get_global_id(0);
+
+    // Local (i.e. shared by all threads in the Work Group) memory arrays.
+    local int initialTransitionsCache[WORK_GROUP_SIZE];
+    local int cache[WORK_GROUP_SIZE + MAX_PATTERN_SIZE];
+    local unsigned char* buffer = (local unsigned char*)cache;
+
+    /**
+     * groupResult holds the Work Group's match count or earliest match
+     * position. skip is set if an earlier Work Group has already found a
+     * match, it is shared so that the whole Work Group exits together.
+     */
+    local int groupResult;
+    local int skip;
+    if (tid == 0) {
+        groupResult = (mode == REDUCE_FIRST) ? bufferSize : 0;
+        skip = (mode == REDUCE_FIRST) &&
+               (atomic_add(&result[0], 0) < firstCharInWorkGroup);
+    }
+
+    // Load the initialTransitions table to local (shared) memory.
+    initialTransitionsCache[tid] = READ_TRANSITION(initialTransitions, tid);
+
+#if TABLE_STORAGE == STORAGE_LOCAL
+    // Copy the hash tables to local memory, ordered by the barrier below.
+    local uint hashRowCache[HASH_ROW_SIZE];
+    local uint hashValCache[HASH_VAL_SIZE];
+    loadHashTables(hashRow, hashVal, hashRowCache, hashValCache, tid);
+#endif
+
+    // Read input data from global memory to local (shared) memory, n is the
+    // number of OpenCL integers that would completely contain the input bytes.
+    if (inputIndex < n) {
+        cache[tid] = input[inputIndex];
+    }
+
+    // Read extra input data as we need overlaps to mitigate boundary condition.
+    inputIndex += WORK_GROUP_SIZE;
+    if ((inputIndex < n) && (tid < MAX_PATTERN_SIZE)) {
+        cache[tid + WORK_GROUP_SIZE] = input[inputIndex];
+    }
+
+    // Block until all Work Items in the Work Group have reached this point
+    // to ensure correct ordering of memory operations to local memory.
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (skip) return;
+
+    int count = 0;
+    int firstPos = bufferSize;
+    int firstMatch = -1;
+
+    // Perform state machine look-up with each thread processing four characters.
+    #pragma unroll
+    for (int i = 0; i < 4; i++) {
+        const int pos = tid + i * WORK_GROUP_SIZE;
+
+        if (pos >= bufferSize) break;
+
+        const int match = pfacMatch(initialTransitionsCache, bigramTransitions,
+                                    HASH_ROW(hashRow), HASH_VAL(hashVal),
+                                    INITIAL_STATE(initialState),
+                                    USE_BIGRAM_TABLE(useBigramTable),
+                                    buffer, pos, bufferSize,
+                                    (global const uchar*)input, firstCharInWorkGroup,
+                                    LONG_PATTERNS(longPatterns) ? inputSize : 0);
+
+        if (match >= 0) {
+            if (mode == REDUCE_COUNT) {
+                count++;
+            } else if (mode == REDUCE_HISTOGRAM) {
+                atomic_inc(&result[match]);
+            } else { // Later characters can't be earlier, so stop at the first.
+                firstPos = pos;
+                firstMatch = match;
+                break;
+            }
+        }
+    }
+
+    // Reduce across the Work Group in local memory, then once to global memory.
+    if (mode == REDUCE_COUNT && count > 0) {
+        atomic_add(&groupResult, count);
+    } else if (mode == REDUCE_FIRST && firstMatch >= 0) {
+        atomic_min(&groupResult, firstPos);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (mode == REDUCE_COUNT && tid == 0 && groupResult > 0) {
+        atomic_add(&result[0], groupResult);
+    } else if (mode == REDUCE_FIRST && firstMatch >= 0 && firstPos == groupResult) {
+        // Only one Work Item holds the Work Group's earliest match.
+        groupFirst[gid].index = firstCharInWorkGroup + firstPos;
+        groupFirst[gid].value = firstMatch;
+        atomic_min(&result[0], firstCharInWorkGroup + firstPos);
+    }
+}
+
+/**
+ * Span Kernel, a post-pass over the count matches written by pfacCompact that
+ * adds the end of each match, read from the patternLength table, writing the
+ * resulting MatchSpans to output.
+ *
+ * With leftmostLongest the matches are instead reduced to the non-overlapping
+ * leftmost-longest selection, the first match then each next match starting
+ * at or after the end of the last one selected, and the Kernel must be run as
+ * a single Work Group. The matches are in position order, so the Work Items
+ * first find the next candidate for every match by binary search, filling
+ * next, which must hold count + 1 ints. Each choice depends on the last, so
+ * the first Work Item then follows these links from the first match, which
+ * only visits the selected matches, writing them to output and their number
+ * to next[count].
+ */
+__kernel void pfacSpans(global const MatchEntry* matches,
+                        int count,
+                        global const int* patternLength,
+                        global MatchSpan* output,
+                        global int* next,
+                        int leftmostLongest) {
+    if (!leftmostLongest) {
+        const int i = get_global_id(0);
+        if (i < count) {
+            const MatchEntry match = matches[i];
+            output[i].index = match.index;
+            output[i].end = match.index + patternLength[match.value];
+            output[i].value = match.value;
+        }
+        return;
+    }
+
+    for (int i = get_local_id(0); i < count; i += get_local_size(0)) {
+        const int end = matches[i].index + patternLength[matches[i].value];
+        int lo = i + 1;
+        int hi = count;
+        while (lo < hi) {
+            const int mid = (lo + hi)/2;
+            if (matches[mid].index < end) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        next[i] = lo;
+    }
+    barrier(CLK_GLOBAL_MEM_FENCE);
+
+    if (get_local_id(0) == 0) {
+        int selected = 0;
+        for (int i = 0; i < count; i = next[i]) {
+            const MatchEntry match = matches[i];
+            output[selected].index = match.index;
+            output[selected].end = match.index + patternLength[match.value];
+            output[selected].value = match.value;
+            selected++;
+        }
+        next[count] = selected;
+    }
+}
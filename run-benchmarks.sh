@@ -840,3 +840,21 @@ echo
 ./simple-benchmark-threaded-compact -t words -L 16384 -D OpenCL:GPU[1] -T 4
 echo
 
+################################################################################
+echo
+echo
+echo Host engine comparison, PFAC vs Aho-Corasick DPAC, input size 1500000
+echo
+./simple-benchmark -t test16384 -s 1500000 -i 100 -D Host:CPU[0]
+./simple-benchmark -t test16384 -s 1500000 -i 100 -D Host:CPU[1]
+./simple-benchmark-compact -t test16384 -s 1500000 -i 100 -D Host:CPU[0]
+./simple-benchmark-compact -t test16384 -s 1500000 -i 100 -D Host:CPU[1]
+echo
+################################################################################
+echo
+echo
+echo Bigram root table, input size 1500000
+echo
+./simple-benchmark-bigram -t test16384 -s 1500000
+./simple-benchmark-bigram -t test16384 -s 1500000 -D Host:CPU[0] -i 100
+echo
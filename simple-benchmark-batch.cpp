@@ -0,0 +1,207 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include "pfac.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Return the time taken to call f iterations times, in seconds.
+ */
+template<typename F>
+static double time(const int iterations, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < iterations; i++) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()/1e6;
+}
+
+/**
+ * Batch scan benchmark. Parses command line arguments then cuts messages of
+ * random sizes between the minimum and maximum from random offsets of the
+ * input text. The messages are scanned one PFAC::scan call at a time and then
+ * as a batch by a single PFAC::scan call, the results are checked to be the
+ * same and the messages per second for each approach is shown.
+ */
+int main(int argc, char** argv) {
+    int iterations = 10;
+    std::size_t count = 10000;
+    std::size_t minSize = 200;
+    std::size_t maxSize = 2000;
+    std::size_t bufferSize = 1048576;
+    std::string dictionary = "words";
+    std::string text = "the fat cat sat on the mat and acted like a prat";
+    std::string _usage = 
+        "Usage: " + std::string(argv[0]) + " [OPTIONS]\n" \
+        "Options:\n" \
+        "  -h, --help                       show this help message and exit\n" \
+        "  -l, --list                       list available devices and exit\n" \
+        "  -D <device>, --device <device>   device to use\n" \
+        "  -d <dict>, --dictionary <dict>   dictionary file to use, default = " + dictionary + "\n" \
+        "  -t <text>, --text <text>         text file to use, default = stdin\n" \
+        "  -n <count>, --count <count>      number of messages, default = " + std::to_string(count) + "\n" \
+        "  -m <size>, --min <size>          minimum message size, default = " + std::to_string(minSize) + "\n" \
+        "  -M <size>, --max <size>          maximum message size, default = " + std::to_string(maxSize) + "\n" \
+        "  -b <size>, --buffer <size>       Device buffer size, default = " + std::to_string(bufferSize) + "\n" \
+        "  -o <mode>, --output <mode>       dense or compact output, default = compact\n" \
+        "  -i <count>, --iterations <count> number of iterations, default = " + std::to_string(iterations) + "\n" \
+        "Examples:\n" \
+        "  # Scan 10000 messages of 200 to 2000 bytes of the file \"words\"\n" \
+        "  " + std::string(argv[0]) + " -t words\n\n" \
+        "  # Scan 100000 messages of 64 to 256 bytes with dense output\n" \
+        "  " + std::string(argv[0]) + " -t words -n 100000 -m 64 -M 256 -o dense\n\n";
+
+    std::string device = gimbatuluk::PFAC::getAvailableDevices()[0];
+    bool textIsFile = false;
+    bool dense = false;
+
+    if (argc > 1) {
+        if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
+            std::cout << _usage;
+            std::exit(EXIT_SUCCESS);
+        } else if (std::string(argv[1]) == "-l" || std::string(argv[1]) == "--list") {
+            for (auto device : gimbatuluk::PFAC::getAvailableDevices()) {
+                std::cout << device << std::endl;
+            }
+            std::exit(EXIT_SUCCESS);
+        }
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg[0] == '-') {
+                i++;
+                std::string val = argv[i];
+                if (arg == "-D" || arg == "--device") {
+                    device = val;
+                } else if (arg == "-d" || arg == "--dictionary") {
+                    dictionary = val;
+                } else if (arg == "-t" || arg == "--text") {
+                    text = val;
+                    textIsFile = true;
+                } else if (arg == "-n" || arg == "--count") {
+                    count = std::stoul(val);
+                } else if (arg == "-m" || arg == "--min") {
+                    minSize = std::stoul(val);
+                } else if (arg == "-M" || arg == "--max") {
+                    maxSize = std::stoul(val);
+                } else if (arg == "-b" || arg == "--buffer") {
+                    bufferSize = std::stoul(val);
+                } else if (arg == "-o" || arg == "--output") {
+                    dense = (val == "dense");
+                } else if (arg == "-i" || arg == "--iterations") {
+                    iterations = std::stoi(val);
+                }
+            } else {
+                text = arg;
+            }
+        }
+    }
+
+    try {
+        // Read the text we want to cut the messages from into memory.
+        const auto source = textIsFile ? gimbatuluk::readFile(text) :
+                                         std::vector<char>(text.begin(), text.end());
+
+        // Use a fixed seed so that runs are repeatable.
+        std::mt19937 random(42);
+        std::uniform_int_distribution<std::size_t> sizes(minSize, maxSize);
+        std::uniform_int_distribution<std::size_t> offsets(0, source.size() - 1);
+
+        std::size_t total = 0;
+        std::vector<std::vector<char>> messages(count);
+        for (auto& message : messages) {
+            message.resize(sizes(random));
+            const auto offset = offsets(random);
+            for (auto i = 0u; i < message.size(); i++) {
+                message[i] = source[(offset + i) % source.size()];
+            }
+            total += message.size();
+        }
+
+        std::cout << "Using Device: " << device << std::endl;
+        gimbatuluk::PFAC pfac(device, bufferSize);
+        pfac.loadDictionary(gimbatuluk::readFile(dictionary));
+        pfac.installDictionary();
+
+        double loopTime = 0.0;
+        double batchTime = 0.0;
+        bool matched = true;
+        if (dense) {
+            std::vector<std::vector<std::int32_t>> loopOutput(count);
+            std::vector<std::vector<std::int32_t>> batchOutput;
+            loopTime = time(iterations, [&] {
+                for (auto i = 0u; i < count; i++) {
+                    pfac.scan(messages[i], loopOutput[i]);
+                }
+            });
+            batchTime = time(iterations, [&] {
+                pfac.scan(messages, batchOutput);
+            });
+            matched = loopOutput == batchOutput;
+        } else {
+            std::vector<std::vector<gimbatuluk::MatchEntry>> loopOutput(count);
+            std::vector<std::vector<gimbatuluk::MatchEntry>> batchOutput;
+            loopTime = time(iterations, [&] {
+                for (auto i = 0u; i < count; i++) {
+                    pfac.scan(messages[i], loopOutput[i]);
+                }
+            });
+            batchTime = time(iterations, [&] {
+                pfac.scan(messages, batchOutput);
+            });
+            for (auto i = 0u; matched && i < count; i++) {
+                matched = loopOutput[i].size() == batchOutput[i].size();
+                for (auto j = 0u; matched && j < loopOutput[i].size(); j++) {
+                    matched = loopOutput[i][j].index == batchOutput[i][j].index &&
+                              loopOutput[i][j].value == batchOutput[i][j].value;
+                }
+            }
+        }
+
+        std::cout << "Batch results " << (matched ? "match" : "DO NOT match")
+                  << " the per message results" << std::endl;
+        std::cout << "Messages = " << count << std::endl;
+        std::cout << "Data size = " << total << std::endl;
+        std::cout << "Iterations = " << iterations << std::endl;
+        std::cout << "\nper message scan time = " << loopTime << std::endl;
+        std::cout << "per message messages/s = " << count*iterations/loopTime << std::endl;
+        std::cout << "per message bandwidth (MB/s) = "
+                  << total*1e-6*iterations/loopTime << std::endl;
+        std::cout << "\nbatch scan time = " << batchTime << std::endl;
+        std::cout << "batch messages/s = " << count*iterations/batchTime << std::endl;
+        std::cout << "batch bandwidth (MB/s) = "
+                  << total*1e-6*iterations/batchTime << std::endl;
+        std::cout << "\nspeedup = " << loopTime/batchTime << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Fatal error, caught exception: " << e.what() << std::endl;
+    }
+}
@@ -25,17 +25,21 @@
 #include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 /**
  * Simple benchmark for the text scanner. Parses command line arguments then
  * reads the dictionary and input text and times the pattern scanner over a
- * number of iterations to determine the throughput.
+ * number of iterations to determine the throughput. The mode selects either
+ * the compact scan, the all matches scan, a span scan or one of the reduced
+ * scans, whose result is first checked against the compact scan.
  */
 int main(int argc, char** argv) {
     int limit = -1;
     int iterations = 10000;
+    std::string mode = "compact";
     std::string dictionary = "words";
     std::string text = "the fat cat sat on the mat and acted like a prat";
     std::string _usage = 
@@ -49,12 +53,16 @@ int main(int argc, char** argv) {
         "  -s <size>, --size <size>         data size, default = text size\n" \
         "  -i <count>, --iterations <count> number of iterations, default = " + std::to_string(iterations) + "\n" \
         "  -L <limit>, --limit <limit>    maximum number of results returned, default = unlimited\n" \
+        "  -m <mode>, --mode <mode>         compact, all, spans, leftmost, count,\n" \
+        "                                   histogram or first, default = " + mode + "\n" \
         "Examples:\n" \
         "  # Scan \"" + text + "\"\n" \
         "  # padded out to 1300000 bytes for " + std::to_string(iterations) + " iterations\n" \
         "  " + std::string(argv[0]) + " -s 1300000\n\n" \
         "  # Scan the text of the file \"words\" for 1000 iterations\n" \
         "  " + std::string(argv[0]) + " -t words -i 1000\n\n" \
+        "  # Count the matches in the text of the file \"words\" for 1000 iterations\n" \
+        "  " + std::string(argv[0]) + " -t words -i 1000 -m count\n\n" \
         "  # Scan the text of the file \"words\" for " + std::to_string(iterations) + " iterations\n" \
         "  # using the second OpenCL GPU Device (if available)\n" \
         "  " + std::string(argv[0]) + " -t words -D OpenCL:GPU[1]\n\n";
@@ -92,6 +100,8 @@ int main(int argc, char** argv) {
                     iterations = std::stoi(val);
                 } else if (arg == "-L" || arg == "--limit") {
                     limit = std::stoi(val);
+                } else if (arg == "-m" || arg == "--mode") {
+                    mode = val;
                 }
             } else {
                 text = arg;
@@ -124,10 +134,97 @@ int main(int argc, char** argv) {
         // Compile and install dictionary onto Device.
         pfac.installDictionary();
 
+        // Check the reduced scan result against the full compact scan.
+        std::vector<std::uint32_t> histogram;
+        std::vector<gimbatuluk::MatchEntry> allOutput;
+        std::vector<gimbatuluk::MatchSpan> spans;
+        if (mode == "compact") {
+            const auto result = pfac.scan(input, output, limit);
+            std::cout << "Found " << result.count << " matches" <<
+                         (result.truncated ? ", truncated from at least " +
+                                             std::to_string(result.total) : "") <<
+                         std::endl;
+        } else {
+            pfac.scan(input, output);
+            bool matched = true;
+            if (mode == "all") {
+                // The last match at each position is the longest, as found by
+                // the compact scan.
+                pfac.scanAll(input, allOutput);
+                std::size_t j = 0;
+                for (std::size_t i = 0; i < allOutput.size(); i++) {
+                    if (i + 1 == allOutput.size() ||
+                        allOutput[i + 1].index != allOutput[i].index) {
+                        matched = matched && j < output.size() &&
+                                  allOutput[i].index == output[j].index &&
+                                  allOutput[i].value == output[j].value;
+                        j++;
+                    }
+                }
+                matched = matched && j == output.size();
+                std::cout << "Found " << allOutput.size() << " matches, " <<
+                             output.size() << " longest" << std::endl;
+            } else if (mode == "spans" || mode == "leftmost") {
+                // The leftmost-longest spans are those of the compact scan
+                // starting at or after the end of the previous one selected.
+                if (mode == "spans") {
+                    pfac.scan(input, spans);
+                } else {
+                    pfac.scanLeftmostLongest(input, spans);
+                }
+                std::size_t j = 0;
+                std::int32_t end = 0;
+                for (const auto& match : output) {
+                    if (mode == "spans" || match.index >= end) {
+                        matched = matched && j < spans.size() &&
+                                  spans[j].index == match.index &&
+                                  spans[j].value == match.value &&
+                                  spans[j].end > match.index;
+                        end = j < spans.size() ? spans[j].end : end;
+                        j++;
+                    }
+                }
+                matched = matched && j == spans.size();
+                std::cout << "Found " << spans.size() << " spans" << std::endl;
+            } else if (mode == "count") {
+                matched = pfac.countMatches(input) == output.size();
+            } else if (mode == "histogram") {
+                pfac.matchHistogram(input, histogram);
+                for (auto match : output) {
+                    histogram[match.value]--;
+                }
+                for (auto count : histogram) {
+                    matched = matched && count == 0;
+                }
+            } else if (mode == "first") {
+                const auto first = pfac.firstMatch(input);
+                matched = output.empty() ? first.index == -1 :
+                          first.index == output[0].index && first.value == output[0].value;
+            } else {
+                throw std::runtime_error("Unknown mode \"" + mode + "\"");
+            }
+            std::cout << "Mode " << mode << " result " << (matched ? "matches" :
+                         "DOES NOT match") << " the compact scan" << std::endl;
+        }
+
         auto start = std::chrono::steady_clock::now();
 
         for (auto i = 0; i < iterations; i++) {
-            pfac.scan(input, output, limit);
+            if (mode == "all") {
+                pfac.scanAll(input, allOutput, limit);
+            } else if (mode == "spans") {
+                pfac.scan(input, spans, limit);
+            } else if (mode == "leftmost") {
+                pfac.scanLeftmostLongest(input, spans, limit);
+            } else if (mode == "count") {
+                pfac.countMatches(input);
+            } else if (mode == "histogram") {
+                pfac.matchHistogram(input, histogram);
+            } else if (mode == "first") {
+                pfac.firstMatch(input);
+            } else {
+                pfac.scan(input, output, limit);
+            }
         }
 
         auto end = std::chrono::steady_clock::now();
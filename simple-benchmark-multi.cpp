@@ -0,0 +1,202 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include "pfac.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Multi Device benchmark. Parses command line arguments then reads the
+ * dictionary and input text, checks that a MultiScanner over the selected
+ * Devices gives the same results as a single PFAC instance, then times it over
+ * a number of iterations to determine the throughput. By default the input is
+ * split across the Devices, with -m it is instead cut into messages of the
+ * given size which are routed whole to the Devices.
+ */
+int main(int argc, char** argv) {
+    int iterations = 100;
+    std::string dictionary = "words";
+    std::string text = "the fat cat sat on the mat and acted like a prat";
+    std::string _usage = 
+        "Usage: " + std::string(argv[0]) + " [OPTIONS]\n" \
+        "Options:\n" \
+        "  -h, --help                       show this help message and exit\n" \
+        "  -l, --list                       list available devices and exit\n" \
+        "  -D <list>, --devices <list>      comma separated devices to use, default = all OpenCL + Host:CPU[0]\n" \
+        "  -d <dict>, --dictionary <dict>   dictionary file to use, default = " + dictionary + "\n" \
+        "  -t <text>, --text <text>         text file to use, default = stdin\n" \
+        "  -s <size>, --size <size>         data size, default = text size\n" \
+        "  -m <size>, --message <size>      route messages of this size, default = split input\n" \
+        "  -i <count>, --iterations <count> number of iterations, default = " + std::to_string(iterations) + "\n" \
+        "Examples:\n" \
+        "  # Scan the text of the file \"words\" on both GPUs and the host CPU\n" \
+        "  " + std::string(argv[0]) + " -t words -D OpenCL:GPU[0],OpenCL:GPU[1],Host:CPU[0]\n\n" \
+        "  # Scan 1000 byte messages of the file \"words\" on the default Devices\n" \
+        "  " + std::string(argv[0]) + " -t words -m 1000\n\n";
+
+    std::vector<std::string> devices;
+    bool textIsFile = false;
+    int size = 0;
+    int messageSize = 0;
+
+    if (argc > 1) {
+        if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
+            std::cout << _usage;
+            std::exit(EXIT_SUCCESS);
+        } else if (std::string(argv[1]) == "-l" || std::string(argv[1]) == "--list") {
+            for (auto device : gimbatuluk::PFAC::getAvailableDevices()) {
+                std::cout << device << std::endl;
+            }
+            std::exit(EXIT_SUCCESS);
+        }
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg[0] == '-') {
+                i++;
+                std::string val = argv[i];
+                if (arg == "-D" || arg == "--devices") {
+                    std::stringstream stream(val);
+                    std::string device;
+                    while (std::getline(stream, device, ',')) {
+                        devices.push_back(device);
+                    }
+                } else if (arg == "-d" || arg == "--dictionary") {
+                    dictionary = val;
+                } else if (arg == "-t" || arg == "--text") {
+                    text = val;
+                    textIsFile = true;
+                } else if (arg == "-s" || arg == "--size") {
+                    size = std::stoi(val);
+                } else if (arg == "-m" || arg == "--message") {
+                    messageSize = std::stoi(val);
+                } else if (arg == "-i" || arg == "--iterations") {
+                    iterations = std::stoi(val);
+                }
+            } else {
+                text = arg;
+            }
+        }
+    }
+
+    try {
+        // Read the text we want to scan into memory.
+        auto input = textIsFile ? gimbatuluk::readFile(text) :
+                                  std::vector<char>(text.begin(), text.end());
+
+        if (size > 0) {
+            input.resize(size);
+        }
+
+        const auto DATA_SIZE_MB = input.size()*1e-6*iterations;
+        const auto patterns = gimbatuluk::readFile(dictionary);
+
+        // Each Device buffer need only hold a message, or a piece of the input.
+        const std::size_t bufferSize = messageSize > 0 ? messageSize :
+                                       (input.size() < 16000000 ? input.size() : 16000000);
+
+        gimbatuluk::MultiScanner multi(devices, bufferSize);
+        for (auto device : multi.getDeviceNames()) {
+            std::cout << "Using Device: " << device << std::endl;
+        }
+        multi.loadDictionary(patterns);
+        multi.installDictionary();
+
+        // Compute the expected results using the first Device on its own.
+        gimbatuluk::PFAC pfac(multi.getDeviceNames()[0], input.size());
+        pfac.loadDictionary(patterns);
+        pfac.installDictionary();
+        std::vector<gimbatuluk::MatchEntry> expected;
+        pfac.scan(input, expected);
+
+        std::vector<gimbatuluk::MatchEntry> output;
+        std::vector<std::vector<char>> messages;
+        std::vector<std::vector<gimbatuluk::MatchEntry>> messageOutput;
+        if (messageSize > 0) {
+            for (auto i = 0u; i < input.size(); i += messageSize) {
+                const auto end = (i + messageSize < input.size()) ? i + messageSize :
+                                                                    input.size();
+                messages.emplace_back(input.begin() + i, input.begin() + end);
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (auto i = 0; i < iterations; i++) {
+            if (messageSize > 0) {
+                multi.scan(messages, messageOutput);
+            } else {
+                multi.scan(input, output);
+            }
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        auto duration = std::chrono::
+            duration_cast<std::chrono::milliseconds>(end - start).count()/1000.0;
+
+        /**
+         * Check the results, messages are scanned separately so matches may
+         * not span them, so compare each with a single Device scan of itself.
+         */
+        bool matched = true;
+        if (messageSize > 0) {
+            for (auto i = 0u; i < messages.size(); i++) {
+                pfac.scan(messages[i], output);
+                matched = matched && output.size() == messageOutput[i].size();
+                for (auto j = 0u; matched && j < output.size(); j++) {
+                    matched = output[j].index == messageOutput[i][j].index &&
+                              output[j].value == messageOutput[i][j].value;
+                }
+            }
+        } else {
+            matched = output.size() == expected.size();
+            for (auto j = 0u; matched && j < output.size(); j++) {
+                matched = output[j].index == expected[j].index &&
+                          output[j].value == expected[j].value;
+            }
+        }
+        std::cout << "Results " << (matched ? "match" : "DO NOT match")
+                  << " the single Device results" << std::endl;
+
+        const auto throughput = multi.getThroughput();
+        for (auto i = 0u; i < throughput.size(); i++) {
+            std::cout << multi.getDeviceNames()[i] << " bandwidth (MB/s) = "
+                      << throughput[i] << std::endl;
+        }
+
+        std::cout << "Data size = " << input.size() << std::endl;
+        std::cout << "Iterations = " << iterations << std::endl;
+        std::cout << "\nscan time = " << duration << std::endl;
+        std::cout << "data sent (MB) = " << DATA_SIZE_MB << std::endl;
+        std::cout << "bandwidth (MB/s) = " << DATA_SIZE_MB/duration << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Fatal error, caught exception: " << e.what() << std::endl;
+    }
+}
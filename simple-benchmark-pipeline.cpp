@@ -0,0 +1,193 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include "pfac.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Parse a comma separated list of sizes, e.g. "1,2,4,8".
+ */
+static std::vector<std::size_t> parseList(const std::string& list) {
+    std::vector<std::size_t> values;
+    std::stringstream stream(list);
+    std::string value;
+    while (std::getline(stream, value, ',')) {
+        values.push_back(std::stoul(value));
+    }
+    return values;
+}
+
+/**
+ * Pipeline depth benchmark for the asynchronous text scanner. For each message
+ * size and pipeline depth a PFAC instance is created, the dictionary installed
+ * and the text (padded or truncated to the message size) scanned asynchronously
+ * until the given amount of data has been sent. The throughput for each pair
+ * is shown as a table with a row per message size, and the knee, the smallest
+ * depth reaching 95% of the best throughput for that message size, is marked.
+ *
+ * As with simple-benchmark-async the input and output are reused by every scan
+ * as only the throughput matters here, not the results.
+ */
+int main(int argc, char** argv) {
+    std::string dictionary = "words";
+    std::string text = "the fat cat sat on the mat and acted like a prat";
+    std::string depthList = "1,2,3,4,6,8,12,16";
+    std::string sizeList = "1024,4096,16384,65536,262144,1048576,4194304";
+    std::size_t megabytes = 256;
+    std::string _usage = 
+        "Usage: " + std::string(argv[0]) + " [OPTIONS]\n" \
+        "Options:\n" \
+        "  -h, --help                       show this help message and exit\n" \
+        "  -l, --list                       list available devices and exit\n" \
+        "  -D <device>, --device <device>   device to use\n" \
+        "  -d <dict>, --dictionary <dict>   dictionary file to use, default = " + dictionary + "\n" \
+        "  -t <text>, --text <text>         text file to use, default = stdin\n" \
+        "  -p <list>, --depths <list>       pipeline depths, default = " + depthList + "\n" \
+        "  -s <list>, --sizes <list>        message sizes, default = " + sizeList + "\n" \
+        "  -m <MB>, --megabytes <MB>        data to send per measurement, default = " + std::to_string(megabytes) + "\n" \
+        "Examples:\n" \
+        "  # Sweep the default depths and sizes scanning \"" + text + "\"\n" \
+        "  " + std::string(argv[0]) + "\n\n" \
+        "  # Sweep depths 1 to 4 for 1KB and 1MB messages of the file \"words\"\n" \
+        "  " + std::string(argv[0]) + " -t words -p 1,2,3,4 -s 1024,1048576\n\n";
+
+    std::string device = gimbatuluk::PFAC::getAvailableDevices()[0];
+    bool textIsFile = false;
+
+    if (argc > 1) {
+        if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
+            std::cout << _usage;
+            std::exit(EXIT_SUCCESS);
+        } else if (std::string(argv[1]) == "-l" || std::string(argv[1]) == "--list") {
+            for (auto device : gimbatuluk::PFAC::getAvailableDevices()) {
+                std::cout << device << std::endl;
+            }
+            std::exit(EXIT_SUCCESS);
+        }
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg[0] == '-') {
+                i++;
+                std::string val = argv[i];
+                if (arg == "-D" || arg == "--device") {
+                    device = val;
+                } else if (arg == "-d" || arg == "--dictionary") {
+                    dictionary = val;
+                } else if (arg == "-t" || arg == "--text") {
+                    text = val;
+                    textIsFile = true;
+                } else if (arg == "-p" || arg == "--depths") {
+                    depthList = val;
+                } else if (arg == "-s" || arg == "--sizes") {
+                    sizeList = val;
+                } else if (arg == "-m" || arg == "--megabytes") {
+                    megabytes = std::stoul(val);
+                }
+            } else {
+                text = arg;
+            }
+        }
+    }
+
+    try {
+        // Read the text and dictionary we want to use into memory.
+        const auto source = textIsFile ? gimbatuluk::readFile(text) :
+                                         std::vector<char>(text.begin(), text.end());
+        const auto patterns = gimbatuluk::readFile(dictionary);
+        const auto depths = parseList(depthList);
+        const auto sizes = parseList(sizeList);
+
+        std::cout << "Using Device: " << device << std::endl;
+        std::cout << "Throughput (MB/s), * marks the knee" << std::endl;
+        std::cout << std::setw(10) << "size";
+        for (auto depth : depths) {
+            std::cout << std::setw(12) << ("depth " + std::to_string(depth));
+        }
+        std::cout << std::endl;
+
+        for (auto size : sizes) {
+            // Repeat the text as necessary to fill the message.
+            std::vector<char> input(size);
+            for (auto i = 0u; i < size; i++) {
+                input[i] = source[i % source.size()];
+            }
+            std::vector<std::int32_t> output(size);
+
+            const std::size_t iterations = (megabytes*1000000 + size - 1)/size;
+            std::vector<double> bandwidth;
+            for (auto depth : depths) {
+                gimbatuluk::PFAC pfac(device, size, depth);
+                pfac.loadDictionary(patterns);
+                pfac.installDictionary();
+
+                std::atomic<std::size_t> completed(0);
+                auto start = std::chrono::steady_clock::now();
+
+                for (auto i = 0u; i < iterations; i++) {
+                    pfac.scan(input, output, [&completed](const std::vector<char>& input,
+                              std::vector<std::int32_t>& output) {
+                        completed++;
+                    });
+                }
+
+                // Wait for the pipeline to drain before stopping the clock.
+                while (completed < iterations) {
+                    std::this_thread::yield();
+                }
+
+                auto end = std::chrono::steady_clock::now();
+                auto duration = std::chrono::
+                    duration_cast<std::chrono::microseconds>(end - start).count()/1e6;
+                bandwidth.push_back(size*1e-6*iterations/duration);
+            }
+
+            double best = 0.0;
+            for (auto value : bandwidth) {
+                best = value > best ? value : best;
+            }
+
+            bool knee = false;
+            std::cout << std::setw(10) << size;
+            for (auto value : bandwidth) {
+                const bool isKnee = !knee && value >= 0.95*best;
+                knee = knee || isKnee;
+                std::cout << std::setw(11) << std::fixed << std::setprecision(1)
+                          << value << (isKnee ? "*" : " ");
+            }
+            std::cout << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Fatal error, caught exception: " << e.what() << std::endl;
+    }
+}
@@ -0,0 +1,160 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include "slot-pool.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * The mutex and condition variable store that SlotPool replaced, kept here as
+ * the baseline. get and release both take the mutex on every call.
+ */
+template<typename T>
+class MutexPool {
+public:
+    MutexPool(const std::size_t capacity): index(capacity + 1), value(capacity),
+                                           head(0), tail(0) {
+        for (auto i = 0u; i < capacity; i++) {
+            release(value[i]);
+        }
+    }
+
+    T& get() {
+        const int N = value.size();
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]{return head != tail;});
+        head = (head == N) ? 0 : head + 1;
+        return value[index[head]];
+    }
+
+    void release(const T& slot) {
+        const int N = value.size();
+        std::unique_lock<std::mutex> lock(mutex);
+        tail = (tail == N) ? 0 : tail + 1;
+        index[tail] = &slot - &value[0];
+        lock.unlock();
+        cond.notify_one();
+    }
+private:
+    std::vector<int> index;
+    std::vector<T> value;
+
+    int head;
+    int tail;
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+/**
+ * Time threads threads each getting and releasing operations slots from pool,
+ * checking that no slot is ever held by two threads at once, and return the
+ * throughput in millions of get/release pairs per second.
+ */
+template<typename Pool>
+static double run(Pool& pool, const int threads, const int operations) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (auto t = 0; t < threads; t++) {
+        workers.emplace_back([&pool, operations] {
+            for (auto i = 0; i < operations; i++) {
+                auto& slot = pool.get();
+                if (slot++ != 0) {
+                    std::cout << "Failed, slot acquired twice" << std::endl;
+                    std::abort();
+                }
+                slot--;
+                pool.release(slot);
+            }
+        });
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    auto duration = std::chrono::
+        duration_cast<std::chrono::microseconds>(end - start).count()/1e6;
+    return threads*1e-6*operations/duration;
+}
+
+/**
+ * Contention microbenchmark for the SlotPool backing the async scan callback
+ * store. A number of threads repeatedly get and release slots from a pool with
+ * fewer (or more) slots than threads, for the lock-free SlotPool and for the
+ * mutex and condition variable baseline, so the effect of contention on each
+ * may be compared.
+ */
+int main(int argc, char** argv) {
+    int threads = 2*std::thread::hardware_concurrency();
+    int capacity = 3;
+    int operations = 1000000;
+    std::string _usage = 
+        "Usage: " + std::string(argv[0]) + " [OPTIONS]\n" \
+        "Options:\n" \
+        "  -h, --help                         show this help message and exit\n" \
+        "  -T <count>, --threads <count>      number of threads, default = " + std::to_string(threads) + "\n" \
+        "  -c <count>, --capacity <count>     number of slots, default = " + std::to_string(capacity) + "\n" \
+        "  -i <count>, --iterations <count>   operations per thread, default = " + std::to_string(operations) + "\n";
+
+    if (argc > 1) {
+        if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
+            std::cout << _usage;
+            std::exit(EXIT_SUCCESS);
+        }
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg[0] == '-') {
+                i++;
+                std::string val = argv[i];
+                if (arg == "-T" || arg == "--threads") {
+                    threads = std::stoi(val);
+                } else if (arg == "-c" || arg == "--capacity") {
+                    capacity = std::stoi(val);
+                } else if (arg == "-i" || arg == "--iterations") {
+                    operations = std::stoi(val);
+                }
+            }
+        }
+    }
+
+    std::cout << "Threads = " << threads << std::endl;
+    std::cout << "Slots = " << capacity << std::endl;
+    std::cout << "Operations per thread = " << operations << std::endl;
+
+    gimbatuluk::SlotPool<int> slotPool(capacity);
+    std::cout << "\nSlotPool (M ops/s) = " << run(slotPool, threads, operations) << std::endl;
+
+    MutexPool<int> mutexPool(capacity);
+    std::cout << "MutexPool (M ops/s) = " << run(mutexPool, threads, operations) << std::endl;
+}
@@ -0,0 +1,130 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "pfac.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * Time from constructing a PFAC instance to the results of its first scan,
+ * which for OpenCL Devices is dominated by building the OpenCL Program when
+ * the Dictionary is installed. Starts are timed with the program cache
+ * disabled (cold), then once with it enabled, which populates the cache if
+ * it doesn't yet hold this build, then a number of times from the populated
+ * cache (warm). With -S the Program is specialised for the dictionary, so a
+ * cached start needs a binary built for that dictionary.
+ */
+double startup(const std::string& device, const std::vector<char>& patterns,
+               const std::vector<char>& input) {
+    auto start = std::chrono::steady_clock::now();
+
+    gimbatuluk::PFAC pfac(device, input.size());
+    pfac.loadDictionary(patterns);
+    pfac.installDictionary();
+    std::vector<gimbatuluk::MatchEntry> output;
+    pfac.scan(input, output);
+
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::
+        duration_cast<std::chrono::microseconds>(end - start).count()/1000.0;
+}
+
+int main(int argc, char** argv) {
+    int iterations = 10;
+    std::string device = "OpenCL:GPU[0]";
+    std::string dictionary = "words";
+    std::string text = "the fat cat sat on the mat and acted like a prat";
+    std::string cacheDirectory = gimbatuluk::getProgramCacheDirectory();
+    std::string _usage = 
+        "Usage: " + std::string(argv[0]) + " [OPTIONS]\n" \
+        "Options:\n" \
+        "  -h, --help                       show this help message and exit\n" \
+        "  -l, --list                       list available devices and exit\n" \
+        "  -D <device>, --device <device>   device to use, default = " + device + "\n" \
+        "  -d <dict>, --dictionary <dict>   dictionary file to use, default = " + dictionary + "\n" \
+        "  -c <dir>, --cache <dir>          program cache directory, default = " + cacheDirectory + "\n" \
+        "  -i <count>, --iterations <count> number of warm starts, default = " + std::to_string(iterations) + "\n" \
+        "  -S, --specialise                 build a Program specialised for the dictionary\n" \
+        "Examples:\n" \
+        "  # Time starts on the host CPU OpenCL Device with a fresh cache\n" \
+        "  " + std::string(argv[0]) + " -D OpenCL:CPU[0] -c /tmp/gimbatuluk-cache\n\n";
+
+    if (argc > 1) {
+        if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
+            std::cout << _usage;
+            std::exit(EXIT_SUCCESS);
+        } else if (std::string(argv[1]) == "-l" || std::string(argv[1]) == "--list") {
+            for (auto device : gimbatuluk::PFAC::getAvailableDevices()) {
+                std::cout << device << std::endl;
+            }
+            std::exit(EXIT_SUCCESS);
+        }
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-S" || arg == "--specialise") {
+                gimbatuluk::setSpecialisedPrograms(true);
+            } else if (arg[0] == '-') {
+                i++;
+                std::string val = argv[i];
+                if (arg == "-D" || arg == "--device") {
+                    device = val;
+                } else if (arg == "-d" || arg == "--dictionary") {
+                    dictionary = val;
+                } else if (arg == "-c" || arg == "--cache") {
+                    cacheDirectory = val;
+                } else if (arg == "-i" || arg == "--iterations") {
+                    iterations = std::stoi(val);
+                }
+            }
+        }
+    }
+
+    try {
+        const auto patterns = gimbatuluk::readFile(dictionary);
+        const std::vector<char> input(text.begin(), text.end());
+
+        std::cout << "Using Device: " << device << std::endl;
+        std::cout << "Program cache: " << cacheDirectory << std::endl;
+
+        gimbatuluk::setProgramCacheDirectory("");
+        const auto cold = startup(device, patterns, input);
+
+        gimbatuluk::setProgramCacheDirectory(cacheDirectory);
+        const auto first = startup(device, patterns, input);
+
+        auto warm = 0.0;
+        for (auto i = 0; i < iterations; i++) {
+            warm += startup(device, patterns, input);
+        }
+
+        std::cout << "\ncold start (ms) = " << cold << std::endl;
+        std::cout << "first cached start (ms) = " << first << std::endl;
+        std::cout << "warm start (ms) = " << warm/iterations << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Fatal error, caught exception: " << e.what() << std::endl;
+    }
+}
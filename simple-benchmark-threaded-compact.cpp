@@ -38,6 +38,7 @@
 int main(int argc, char** argv) {
     int limit = -1;
     int numThreads = 2;
+    int async = 0;
     int iterations = 10000;
     std::string dictionary = "words";
     std::string text = "the fat cat sat on the mat and acted like a prat";
@@ -53,6 +54,7 @@ int main(int argc, char** argv) {
         "  -i <count>, --iterations <count> number of iterations, default = " + std::to_string(iterations) + "\n" \
         "  -L <limit>, --limit <limit>    maximum number of results returned, default = unlimited\n" \
         "  -T <count>, --threads <count>    number of threads, default = " + std::to_string(numThreads) + "\n" \
+        "  -a <depth>, --async <depth>      scan async with depth scans in flight per thread, default = sync\n" \
         "Examples:\n" \
         "  # Scan \"" + text + "\"\n" \
         "  # padded out to 1300000 bytes for " + std::to_string(iterations) + " iterations\n" \
@@ -61,7 +63,9 @@ int main(int argc, char** argv) {
         "  " + std::string(argv[0]) + " -t words -i 1000\n\n" \
         "  # Scan the text of the file \"words\" for " + std::to_string(iterations) + " iterations\n" \
         "  # using the second OpenCL GPU Device (if available)\n" \
-        "  " + std::string(argv[0]) + " -t words -D OpenCL:GPU[1]\n\n";
+        "  " + std::string(argv[0]) + " -t words -D OpenCL:GPU[1]\n\n" \
+        "  # As above but with each thread keeping 3 async scans in flight\n" \
+        "  " + std::string(argv[0]) + " -t words -a 3\n\n";
 
     std::string device = gimbatuluk::PFAC::getAvailableDevices()[0];
     bool textIsFile = false;
@@ -98,6 +102,8 @@ int main(int argc, char** argv) {
                     numThreads = std::stoi(val);
                 } else if (arg == "-L" || arg == "--limit") {
                     limit = std::stoi(val);
+                } else if (arg == "-a" || arg == "--async") {
+                    async = std::stoi(val);
                 }
             } else {
                 text = arg;
@@ -107,7 +113,9 @@ int main(int argc, char** argv) {
 
     try {        
         std::cout << "Using " << numThreads 
-                  << " thread" << (numThreads > 1 ? "s" : "") << std::endl;
+                  << " thread" << (numThreads > 1 ? "s" : "")
+                  << (async > 0 ? ", async depth " + std::to_string(async) : "")
+                  << std::endl;
         std::vector<std::thread> threads;
 
         // Read the text we want to scan into memory.
@@ -126,11 +134,14 @@ int main(int argc, char** argv) {
 
         for (auto t = 0; t < numThreads; t++) {
             threads.push_back(std::thread([&]() {
-                // Create output vector.
-                std::vector<gimbatuluk::MatchEntry> output(input.size());
-
-                // Create scanner instance.
-                gimbatuluk::PFAC pfac(device, input.size());
+                // Create output vectors, one per async scan in flight.
+                const std::size_t depth = async > 0 ? async : 1;
+                std::vector<std::vector<gimbatuluk::MatchEntry>> output(depth);
+                std::vector<std::atomic<bool>> busy(depth);
+
+                // Create scanner instance, its destructor waits for any async
+                // scans still in flight so it's declared after their outputs.
+                gimbatuluk::PFAC pfac(device, input.size(), depth);
                 std::cout << "Using Device: " << pfac.getDeviceName() << std::endl;
 
                 // Read entire dictionary file into memory.
@@ -145,7 +156,23 @@ int main(int argc, char** argv) {
                 }
 
                 for (auto i = 0; i < iterations; i++) {
-                    pfac.scan(input, output, limit);
+                    const auto k = i % depth;
+                    if (async == 0) {
+                        pfac.scan(input, output[k], limit);
+                        continue;
+                    }
+
+                    // Wait for the scan last using this output to complete.
+                    while (busy[k]) {
+                        std::this_thread::yield();
+                    }
+                    busy[k] = true;
+                    pfac.scan(input, output[k],
+                              [&busy, k](const std::vector<char>& input,
+                                         std::vector<gimbatuluk::MatchEntry>& output,
+                                         const gimbatuluk::CompactResult& result) {
+                        busy[k] = false;
+                    }, limit);
                 }
             }));
         }
@@ -26,6 +26,7 @@
 #include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
@@ -38,6 +39,7 @@
 int main(int argc, char** argv) {
     int numThreads = 2;
     int iterations = 10000;
+    bool shared = false;
     std::string dictionary = "words";
     std::string text = "the fat cat sat on the mat and acted like a prat";
     std::string _usage = 
@@ -51,6 +53,7 @@ int main(int argc, char** argv) {
         "  -s <size>, --size <size>         data size, default = text size\n" \
         "  -i <count>, --iterations <count> number of iterations, default = " + std::to_string(iterations) + "\n" \
         "  -T <count>, --threads <count>    number of threads, default = " + std::to_string(numThreads) + "\n" \
+        "  -S, --shared                     share one scanner between the threads\n" \
         "Examples:\n" \
         "  # Scan \"" + text + "\"\n" \
         "  # padded out to 1300000 bytes for " + std::to_string(iterations) + " iterations\n" \
@@ -59,7 +62,9 @@ int main(int argc, char** argv) {
         "  " + std::string(argv[0]) + " -t words -i 1000\n\n" \
         "  # Scan the text of the file \"words\" for " + std::to_string(iterations) + " iterations\n" \
         "  # using the second OpenCL GPU Device (if available)\n" \
-        "  " + std::string(argv[0]) + " -t words -D OpenCL:GPU[1]\n\n";
+        "  " + std::string(argv[0]) + " -t words -D OpenCL:GPU[1]\n\n" \
+        "  # As above but with 4 threads sharing one scanner\n" \
+        "  " + std::string(argv[0]) + " -t words -T 4 -S\n\n";
 
     std::string device = gimbatuluk::PFAC::getAvailableDevices()[0];
     bool textIsFile = false;
@@ -78,7 +83,9 @@ int main(int argc, char** argv) {
 
         for (int i = 1; i < argc; i++) {
             std::string arg = argv[i];
-            if (arg[0] == '-') {
+            if (arg == "-S" || arg == "--shared") {
+                shared = true;
+            } else if (arg[0] == '-') {
                 i++;
                 std::string val = argv[i];
                 if (arg == "-D" || arg == "--device") {
@@ -103,7 +110,8 @@ int main(int argc, char** argv) {
 
     try {        
         std::cout << "Using " << numThreads 
-                  << " thread" << (numThreads > 1 ? "s" : "") << std::endl;
+                  << " thread" << (numThreads > 1 ? "s" : "")
+                  << (shared ? " sharing one scanner" : "") << std::endl;
         std::vector<std::thread> threads;
 
         // Read the text we want to scan into memory.
@@ -117,6 +125,28 @@ int main(int argc, char** argv) {
         const auto DATA_SIZE_MB = input.size()*1e-6*iterations*numThreads;
         const auto DATA_SIZE_GB = input.size()*1e-9*iterations*numThreads;
 
+        /**
+         * Create a scanner instance, reading the entire dictionary file into
+         * memory then compiling and installing it onto the Device. A scanner
+         * per thread only needs one pipeline slot for its synchronous scans,
+         * a shared scanner has a slot per thread, so that every thread may
+         * have a scan in flight, but one copy of everything else.
+         */
+        const auto createScanner = [&](const std::size_t pipelineDepth) {
+            std::unique_ptr<gimbatuluk::PFAC> pfac(
+                new gimbatuluk::PFAC(device, input.size(), pipelineDepth)
+            );
+            std::cout << "Using Device: " << pfac->getDeviceName() << std::endl;
+            pfac->loadDictionary(gimbatuluk::readFile(dictionary));
+            pfac->installDictionary();
+            return pfac;
+        };
+
+        std::unique_ptr<gimbatuluk::PFAC> sharedPfac;
+        if (shared) {
+            sharedPfac = createScanner(numThreads);
+        }
+
         auto start = std::chrono::steady_clock::now();
         std::atomic<bool> first(true);
 
@@ -125,15 +155,11 @@ int main(int argc, char** argv) {
                 // Create output vector.
                 std::vector<std::int32_t> output(input.size());
 
-                // Create scanner instance.
-                gimbatuluk::PFAC pfac(device, input.size());
-                std::cout << "Using Device: " << pfac.getDeviceName() << std::endl;
-
-                // Read entire dictionary file into memory.
-                pfac.loadDictionary(gimbatuluk::readFile(dictionary));
-
-                // Compile and install dictionary onto Device.
-                pfac.installDictionary();
+                std::unique_ptr<gimbatuluk::PFAC> ownPfac;
+                if (!shared) {
+                    ownPfac = createScanner(1);
+                }
+                auto& pfac = shared ? *sharedPfac : *ownPfac;
 
                 if (first) {
                     start = std::chrono::steady_clock::now();
@@ -22,6 +22,7 @@
 
 #include "pfac.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
 #include <iostream>
@@ -47,6 +48,9 @@ int main(int argc, char** argv) {
         "  -t <text>, --text <text>         text file to use, default = stdin\n" \
         "  -s <size>, --size <size>         data size, default = text size\n" \
         "  -i <count>, --iterations <count> number of iterations, default = " + std::to_string(iterations) + "\n" \
+        "  -p, --pinned                     scan in place in the scanner's pinned buffers\n" \
+        "  -S, --specialise                 build a Program specialised for the dictionary\n" \
+        "  -T <type>, --storage <type>      table storage: image, global, constant or local\n" \
         "Examples:\n" \
         "  # Scan \"" + text + "\"\n" \
         "  # padded out to 1300000 bytes for " + std::to_string(iterations) + " iterations\n" \
@@ -59,6 +63,8 @@ int main(int argc, char** argv) {
 
     std::string device = gimbatuluk::PFAC::getAvailableDevices()[0];
     bool textIsFile = false;
+    bool pinned = false;
+    std::string storage;
     int size = 0;
 
     if (argc > 1) {
@@ -74,7 +80,11 @@ int main(int argc, char** argv) {
 
         for (int i = 1; i < argc; i++) {
             std::string arg = argv[i];
-            if (arg[0] == '-') {
+            if (arg == "-p" || arg == "--pinned") {
+                pinned = true;
+            } else if (arg == "-S" || arg == "--specialise") {
+                gimbatuluk::setSpecialisedPrograms(true);
+            } else if (arg[0] == '-') {
                 i++;
                 std::string val = argv[i];
                 if (arg == "-D" || arg == "--device") {
@@ -88,6 +98,8 @@ int main(int argc, char** argv) {
                     size = std::stoi(val);
                 } else if (arg == "-i" || arg == "--iterations") {
                     iterations = std::stoi(val);
+                } else if (arg == "-T" || arg == "--storage") {
+                    storage = val;
                 }
             } else {
                 text = arg;
@@ -96,6 +108,8 @@ int main(int argc, char** argv) {
     }
 
     try {        
+        gimbatuluk::setTableStorage(storage);
+
         // Read the text we want to scan into memory.
         auto input = textIsFile ? gimbatuluk::readFile(text) :
                                   std::vector<char>(text.begin(), text.end());
@@ -118,12 +132,27 @@ int main(int argc, char** argv) {
         pfac.loadDictionary(gimbatuluk::readFile(dictionary));
 
         // Compile and install dictionary onto Device.
-        pfac.installDictionary();
+        const auto tableBytes = pfac.installDictionary();
+        std::cout << "Compiled table size (bytes) = " << tableBytes << std::endl;
+        std::cout << "Table storage = " << pfac.getTableStorage() << std::endl;
+
+        const auto timings = pfac.getCompileTimings();
+        std::cout << "Dictionary load time (ms) = " << timings.load << std::endl;
+        std::cout << "Hash table compile time (ms) = " << timings.hashTable << std::endl;
+        std::cout << "Failure link compile time (ms) = " << timings.failureLinks << std::endl;
 
         auto start = std::chrono::steady_clock::now();
 
-        for (auto i = 0; i < iterations; i++) {
-            pfac.scan(input, output);
+        if (pinned) {
+            // Fill the input buffer once, each scan then transfers from it.
+            std::copy(input.begin(), input.end(), pfac.getInputBuffer());
+            for (auto i = 0; i < iterations; i++) {
+                pfac.scanBuffer(input.size());
+            }
+        } else {
+            for (auto i = 0; i < iterations; i++) {
+                pfac.scan(input, output);
+            }
         }
 
         auto end = std::chrono::steady_clock::now();
@@ -0,0 +1,139 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include "pfac.h"
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * Simple stream scanner. Parses command line arguments then reads the text file
+ * in chunks, as a program reading from a socket would, and scans each chunk
+ * using a ScanStream whose buffer may be far smaller than the file. The stream
+ * matches are then checked against a compact scan of the whole file at once.
+ */
+int main(int argc, char** argv) {
+    std::string dictionary = "words";
+    std::string text = "test16384";
+    std::size_t chunkSize = 4096;
+    std::size_t bufferSize = 65536;
+    std::string _usage = 
+        "Usage: " + std::string(argv[0]) + " [OPTIONS]\n" \
+        "Options:\n" \
+        "  -h, --help                     show this help message and exit\n" \
+        "  -l, --list                     list available devices and exit\n" \
+        "  -D <device>, --device <device> device to use\n" \
+        "  -d <dict>, --dictionary <dict> dictionary file to use, default = " + dictionary + "\n" \
+        "  -t <text>, --text <text>       text file to use, default = " + text + "\n" \
+        "  -c <size>, --chunk <size>      size of each chunk read, default = " + std::to_string(chunkSize) + "\n" \
+        "  -s <size>, --size <size>       stream buffer size, default = " + std::to_string(bufferSize) + "\n";
+
+    std::string device = gimbatuluk::PFAC::getAvailableDevices()[0];
+
+    if (argc > 1) {
+        if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
+            std::cout << _usage;
+            std::exit(EXIT_SUCCESS);
+        } else if (std::string(argv[1]) == "-l" || std::string(argv[1]) == "--list") {
+            for (auto device : gimbatuluk::PFAC::getAvailableDevices()) {
+                std::cout << device << std::endl;
+            }
+            std::exit(EXIT_SUCCESS);
+        }
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg[0] == '-') {
+                i++;
+                std::string val = argv[i];
+                if (arg == "-D" || arg == "--device") {
+                    device = val;
+                } else if (arg == "-d" || arg == "--dictionary") {
+                    dictionary = val;
+                } else if (arg == "-t" || arg == "--text") {
+                    text = val;
+                } else if (arg == "-c" || arg == "--chunk") {
+                    chunkSize = std::stoul(val);
+                } else if (arg == "-s" || arg == "--size") {
+                    bufferSize = std::stoul(val);
+                }
+            }
+        }
+    }
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+
+        // Read entire dictionary file into memory.
+        const auto dictionaryBuffer = gimbatuluk::readFile(dictionary);
+
+        // Create scanner instance with a buffer that is independent of the text size.
+        gimbatuluk::PFAC pfac(device, bufferSize);
+        std::cout << "Using Device: " << pfac.getDeviceName() << std::endl;
+        pfac.loadDictionary(dictionaryBuffer);
+        pfac.installDictionary();
+
+        // Read and scan the text a chunk at a time.
+        gimbatuluk::ScanStream stream(pfac);
+        std::vector<gimbatuluk::StreamMatchEntry> output;
+        std::vector<char> chunk(chunkSize);
+        std::ifstream file(text, std::ios::binary);
+        while (file.read(chunk.data(), chunk.size()) || file.gcount()) {
+            chunk.resize(file.gcount());
+            stream.scan(chunk, output);
+            chunk.resize(chunkSize);
+        }
+        stream.finish(output);
+
+        auto end = std::chrono::steady_clock::now();
+        auto duration = std::chrono::
+             duration_cast<std::chrono::milliseconds>(end - start).count();
+
+        std::cout << "stream size = " << stream.getOffset() << std::endl;
+        std::cout << "stream matches = " << output.size() << std::endl;
+        std::cout << "stream scan time = " << duration << std::endl;
+
+        // Check the stream matches against a scan of the whole text.
+        const auto input = gimbatuluk::readFile(text);
+        gimbatuluk::PFAC reference(device, input.size());
+        reference.loadDictionary(dictionaryBuffer);
+        reference.installDictionary();
+        std::vector<gimbatuluk::MatchEntry> expected;
+        reference.scan(input, expected);
+
+        bool same = expected.size() == output.size();
+        for (auto i = 0u; same && i < expected.size(); i++) {
+            same = expected[i].index == static_cast<std::int64_t>(output[i].offset) &&
+                   expected[i].value == output[i].value;
+        }
+        std::cout << "whole text matches = " << expected.size() << std::endl;
+        std::cout << (same ? "stream and whole text results match" :
+                             "stream and whole text results DIFFER") << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Fatal error, caught exception: " << e.what() << std::endl;
+    }
+}
@@ -23,14 +23,16 @@
 #include "pfac.h"
 
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
 /**
- * Simple text scanner. Parses command line arguments then reads the dictionary
- * and input text and runs the pattern scanner before returning the matched
+ * Simple text scanner. Parses command line arguments then reads the dictionary,
+ * maps the input text and runs the pattern scanner before returning the matched
  * results.
  */
 int main(int argc, char** argv) {
@@ -42,11 +44,13 @@ int main(int argc, char** argv) {
         "  -l, --list                     list available devices and exit\n" \
         "  -D <device>, --device <device> device to use\n" \
         "  -d <dict>, --dictionary <dict> dictionary file to use, default = " + dictionary + "\n" \
+        "  -c <file>, --compiled <file>   precompiled dictionary file to use instead\n" \
         "  -t <text>, --text <text>       text file to use, default = stdin\n";
 
     std::string device = gimbatuluk::PFAC::getAvailableDevices()[0];
     std::string text = "the fat cat sat on the mat and acted like a prat";
     bool textIsFile = false;
+    std::string compiled;
 
     if (argc > 1) {
         if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
@@ -68,6 +72,8 @@ int main(int argc, char** argv) {
                     device = val;
                 } else if (arg == "-d" || arg == "--dictionary") {
                     dictionary = val;
+                } else if (arg == "-c" || arg == "--compiled") {
+                    compiled = val;
                 } else if (arg == "-t" || arg == "--text") {
                     text = val;
                     textIsFile = true;
@@ -81,25 +87,32 @@ int main(int argc, char** argv) {
     try {
         auto start = std::chrono::steady_clock::now();
         
-        // Read the text we want to scan into memory.
-        const auto input = textIsFile ? gimbatuluk::readFile(text) :
-                                        std::vector<char>(text.begin(), text.end());
+        // Map the file we want to scan, which is then scanned in place, or
+        // use the text given on the command line.
+        const auto file = textIsFile ? gimbatuluk::mapFile(text) : nullptr;
+        const char* input = textIsFile ? file->data() : text.data();
+        const std::size_t size = textIsFile ? file->size() : text.size();
 
         // Create output vector.
-        std::vector<std::int32_t> output(input.size());
+        std::vector<std::int32_t> output(size);
 
         // Create scanner instance.
-        gimbatuluk::PFAC pfac(device, input.size());
+        gimbatuluk::PFAC pfac(device, size);
         std::cout << "Using Device: " << pfac.getDeviceName() << std::endl;
 
-        // Read entire dictionary file into memory.
-        pfac.loadDictionary(gimbatuluk::readFile(dictionary));
+        if (compiled.empty()) {
+            // Read entire dictionary file into memory.
+            pfac.loadDictionary(gimbatuluk::readFile(dictionary));
 
-        // Compile and install dictionary onto Device.
-        pfac.installDictionary();
+            // Compile and install dictionary onto Device.
+            pfac.installDictionary();
+        } else {
+            // Map precompiled dictionary and install it onto Device.
+            pfac.installCompiledDictionary(compiled);
+        }
 
         // Do a synchronous scan to compute the expected result.
-        pfac.scan(input, output);
+        pfac.scan(input, size, output.data());
 
         // Display results.
         std::cout << std::endl;
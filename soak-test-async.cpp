@@ -22,9 +22,12 @@
 
 #include "pfac.h"
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -35,15 +38,16 @@
  * output data used in the async scan prematurely. The data is transfered to the
  * device asynchronously, so those vectors cannot be considered consistent (and
  * thus reusable) until the callback completes. There are other ways to achieve
- * this, and in practice only a maximum of three callbacks will be pending, so
- * one could use arrays of three input and output vectors and an index modulo
- * three (i % 3) to avoid premature reuse, but for a simple test like this we
- * just give each instance its own input and output vectors.
+ * this, and in practice at most the pipeline depth (default three) callbacks
+ * will be pending, so one could use arrays of three input and output vectors
+ * and an index modulo three (i % 3) to avoid premature reuse, but for a simple
+ * test like this we just give each instance its own input and output vectors.
  */
 struct AsyncData {
     std::vector<char> input;
     std::vector<std::int32_t> output;
     long int check; // Simple checksum to compare actual result with expected.
+    std::atomic<long int>* completed; // Count of callbacks across all instances.
 
     AsyncData() = default;
     AsyncData(const AsyncData&) = delete; // disable copying
@@ -60,6 +64,7 @@ struct AsyncData {
                       << " should be " << check << std::endl;
             std::abort();
         }
+        (*completed)++;
     }
 };
 
@@ -72,9 +77,17 @@ struct AsyncData {
  * prematurely. This test creates simple permutations of the input data and
  * cycles through the permutations a large number of times comparing the scan
  * result with the expected result, aborting if they don't match.
+ *
+ * As a stress test the pipeline depth may be set, a depth of one maximises
+ * contention between the scanning thread and the callbacks for the scanner's
+ * callback slots, and the scanner may be recreated every few iterations while
+ * scans are still in flight, which must wait for their callbacks. At the end
+ * the number of callbacks is checked, so a lost or duplicated one is detected.
  */
 int main(int argc, char** argv) {
     int iterations = 10000000;
+    int pipelineDepth = 3;
+    int recreate = 0;
     std::string dictionary = "words";
     std::string _usage = 
         "Usage: " + std::string(argv[0]) + " [OPTIONS]\n" \
@@ -84,7 +97,9 @@ int main(int argc, char** argv) {
         "  -D <device>, --device <device>   device to use\n" \
         "  -d <dict>, --dictionary <dict>   dictionary file to use, default = " + dictionary + "\n" \
         "  -t <text>, --text <text>         text file to use, default = stdin\n" \
-        "  -i <count>, --iterations <count> number of iterations, default = " + std::to_string(iterations) + "\n";
+        "  -i <count>, --iterations <count> number of iterations, default = " + std::to_string(iterations) + "\n" \
+        "  -p <depth>, --pipeline <depth>   async pipeline depth, default = " + std::to_string(pipelineDepth) + "\n" \
+        "  -r <count>, --recreate <count>   recreate the scanner every count iterations, default = never\n";
 
     std::string device = gimbatuluk::PFAC::getAvailableDevices()[0];
     std::string text = "the fat cat sat on the mat and acted like a prat";
@@ -119,6 +134,10 @@ int main(int argc, char** argv) {
                     textIsFile = true;
                 } else if (arg == "-i" || arg == "--iterations") {
                     iterations = std::stoi(val);
+                } else if (arg == "-p" || arg == "--pipeline") {
+                    pipelineDepth = std::stoi(val);
+                } else if (arg == "-r" || arg == "--recreate") {
+                    recreate = std::stoi(val);
                 }
             } else {
                 text = arg;
@@ -143,20 +162,33 @@ int main(int argc, char** argv) {
         std::vector<AsyncData> data(input.size() > MAX_PERMUTATIONS ?       
                                     MAX_PERMUTATIONS : input.size());
 
+        // Each AsyncData must not be reused while its scan is in flight.
+        if (data.size() <= static_cast<std::size_t>(pipelineDepth)) {
+            throw std::runtime_error("Input text is too short for the pipeline depth.");
+        }
+
+        // Read entire dictionary file into memory.
+        const auto patterns = gimbatuluk::readFile(dictionary);
+
         // Create scanner instance. In this example it's important to create it
         // after the AsyncData vector as we don't want the otput vector to go
         // out of scope until the callback has been called.
-        gimbatuluk::PFAC pfac(device, input.size());
-        std::cout << "Using Device: " << pfac.getDeviceName() << std::endl;
+        auto createScanner = [&]() {
+            std::unique_ptr<gimbatuluk::PFAC> pfac(
+                new gimbatuluk::PFAC(device, input.size(), pipelineDepth)
+            );
 
-        // Read entire dictionary file into memory.
-        pfac.loadDictionary(gimbatuluk::readFile(dictionary));
+            // Compile and install dictionary onto Device.
+            pfac->loadDictionary(patterns);
+            pfac->installDictionary();
+            return pfac;
+        };
 
-        // Compile and install dictionary onto Device.
-        pfac.installDictionary();
+        auto pfac = createScanner();
+        std::cout << "Using Device: " << pfac->getDeviceName() << std::endl;
 
         // Do the synchronous scan to compute the expected result.
-        pfac.scan(input, output);
+        pfac->scan(input, output);
 
         // Compute sum of output values to compare input with expected result.
         long int count = 0;
@@ -171,6 +203,8 @@ int main(int argc, char** argv) {
         data[0].input = input;
         data[0].output.resize(input.size());
         data[0].check = count; // Store simple checksum.
+        std::atomic<long int> completed(0);
+        data[0].completed = &completed;
 
         for (auto i = 1u; i < data.size(); i++) {
             data[i].input = data[i - 1].input;
@@ -178,6 +212,7 @@ int main(int argc, char** argv) {
             data[i].output.resize(input.size());
             count = (count - output[i - 1]) - 1; // Compute new checksum.
             data[i].check = count;
+            data[i].completed = &completed;
         }
 
         std::cout << "Starting test" << std::endl;
@@ -188,8 +223,20 @@ int main(int argc, char** argv) {
             if (i % 100 == 0) {
                 std::cout << "iteration " << i << std::endl;
             }
+            if (recreate > 0 && i > 0 && i % recreate == 0) {
+                // Destroying the scanner waits for the scans still in flight.
+                pfac = createScanner();
+            }
             auto& in = data[i % data.size()];
-            pfac.scan(in.input, in.output, std::ref(in));
+            pfac->scan(in.input, in.output, std::ref(in));
+        }
+
+        // Wait for the outstanding callbacks then check none went missing.
+        pfac.reset();
+        if (completed != iterations) {
+            std::cout << "Failed, " << completed << " callbacks completed for "
+                      << iterations << " scans" << std::endl;
+            std::abort();
         }
 
         auto end = std::chrono::steady_clock::now();
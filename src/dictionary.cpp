@@ -22,105 +22,325 @@
 
 #include "pfac.h"
 #include "dictionary.h"
+#include "thread-pool.h"
+#include "trie.h"
 
+#include <algorithm>
 #include <array>
+#include <bitset>
+#include <cerrno>
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <queue>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 namespace gimbatuluk {
 
+/**
+ * Precompiled Dictionary file format. The file starts with a CompiledHeader
+ * followed by the compiled tables, each starting on a COMPILED_ALIGNMENT byte
+ * boundary so that the mapped tables are cache line aligned. The values are
+ * stored in native byte order, byteOrder allows a mismatch to be detected.
+ * The version must be incremented whenever the layout of the file changes,
+ * including the packed hashRow and hashVal layout described in dictionary.h.
+ */
+constexpr char COMPILED_MAGIC[8] = {'G', 'I', 'M', 'B', 'A', 'T', 'U', 'L'};
+constexpr std::uint32_t COMPILED_VERSION = 2;
+constexpr std::uint32_t COMPILED_BYTE_ORDER = 0x01020304;
+constexpr std::size_t COMPILED_ALIGNMENT = 64;
+
+enum CompiledSection {
+    INITIAL_TRANSITIONS,
+    BIGRAM_TRANSITIONS,
+    HASH_ROW,
+    HASH_VAL,
+    FAILURE,
+    OUTPUT_LINK,
+    PATTERN_LENGTH,
+    PREFIX_LINK,
+    COMPILED_SECTIONS
+};
+
+struct CompiledHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::int32_t initialState;
+    std::int32_t maxPatternLength;
+    struct {
+        std::uint64_t offset; // In bytes from the start of the file.
+        std::uint64_t count;  // In (32 bit) values.
+    } sections[COMPILED_SECTIONS];
+};
+
+/**
+ * Dictionaries with fewer states than this are compiled on the calling thread
+ * as the cost of starting the worker threads would outweigh any speedup.
+ */
+constexpr std::size_t MIN_PARALLEL_STATES = 16*1024;
+
 // Polyfill make_unique etc. aliases to std::make_unique etc. if using >= c++14.
 #include "c++14-polyfill.h"
 
 //------------------------------------------------------------------------------
 // static free function prototype declarations.
-static std::int32_t getNextState(const std::vector<Transition>& currentState,
-                                 const std::int32_t ch);
+template<typename T>
+static const T* getSection(const MappedFile& file,
+                           const CompiledHeader& header,
+                           const CompiledSection section);
+static void parallelFor(const std::size_t n,
+                        const std::function<void(std::size_t begin,
+                                                 std::size_t end)>& f);
+static std::int32_t findRowHash(const StateTable::Row& currentState,
+                                std::int32_t& log2Si);
 
 //--------------------------------- Dictionary ---------------------------------
 
 /**
- * Helper function to return next state given the current state and input value.
- * TODO can't decide whether this should be replace by a lambda
+ * Return a pointer to the given section of a mapped precompiled Dictionary,
+ * checking that the section lies within the file and is suitably aligned.
  */
-static std::int32_t getNextState(const std::vector<Transition>& currentState,
-                                 const std::int32_t ch) {
-    for (auto transition : currentState) {
-        if (ch == transition.ch) {
-            return transition.nextState;	
-        }	
+template<typename T>
+static const T* getSection(const MappedFile& file,
+                           const CompiledHeader& header,
+                           const CompiledSection section) {
+    const auto offset = header.sections[section].offset;
+    const auto count = header.sections[section].count;
+    if (offset % COMPILED_ALIGNMENT || offset > file.size() ||
+        count > (file.size() - offset)/sizeof(T)) {
+        throw std::runtime_error("Compiled dictionary section out of range.");
     }
-
-    return INVALID;
+    return reinterpret_cast<const T*>(file.data() + offset);
 }
 
 void Dictionary::clear() {
     stateTable.clear();
+    stateTableStale = false;
+    trie.clear();
+    patternCount = 0;
+    maxPatternLength = 0;
+    timings = {0.0, 0.0, 0.0};
+
+    // The compiled tables may reference the mapping, so clear them first.
+    hashRow.clear();
+    hashVal.clear();
+    bigramTransitions.clear();
+    failure.clear();
+    outputLink.clear();
+    patternLength.clear();
+    prefixLink.clear();
+    mapping.reset();
 }
 
-void Dictionary::load(const std::vector<char>& buffer) {
-//    std::cout << "Dictionary::loadDictionary, buffer.size() = " << buffer.size() << std::endl;
+/**
+ * Copy the patterns loaded into other, but none of its compiled tables. Only
+ * the stateTable that compilation needs is built, from other's trie, rather
+ * than copying the trie itself. The copy may then be compiled and installed
+ * while other is left to have further patterns loaded into it.
+ */
+void Dictionary::copyPatterns(const Dictionary& other) {
+    clear();
+    patternCount = other.patternCount;
+    maxPatternLength = other.maxPatternLength;
+    timings.load = other.timings.load;
+    createStateTable(other.trie);
+}
 
-auto start = std::chrono::steady_clock::now();
+/**
+ * Release the trie and stateTable once the compiled tables have been created
+ * from them. An installed Dictionary is never recompiled so need not keep them.
+ */
+void Dictionary::releasePatterns() {
+    stateTable = StateTable();
+    stateTableStale = false;
+    trie = Trie();
+}
 
-    // Initial parse of dictionary file so that we can store the states that
-    // represent matched patterns at the start of the state transition table.
-    // By doing this we know that match states have an ID < the initialState ID
-    for (auto i = 0u; i < buffer.size(); i++) {
-        // If we reach the end of a non-empty line add a state to the table.
-        if (buffer[i] == 10 && (i > 0 && buffer[i - 1] != 10)) {
-            stateTable.push_back(std::vector<Transition>());
+/**
+ * Add the newline separated patterns in buffer to the dictionary. Pattern IDs
+ * continue from any previously loaded patterns, so a dictionary may be loaded
+ * incrementally from several buffers. Only the trie is updated, the stateTable
+ * is built from it once, by createHashTable, however many buffers are loaded.
+ */
+void Dictionary::load(const std::vector<char>& buffer) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto data = reinterpret_cast<const std::uint8_t*>(buffer.data());
+
+    // Reserve for the nodes buffer is expected to add rather than one per byte.
+    trie.reserve(trie.estimateNodes(buffer.size()));
+
+    std::size_t begin = 0;
+    for (auto i = 0u; i <= buffer.size(); i++) {
+        // If we reach the end of a non-empty line add the pattern to the trie.
+        if (i == buffer.size() || data[i] == 10) {
+            const std::size_t length = i - begin;
+            if (length) {
+                trie.insert(data + begin, length, patternCount++);
+                if (static_cast<std::int32_t>(length) > maxPatternLength) {
+                    maxPatternLength = length;
+                }
+            }
+            begin = i + 1;
         }
     }
 
-//    std::cout << "Number of patterns = " << stateTable.size() << std::endl;
-
-    std::int32_t patternID = 0;
-    initialState = stateTable.size();
-    std::int32_t state = initialState;
-
-    // Add a state representing the initial state to the table.
-    stateTable.push_back(std::vector<Transition>());
-
-    for (auto i = 0u; i < buffer.size(); i++) {
-        const std::uint8_t ch = buffer[i];
-        const bool isLastCharInPattern = i + 1 == buffer.size() || buffer[i + 1] == 10;
-
-        if (ch == 10) { // Skip
-        } else if (isLastCharInPattern) {
-            // This state represents final (match) state of dictionary pattern.
-            stateTable[state].push_back({ch, patternID});
-//console.log("A: State %d {ch: %d, nextState: %d}", state, ch, patternID);
-            state = initialState;
-            patternID++;
-        } else {
-            std::int32_t nextState = getNextState(stateTable[state], ch);
-            if (nextState == INVALID) {
-                nextState = stateTable.size();
-                stateTable[state].push_back({ch, nextState});
-//console.log("B: State %d {ch: %d, nextState: %d}", state, ch, table.length);
-                state = nextState; // Go to next state
-                stateTable.push_back(std::vector<Transition>());
-            } else {
-                state = nextState ;
-            }
+    stateTableStale = true;
+
+    const auto end = std::chrono::steady_clock::now();
+    timings.load += std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/**
+ * Create the stateTable from the patterns trie. The states that represent
+ * matched patterns are stored at the start of the state transition table, using
+ * the pattern ID as the state ID, so match states have an ID < the initialState
+ * ID. The remaining states are numbered breadth first from the initial state,
+ * so states near the root, which are visited by almost every PFAC walk, have
+ * adjacent IDs and therefore adjacent hashRow entries. Duplicate patterns
+ * leave their (unreachable) match state empty.
+ */
+void Dictionary::createStateTable(const Trie& patterns) {
+    const auto start = std::chrono::steady_clock::now();
+    initialState = patternCount;
+
+    // The trie nodes are scattered in memory, so make a single breadth first
+    // pass over them recording the transition into each node in visiting order,
+    // along with its first child so that each node is only read once. A node's
+    // children are visited consecutively, so its row is contiguous.
+    std::vector<std::int32_t> firstChildren;
+    std::vector<Transition> visited;
+    firstChildren.reserve(patterns.size());
+    visited.reserve(patterns.size());
+
+    // Each node adds at most one state to the match states, bounding nextID.
+    auto& offsets = stateTable.offsets;
+    offsets.assign(patternCount + patterns.size() + 1, 0);
+
+    std::int32_t nextID = initialState;
+    firstChildren.push_back(patterns.getFirstChild(Trie::ROOT));
+    visited.push_back({0, nextID++});
+    for (auto i = 0u; i < visited.size(); i++) {
+        const std::int32_t state = visited[i].nextState;
+        for (auto child = firstChildren[i]; child >= 0;
+             child = patterns.getNextSibling(child)) {
+            const std::int32_t patternID = patterns.getPatternID(child);
+            firstChildren.push_back(patterns.getFirstChild(child));
+            visited.push_back({patterns.getChar(child),
+                               (patternID >= 0) ? patternID : nextID++});
+            offsets[state + 1]++;
         }
     }
+    firstChildren.clear();
+    firstChildren.shrink_to_fit();
+
+    if (nextID > MAX_STATES) {
+        throw std::runtime_error("Dictionary has too many states for compact layout.");
+    }
 
-auto end = std::chrono::steady_clock::now();
-auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-//std::cout << "loadDictionary time = " << duration.count() << std::endl;
+    offsets.resize(nextID + 1);
+    for (auto i = 0; i < nextID; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    // Copy each state's row, the rows following one another in visiting order.
+    auto& transitions = stateTable.transitions;
+    transitions.resize(offsets[nextID]);
+    auto row = visited.begin() + 1; // Skip the transition into the root.
+    for (auto i = 0u; i < visited.size(); i++) {
+        const std::int32_t state = visited[i].nextState;
+        const auto count = offsets[state + 1] - offsets[state];
+        std::copy(row, row + count, transitions.begin() + offsets[state]);
+        row += count;
+    }
+    stateTableStale = false;
+
+    const auto end = std::chrono::steady_clock::now();
+    timings.load += std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/**
+ * Run f(begin, end) over [0, n) split into one range per hardware thread. Small
+ * ranges aren't worth the cost of starting threads so they are run inline.
+ */
+static void parallelFor(const std::size_t n,
+                        const std::function<void(std::size_t begin,
+                                                 std::size_t end)>& f) {
+    const std::size_t threads = std::thread::hardware_concurrency();
+    if (n < MIN_PARALLEL_STATES || threads <= 1) {
+        f(0, n);
+        return;
+    }
+
+    ThreadPool pool(threads);
+    const std::size_t chunkSize = (n + threads - 1)/threads;
+    std::vector<std::future<void>> results;
+    for (std::size_t begin = 0; begin < n; begin += chunkSize) {
+        const std::size_t end = (begin + chunkSize) < n ? begin + chunkSize : n;
+        results.emplace_back(pool.enqueue([&f, begin, end] {f(begin, end);}));
+    }
+
+    // Wait for every range before rethrowing, as the ranges reference f.
+    for (auto& result : results) {
+        result.wait();
+    }
+    for (auto& result : results) {
+        result.get();
+    }
+}
 
-//std::cout << "stateTable size = " << stateTable.size() << std::endl;
-//std::cout << "root transition count = " << stateTable[initialState].size() << std::endl;
+/**
+ * Find the hash function parameters for a (non-empty) row of the state table.
+ * Returns ki and sets log2Si, see createHashTable for the details.
+ */
+static std::int32_t findRowHash(const StateTable::Row& currentState,
+                                std::int32_t& log2Si) {
+    const int Bi = currentState.size();
+
+    // Compute Si, which is the power of two greater than Bi
+    std::int32_t Si = 256;
+    log2Si = 8;
+    for (const auto Bi2 = Bi * 2; Si >= Bi2; Si >>= 1, log2Si--) {/*empty*/}
+    std::int32_t sminus1 = Si - 1;
+
+    // Iteratively compute ki where ki is the lowest ki <= MAX_K such that no
+    // collisions occur for ((ki * ch) % p) % Si for all ch.
+    // For the case of Si = 1 or 256 we know ki will be 1.
+    while (Si != 1 && Si != 256) {
+        for (std::int32_t k = 1; k <= MAX_K; k++) {
+            std::bitset<256> bits;
+            bool collision = false;
+
+            // Check if this value of k has any collisions.
+            for (auto transition : currentState) {
+                const auto p = mod257(k * transition.ch) & sminus1;
+                if (bits[p]) {
+                    collision = true; // Collision occurred, try next k.
+                    break;
+                }
+                bits[p] = true;
+            }
+
+            if (!collision) {
+                return k;
+            }
+        }
+
+        // No collision-free ki found, try next Si.
+        Si <<= 1;
+        log2Si++;
+        sminus1 = Si - 1;
+    }
+    return 1;
 }
 
 /**
@@ -173,8 +393,11 @@ auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - star
  * iterate though the non-sufficient Si values probing for a valid ki is low
  * and the table compression gain is significant, which may help look up speed.
  */
-void Dictionary::createHashTable() {
-//    std::cout << "Creating Hash Table" << std::endl;
+void Dictionary::createHashTable(const bool bigramTable) {
+    if (stateTableStale) {
+        createStateTable(trie);
+    }
+    const auto start = std::chrono::steady_clock::now();
 
     // Clear any previous hash table
     hashRow.clear();
@@ -182,83 +405,352 @@ void Dictionary::createHashTable() {
     initialTransitions.fill(INVALID);
 
     const std::int32_t numOfStates = stateTable.size();
-//    std::cout << "numOfStates " << numOfStates << std::endl;
 
-auto start = std::chrono::steady_clock::now();
+    // Copy initial transitions into separate table.
+    for (auto transition : stateTable[initialState]) {
+        initialTransitions[transition.ch] = transition.nextState;
+    }
+
+    // Breadth first order of the (non-initial) states that have transitions,
+    // so the hashVal rows of the hot shallow states share cache lines.
+    std::vector<std::int32_t> order;
+    order.reserve(numOfStates);
+    order.push_back(initialState);
+    for (auto i = 0u; i < order.size(); i++) {
+        for (auto transition : stateTable[order[i]]) {
+            if (!stateTable[transition.nextState].empty()) {
+                order.push_back(transition.nextState);
+            }
+        }
+    }
+    order.erase(order.begin());
+
+    // Find each row's ki and Si, every row is independent so do this in parallel.
+    std::vector<std::int32_t> rowK(order.size());
+    std::vector<std::int32_t> rowLog2Si(order.size());
+    parallelFor(order.size(), [&](std::size_t begin, std::size_t end) {
+        for (auto i = begin; i < end; i++) {
+            rowK[i] = findRowHash(stateTable[order[i]], rowLog2Si[i]);
+        }
+    });
 
+    // Allocate each row's block of hashVal in order, which must be serial.
+    std::vector<std::int32_t> offsets(order.size());
     std::int32_t offset = 0;
+    for (auto i = 0u; i < order.size(); i++) {
+        if (offset > MAX_STATES) {
+            throw std::runtime_error("Dictionary hashVal table exceeds compact layout limit.");
+        }
+        offsets[i] = offset;
+        offset += 1 << rowLog2Si[i];
+    }
 
-    // Number of rows = number of states, which we know, so reserve capacity.
-    hashRow.reserve(numOfStates);
-    for (auto i = 0; i < numOfStates; i++) {
-        hashRow.push_back({INVALID, INVALID}); // Initialise offset and k_sminus1.
-
-        const std::vector<Transition>& currentState = stateTable[i];
-        const int Bi = currentState.size();
-        if (Bi) {
-            if (i == initialState) { // Copy initial transitions into separate table.
-                for (auto transition : currentState) {
-                    initialTransitions[transition.ch] = transition.nextState;
-                }
-            } else { // Populate hashRow and hashVal.
-                // Compute Si, which is the power of two greater than Bi
-                std::int32_t Si = 256;
-                for (const auto Bi2 = Bi * 2; Si >= Bi2; Si >>= 1) {/*empty*/}
-                std::int32_t sminus1 = Si - 1;
-
-                // Iteratively compute ki where ki is the lowest ki < P257 such
-                // that no collisions occur for ((ki * ch) % p) % Si for all ch
-                // For the case of Si = 1 or 256 we know ki will be 1.
-                std::int32_t ki = INVALID;
-                while (ki < 0) {
-                    if (Si == 1 || Si == 256) {
-                        ki = 1;
-                    } else {
-                        for (std::int32_t k = 1; k < P257 && ki < 0; k++) {
-                            ki = k;
-                            std::vector<bool> bits(Si, false);
-
-                            // Check if this value of k has any collisions.
-                            for (auto transition : currentState) {
-                                const auto p = mod257(k * transition.ch) & sminus1;
-                                if (bits[p]) {
-                                    ki = INVALID; // Collision occurred, try next k.
-                                    break;
-                                } else {
-                                    bits[p] = true;
-                                }
-                            }
-                        }
-
-                        if (ki == INVALID) { // No collision-free ki found, try next Si.
-                            Si <<= 1;
-                            sminus1 = Si - 1;
-                        }
-                    }
-                }
+    // Number of rows = number of states, which we know, so allocate up front.
+    hashRow.assign(numOfStates, NO_TRANSITIONS);
+    hashVal.resize(offset);
+    parallelFor(order.size(), [&](std::size_t begin, std::size_t end) {
+        for (auto i = begin; i < end; i++) {
+            const std::int32_t ki = rowK[i];
+            const std::int32_t Si = 1 << rowLog2Si[i];
+            const std::int32_t sminus1 = Si - 1;
+            const std::int32_t offset = offsets[i];
+
+            /**
+             * Empty slots hold an invalid nextState tagged with a character
+             * that does *not* hash to the slot, so lookups never need to check
+             * for empty slots. Zero always hashes to slot zero, so only slot
+             * zero needs a search for a character that hashes elsewhere.
+             */
+            std::uint32_t empty = 0;
+            while (Si > 1 && (mod257(ki * empty) & sminus1) == 0) {
+                empty++;
+            }
+            hashVal[offset] = static_cast<std::uint32_t>(MAX_STATES) << VAL_STATE_SHIFT | empty;
+            for (auto j = 1; j < Si; j++) {
+                hashVal[offset + j] = static_cast<std::uint32_t>(MAX_STATES) << VAL_STATE_SHIFT;
+            }
 
-                // Reserve next block of space in hashVal table.
-                for (auto j = 0; j < Si; j++) {
-                    hashVal.push_back({INVALID, INVALID});
+            for (auto transition : stateTable[order[i]]) {
+                const auto p = mod257(ki * transition.ch) & sminus1;
+                hashVal[offset + p] = static_cast<std::uint32_t>(transition.nextState) << VAL_STATE_SHIFT |
+                                      static_cast<std::uint32_t>(transition.ch);
+            }
+
+            hashRow[order[i]] = static_cast<std::uint32_t>(offset) << ROW_OFFSET_SHIFT |
+                                static_cast<std::uint32_t>(ki - 1) << ROW_K_SHIFT |
+                                static_cast<std::uint32_t>(rowLog2Si[i]);
+        }
+    });
+
+    /**
+     * Optionally create the bigram table, which maps the first two characters
+     * of a match directly to the depth two state. Every walk that survives the
+     * initial transition would otherwise need at least one hashed lookup, so
+     * this replaces the hashRow and hashVal reads for depth two with a single
+     * read from a 65536 entry table indexed by (firstChar << 8) | secondChar.
+     */
+    bigramTransitions.clear();
+    if (bigramTable) {
+        bigramTransitions.resize(BIGRAM_TABLE_SIZE, INVALID);
+        for (auto first = 0; first < 256; first++) {
+            const std::int32_t state = initialTransitions[first];
+            if (state != INVALID) {
+                for (auto transition : stateTable[state]) {
+                    bigramTransitions[(first << 8) | transition.ch] = transition.nextState;
                 }
+            }
+        }
+    }
+
+    const auto end = std::chrono::steady_clock::now();
+    timings.hashTable = std::chrono::duration<double, std::milli>(end - start).count();
+}
 
-                for (auto transition : currentState) {
-                    const auto p = mod257(ki * transition.ch) & sminus1;
-                    hashVal[offset + p] = transition;
+/**
+ * Compute the classic Aho-Corasick failure and output links from stateTable.
+ * https://en.wikipedia.org/wiki/Aho%E2%80%93Corasick_algorithm
+ * The states are visited in breadth first order, so when we visit a state the
+ * failure links of all shallower states, which are the only ones its failure
+ * link can refer to, have already been computed. The depth of each match state
+ * is also recorded as this is the length of the corresponding pattern, which
+ * is needed to convert the end position of a match into its start position.
+ * Similarly nearestMatch tracks the deepest match state on the path to each
+ * state, and as a state's trie parent is visited first, the prefixLink of a
+ * match state is simply the nearestMatch of its parent.
+ * Transitions are resolved via the compiled tables rather than by searching
+ * stateTable rows, so createHashTable must have been called first.
+ */
+void Dictionary::createFailureLinks() {
+    const auto start = std::chrono::steady_clock::now();
+    const std::int32_t numOfStates = stateTable.size();
+    const auto transition = [this](const std::int32_t state, const std::int32_t ch) {
+        return (state == initialState) ? initialTransitions[ch] : lookup(state, ch);
+    };
+
+    failure.assign(numOfStates, initialState);
+    outputLink.assign(numOfStates, INVALID);
+    patternLength.assign(initialState, 0);
+    prefixLink.assign(initialState, INVALID);
+
+    std::vector<std::int32_t> depth(numOfStates, 0);
+    std::vector<std::int32_t> nearestMatch(numOfStates, INVALID);
+    std::queue<std::int32_t> queue;
+    queue.push(initialState);
+
+    while (!queue.empty()) {
+        const std::int32_t state = queue.front();
+        queue.pop();
+
+        for (auto arc : stateTable[state]) {
+            const std::int32_t ch = arc.ch;
+            const std::int32_t nextState = arc.nextState;
+            depth[nextState] = depth[state] + 1;
+            nearestMatch[nextState] = nearestMatch[state];
+            if (nextState < initialState) {
+                patternLength[nextState] = depth[nextState];
+                prefixLink[nextState] = nearestMatch[state];
+                nearestMatch[nextState] = nextState;
+            }
+
+            if (state != initialState) {
+                // Follow the failure links of state until one has a transition on ch.
+                std::int32_t f = failure[state];
+                std::int32_t target = transition(f, ch);
+                while (target == INVALID && f != initialState) {
+                    f = failure[f];
+                    target = transition(f, ch);
                 }
 
-                hashRow[i] = {offset, sminus1 | (ki << MASKBITS)};
-                offset += Si;
+                failure[nextState] = (target == INVALID) ? initialState : target;
             }
+
+            const std::int32_t f = failure[nextState];
+            outputLink[nextState] = (f < initialState) ? f : outputLink[f];
+            queue.push(nextState);
         }
     }
 
-auto end = std::chrono::steady_clock::now();
-auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-//std::cout << "createHashTable time = " << duration.count() << std::endl;
-//std::cout << "hashRow size = " << hashRow.size() << std::endl;
-//std::cout << "hashVal size = " << hashVal.size() << std::endl;
+    const auto end = std::chrono::steady_clock::now();
+    timings.failureLinks = std::chrono::duration<double, std::milli>(end - start).count();
 }
 
-} // namespace gimbatuluk
+/**
+ * Write the compiled tables to fileName in the precompiled Dictionary format,
+ * which may later be loaded by map(). createHashTable and createFailureLinks
+ * must have been called first.
+ */
+void Dictionary::save(const std::string& fileName) const {
+    CompiledHeader header = {};
+    std::memcpy(header.magic, COMPILED_MAGIC, sizeof(COMPILED_MAGIC));
+    header.version = COMPILED_VERSION;
+    header.byteOrder = COMPILED_BYTE_ORDER;
+    header.initialState = initialState;
+    header.maxPatternLength = maxPatternLength;
+
+    const std::array<std::pair<const void*, std::size_t>, COMPILED_SECTIONS> sections = {{
+        {initialTransitions.data(), initialTransitions.size()},
+        {bigramTransitions.data(), bigramTransitions.size()},
+        {hashRow.data(), hashRow.size()},
+        {hashVal.data(), hashVal.size()},
+        {failure.data(), failure.size()},
+        {outputLink.data(), outputLink.size()},
+        {patternLength.data(), patternLength.size()},
+        {prefixLink.data(), prefixLink.size()}
+    }};
+
+    // Lay out each section at the next aligned offset after the previous one.
+    std::uint64_t offset = sizeof(CompiledHeader);
+    for (auto i = 0; i < COMPILED_SECTIONS; i++) {
+        offset = (offset + COMPILED_ALIGNMENT - 1)/COMPILED_ALIGNMENT*COMPILED_ALIGNMENT;
+        header.sections[i] = {offset, sections[i].second};
+        offset += sections[i].second*sizeof(std::int32_t);
+    }
+
+    std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const std::vector<char> padding(COMPILED_ALIGNMENT, 0);
+    for (auto i = 0; i < COMPILED_SECTIONS; i++) {
+        file.write(padding.data(), header.sections[i].offset - file.tellp());
+        file.write(static_cast<const char*>(sections[i].first),
+                   sections[i].second*sizeof(std::int32_t));
+    }
+
+    if (!file.flush()) {
+        std::string message = "Failed to write file \"" +
+                               fileName + "\": " + std::strerror(errno);
+        throw std::runtime_error(message);
+    }
+}
 
+/**
+ * Load a precompiled Dictionary written by save(). Rather than reading the file
+ * the compiled tables reference a shared read only mapping of it, so there is
+ * no parsing or copying and processes using the same file share one page cache
+ * copy of the tables. Only the 256 entry initialTransitions table is copied.
+ * As a corrupt table could cause scans to read out of bounds, every state and
+ * hashVal offset in the tables is checked before the Dictionary is used.
+ */
+void Dictionary::map(const std::string& fileName) {
+    const auto start = std::chrono::steady_clock::now();
+    auto file = std::make_shared<const MappedFile>(fileName);
+
+    CompiledHeader header;
+    if (file->size() < sizeof(header)) {
+        throw std::runtime_error("\"" + fileName + "\" is not a compiled dictionary.");
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+
+    if (std::memcmp(header.magic, COMPILED_MAGIC, sizeof(COMPILED_MAGIC))) {
+        throw std::runtime_error("\"" + fileName + "\" is not a compiled dictionary.");
+    }
+
+    if (header.version != COMPILED_VERSION || header.byteOrder != COMPILED_BYTE_ORDER) {
+        throw std::runtime_error("\"" + fileName + "\" compiled dictionary version " +
+                                 std::to_string(header.version) + " is incompatible.");
+    }
+
+    const auto& sections = header.sections;
+    const auto numOfStates = sections[HASH_ROW].count;
+    const auto bigramCount = sections[BIGRAM_TRANSITIONS].count;
+    if (sections[INITIAL_TRANSITIONS].count != initialTransitions.size() ||
+        (bigramCount != 0 && bigramCount != BIGRAM_TABLE_SIZE) ||
+        numOfStates > MAX_STATES || sections[HASH_VAL].count > MAX_STATES ||
+        sections[FAILURE].count != numOfStates ||
+        sections[OUTPUT_LINK].count != numOfStates ||
+        header.initialState < 0 ||
+        static_cast<std::uint64_t>(header.initialState) >= numOfStates ||
+        sections[PATTERN_LENGTH].count != static_cast<std::uint64_t>(header.initialState) ||
+        sections[PREFIX_LINK].count != static_cast<std::uint64_t>(header.initialState)) {
+        throw std::runtime_error("Compiled dictionary table sizes are inconsistent.");
+    }
+
+    clear();
+    initialState = header.initialState;
+    patternCount = header.initialState;
+    maxPatternLength = header.maxPatternLength;
+
+    const auto initial = getSection<std::int32_t>(*file, header, INITIAL_TRANSITIONS);
+    std::copy(initial, initial + initialTransitions.size(), initialTransitions.begin());
+    bigramTransitions.reference(getSection<std::int32_t>(*file, header, BIGRAM_TRANSITIONS), bigramCount);
+    hashRow.reference(getSection<std::uint32_t>(*file, header, HASH_ROW), numOfStates);
+    hashVal.reference(getSection<std::uint32_t>(*file, header, HASH_VAL), sections[HASH_VAL].count);
+    failure.reference(getSection<std::int32_t>(*file, header, FAILURE), numOfStates);
+    outputLink.reference(getSection<std::int32_t>(*file, header, OUTPUT_LINK), numOfStates);
+    patternLength.reference(getSection<std::int32_t>(*file, header, PATTERN_LENGTH), initialState);
+    prefixLink.reference(getSection<std::int32_t>(*file, header, PREFIX_LINK), initialState);
+    mapping = std::move(file);
+
+    // Check that every state and offset in the tables is within range.
+    const auto states = static_cast<std::int32_t>(numOfStates);
+    const auto validState = [states](const std::int32_t state) {
+        return state >= INVALID && state < states;
+    };
+    bool valid = std::all_of(initialTransitions.begin(), initialTransitions.end(), validState) &&
+                 std::all_of(bigramTransitions.data(), bigramTransitions.data() + bigramCount, validState) &&
+                 std::all_of(failure.data(), failure.data() + numOfStates, validState) &&
+                 std::all_of(outputLink.data(), outputLink.data() + numOfStates, validState);
+    for (auto i = 0u; valid && i < numOfStates; i++) {
+        const std::uint32_t row = hashRow[i];
+        valid = row == NO_TRANSITIONS ||
+                (row >> ROW_OFFSET_SHIFT) + (1u << (row & ROW_FIELD_MASK)) <= hashVal.size();
+    }
+    for (auto i = 0u; valid && i < hashVal.size(); i++) {
+        const std::uint32_t state = hashVal[i] >> VAL_STATE_SHIFT;
+        valid = state == static_cast<std::uint32_t>(MAX_STATES) || state < numOfStates;
+    }
+    // Each prefix must be shorter, so following the links always terminates.
+    for (auto i = 0; valid && i < initialState; i++) {
+        const std::int32_t prefix = prefixLink[i];
+        valid = prefix == INVALID ||
+                (prefix >= 0 && prefix < initialState &&
+                 patternLength[prefix] < patternLength[i]);
+    }
+    if (!valid) {
+        clear();
+        throw std::runtime_error("\"" + fileName + "\" compiled dictionary is corrupt.");
+    }
+
+    const auto end = std::chrono::steady_clock::now();
+    timings.load = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/**
+ * Walk the compiled tables over the input in the same way as the PFAC scanners
+ * do, counting the table reads required. This is a host side diagnostic used
+ * to compare table layouts independently of the Device used for scanning.
+ */
+ScanProfile Dictionary::profile(const std::vector<char>& input) const {
+    ScanProfile profile = {input.size(), 0, 0, 0, 0};
+    const auto buffer = reinterpret_cast<const std::uint8_t*>(input.data());
+    const std::size_t size = input.size();
+    const bool bigramTable = !bigramTransitions.empty();
+
+    for (auto i = 0u; i < size; i++) {
+        std::size_t pos = i;
+        std::int32_t state = initialTransitions[buffer[pos]];
+        profile.initialLookups++;
+        profile.tableReads++;
+        if (state == INVALID) {
+            continue;
+        }
+        pos++;
+
+        if (bigramTable && pos < size) {
+            state = bigramTransitions[(buffer[i] << 8) | buffer[pos]];
+            profile.bigramLookups++;
+            profile.tableReads++;
+            pos++;
+        }
+
+        while (state != INVALID && pos < size) {
+            profile.hashLookups++;
+            profile.tableReads += (hashRow[state] != NO_TRANSITIONS) ? 2 : 1;
+            state = lookup(state, buffer[pos]);
+            pos++;
+        }
+    }
+
+    return profile;
+}
+
+} // namespace gimbatuluk
@@ -24,15 +24,38 @@
 
 #pragma once
 
+#include "pfac.h"
+#include "trie.h"
+
 #include <array>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace gimbatuluk {
 
 constexpr std::int32_t INVALID = -1;
-constexpr std::int32_t MASKBITS = 16;
-constexpr std::int32_t MASK = 0x0000FFFF;
+constexpr std::int32_t BIGRAM_TABLE_SIZE = 65536;
+
+/**
+ * The compiled hash tables use a compact layout of one 32 bit word per entry.
+ * Each hashRow entry packs offset << ROW_OFFSET_SHIFT | (k - 1) << ROW_K_SHIFT
+ * | log2(Si), where k - 1 and log2(Si) are ROW_FIELD_MASK wide fields, or is
+ * NO_TRANSITIONS if the state has no (hashed) transitions. Each hashVal entry
+ * packs nextState << VAL_STATE_SHIFT | ch. Restricting k to 1 <= k <= MAX_K
+ * costs very little, as an Si of 256 is always collision free with k = 1, and
+ * leaves 24 bits for both offsets and state IDs, so MAX_STATES is the limit.
+ */
+constexpr std::int32_t ROW_OFFSET_SHIFT = 8;
+constexpr std::int32_t ROW_K_SHIFT = 4;
+constexpr std::int32_t ROW_FIELD_MASK = 0xF;
+constexpr std::int32_t MAX_K = 16;
+constexpr std::uint32_t NO_TRANSITIONS = 0xFFFFFFFF;
+constexpr std::int32_t VAL_STATE_SHIFT = 8;
+constexpr std::int32_t VAL_CHAR_MASK = 0xFF;
+constexpr std::int32_t MAX_STATES = 0xFFFFFF;
 
 /**
  * 257 is the prime number used in the hash function and has the useful
@@ -49,14 +72,101 @@ constexpr int mod257(int x) {
 }
 
 
+/**
+ * A compiled table, which either owns its values, as when the Dictionary is
+ * compiled in process, or references values held elsewhere, as when a
+ * precompiled Dictionary is memory mapped. The vector style modifiers always
+ * make the table own its values. Values may only be modified in owned tables,
+ * which is the case while compiling, as mapped tables are read only.
+ */
+template<typename T>
+class CompiledTable {
+public:
+    CompiledTable() = default;
+
+    // Non-copyable, as a copy of an owned table would reference the original.
+    CompiledTable(CompiledTable&&) = delete;
+    CompiledTable(const CompiledTable&) = delete;
+    CompiledTable& operator=(CompiledTable&&) = delete;
+    CompiledTable& operator=(const CompiledTable&) = delete;
+
+    std::size_t size() const {return count;}
+    bool empty() const {return count == 0;}
+    const T* data() const {return values;}
+    const T& operator[](const std::size_t i) const {return values[i];}
+    T& operator[](const std::size_t i) {return const_cast<T&>(values[i]);}
+
+    void clear() {
+        storage.clear();
+        own();
+    }
+
+    void assign(const std::size_t n, const T& value) {
+        storage.assign(n, value);
+        own();
+    }
+
+    void resize(const std::size_t n, const T& value = T()) {
+        storage.resize(n, value);
+        own();
+    }
+
+    // Reference n values at data, which must outlive the table's use.
+    void reference(const T* data, const std::size_t n) {
+        storage.clear();
+        values = data;
+        count = n;
+    }
+private:
+    void own() {
+        values = storage.data();
+        count = storage.size();
+    }
+
+    std::vector<T> storage;
+    const T* values = nullptr;
+    std::size_t count = 0;
+};
+
 struct Transition {
     std::int32_t ch;
     std::int32_t nextState;
 };
 
-struct HashRow {
-    std::int32_t offset;
-    std::int32_t k_sminus1; // Packed using k << 16 | sminus1
+/**
+ * Raw state table from which we create the hash tables. The table rows
+ * represent states (nodes) and the columns represent transitions (arcs).
+ * Rather than allocating each row separately, all the transitions are held in
+ * a single arena ordered by state, with row i being the transitions between
+ * offsets[i] and offsets[i + 1].
+ */
+struct StateTable {
+    struct Row {
+        const Transition* begin() const {return first;}
+        const Transition* end() const {return last;}
+        std::size_t size() const {return last - first;}
+        bool empty() const {return first == last;}
+
+        const Transition* first;
+        const Transition* last;
+    };
+
+    Row operator[](const std::int32_t state) const {
+        return {transitions.data() + offsets[state],
+                transitions.data() + offsets[state + 1]};
+    }
+
+    std::size_t size() const {
+        return offsets.size() - 1;
+    }
+
+    void clear() {
+        offsets.assign(1, 0);
+        transitions.clear();
+    }
+
+    std::vector<std::int32_t> offsets = {0};
+    std::vector<Transition> transitions;
 };
 
 
@@ -71,14 +181,56 @@ struct Dictionary {
     Dictionary& operator=(const Dictionary&) = delete;
 
     void clear();
+    void copyPatterns(const Dictionary& other);
+    void releasePatterns();
     void load(const std::vector<char>& buffer);
-    void createHashTable();
+    void createStateTable(const Trie& patterns);
+    void createHashTable(const bool bigramTable = false);
+    void createFailureLinks();
+    void save(const std::string& fileName) const;
+    void map(const std::string& fileName);
+    ScanProfile profile(const std::vector<char>& input) const;
+
+    /**
+     * Look up the next state in the compiled hash table given the current
+     * (non-initial) state and the transition (input) character. This is the
+     * host equivalent of lookup() in the OpenCL Kernels.
+     */
+    std::int32_t lookup(const std::int32_t state,
+                        const std::int32_t inputChar) const {
+        const std::uint32_t row = hashRow[state];
+        std::int32_t nextState = INVALID;
+        if (row != NO_TRANSITIONS) {
+            const std::uint32_t offset = row >> ROW_OFFSET_SHIFT;
+            const std::int32_t k = ((row >> ROW_K_SHIFT) & ROW_FIELD_MASK) + 1;
+            const std::int32_t sminus1 = (1 << (row & ROW_FIELD_MASK)) - 1;
+
+            const std::int32_t p = mod257(k * inputChar) & sminus1;
+            const std::uint32_t value = hashVal[offset + p];
+            if (static_cast<std::int32_t>(value & VAL_CHAR_MASK) == inputChar) {
+                nextState = value >> VAL_STATE_SHIFT;
+            }
+        }
+        return nextState;
+    }
+
+    // Size in bytes of the compiled tables used by the scanners.
+    std::size_t getTableBytes() const {
+        return sizeof(std::int32_t)*(initialTransitions.size() +
+                                     bigramTransitions.size()) +
+               sizeof(std::uint32_t)*(hashRow.size() + hashVal.size());
+    }
+
+    StateTable stateTable;
 
     /**
-     * Raw state table from which we create the hash tables. The table rows
-     * represent states (nodes) and the columns represent transitions (arcs)
+     * Trie of every pattern loaded since the Dictionary was last cleared, from
+     * which the stateTable is (re)created. load() only sets stateTableStale, so
+     * loading many buffers builds the stateTable once, when it is compiled.
      */
-    std::vector<std::vector<Transition>> stateTable;
+    Trie trie;
+    bool stateTableStale = false;
+    std::int32_t patternCount = 0;
 
     /**
      * Index of the initial state, N.B. this is set to be the number of patterns
@@ -87,15 +239,59 @@ struct Dictionary {
      */
     std::int32_t initialState;
 
+    /**
+     * Length in bytes of the longest pattern in the dictionary. Scanners that
+     * partition their input use this as the overlap required between chunks.
+     */
+    std::int32_t maxPatternLength = 0;
+
     /**
      * Compiled state table information. The hashRow is indexed by state index
-     * and contains an offset into the hashVal table plus the k and s - 1 hash
+     * and contains an offset into the hashVal table plus the k and Si hash
      * function values for the state. The hashVal contains the ch and nextState.
      * The first transition uses a simple array lookup rather than hashing.
+     * Both hashRow and hashVal entries use the packed 32 bit layout above.
      */
     std::array<std::int32_t, 256> initialTransitions;
-    std::vector<HashRow> hashRow;
-    std::vector<Transition> hashVal;
+    CompiledTable<std::uint32_t> hashRow;
+    CompiledTable<std::uint32_t> hashVal;
+
+    /**
+     * Optional table of BIGRAM_TABLE_SIZE entries indexed by the first two
+     * characters, (first << 8) | second, holding the depth two state or INVALID.
+     * The table is empty if it was not requested when creating the hash table.
+     */
+    CompiledTable<std::int32_t> bigramTransitions;
+
+    /**
+     * Classic Aho-Corasick information, used by the host AhoCorasickScanner.
+     * failure is indexed by state and holds the state representing the longest
+     * proper suffix of the current state that is also a prefix of a pattern.
+     * outputLink is indexed by state and holds the nearest match state reached
+     * by following failure links, or INVALID if there is none. patternLength
+     * is indexed by pattern ID (i.e. match state) and holds the pattern length.
+     */
+    CompiledTable<std::int32_t> failure;
+    CompiledTable<std::int32_t> outputLink;
+    CompiledTable<std::int32_t> patternLength;
+
+    /**
+     * prefixLink is indexed by pattern ID and holds the ID of the longest
+     * shorter pattern that is a prefix of it, or INVALID if there is none. So
+     * following the links from the longest match at a position yields every
+     * pattern matching at that position without walking the input again.
+     */
+    CompiledTable<std::int32_t> prefixLink;
+
+    /**
+     * If the Dictionary was loaded from a precompiled file by map() then the
+     * compiled tables reference this mapping, otherwise it is null. Dictionaries
+     * loaded this way have no stateTable so cannot be recompiled.
+     */
+    std::shared_ptr<const MappedFile> mapping;
+
+    // Time spent in each compilation step, see CompileTimings.
+    CompileTimings timings = {0.0, 0.0, 0.0};
 };
 
 } // namespace gimbatuluk
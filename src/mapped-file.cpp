@@ -0,0 +1,79 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include "pfac.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace gimbatuluk {
+
+MappedFile::MappedFile(const std::string& fileName): address(nullptr), length(0) {
+    const int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd == -1) {
+        std::string message = "Failed to open file \"" +
+                               fileName + "\": " + std::strerror(errno);
+        throw std::runtime_error(message);
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) == -1) {
+        const int error = errno;
+        close(fd);
+        std::string message = "Failed to stat file \"" +
+                               fileName + "\": " + std::strerror(error);
+        throw std::runtime_error(message);
+    }
+
+    // mmap fails for zero length, so an empty file maps to an empty range.
+    length = status.st_size;
+    if (length) {
+        void* mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            const int error = errno;
+            close(fd);
+            std::string message = "Failed to map file \"" +
+                                   fileName + "\": " + std::strerror(error);
+            throw std::runtime_error(message);
+        }
+        address = static_cast<const char*>(mapping);
+    }
+
+    close(fd); // The mapping remains valid after the descriptor is closed.
+}
+
+MappedFile::~MappedFile() {
+    if (address) {
+        munmap(const_cast<char*>(address), length);
+    }
+}
+
+} // namespace gimbatuluk
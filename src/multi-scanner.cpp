@@ -0,0 +1,387 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include "pfac.h"
+#include "dictionary.h"
+#include "scanner.h"
+#include "thread-pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace gimbatuluk {
+
+// Polyfill make_unique etc. aliases to std::make_unique etc. if using >= c++14.
+#include "c++14-polyfill.h"
+
+/**
+ * Pieces smaller than MIN_PIECE_SIZE bytes are not worth the cost of a Device
+ * round trip, so the last few pieces of an input are at least this size.
+ */
+constexpr std::size_t MIN_PIECE_SIZE = 64*1024;
+
+/**
+ * Weight given to the latest piece when updating a Device's throughput, as an
+ * exponentially weighted moving average so that it adapts to changing load.
+ */
+constexpr double THROUGHPUT_WEIGHT = 0.25;
+
+/**
+ * The MultiScanner only uses synchronous scans, so each Device is created with
+ * a pipeline depth of one to avoid allocating unused Device buffers.
+ */
+constexpr std::size_t PIPELINE_DEPTH = 1;
+
+/**
+ * A Device taking part in the scan, with its throughput in bytes per second
+ * (zero until measured) and a buffer for its dense output.
+ */
+struct MultiScanner::Device {
+    std::unique_ptr<Scanner> scanner;
+    double throughput;
+    std::vector<std::int32_t> output;
+};
+
+//------------------------------------------------------------------------------
+// static free function prototype declarations.
+static std::vector<std::string> getDefaultDevices();
+
+//------------------------------------------------------------------------------
+
+/**
+ * Every available OpenCL Device, but only the first host scanner, Host:CPU[0].
+ * Each host scanner runs a thread per hardware thread, so another would only
+ * compete with it for the same cores. The Aho-Corasick Host:CPU[1] may still
+ * be selected by name.
+ */
+static std::vector<std::string> getDefaultDevices() {
+    std::vector<std::string> names;
+    bool hostSelected = false;
+    for (const auto& name : PFAC::getAvailableDevices()) {
+        const bool host = name.find("Host") == 0;
+        if (!host || !hostSelected) {
+            names.push_back(name);
+            hostSelected = hostSelected || host;
+        }
+    }
+    return names;
+}
+
+//-------------------------------- MultiScanner --------------------------------
+
+MultiScanner::MultiScanner(const std::vector<std::string>& deviceNames,
+                           const std::size_t bufferSize):
+bufferSize(bufferSize),
+dictionary(make_unique<Dictionary>()) {
+    const auto names = deviceNames.empty() ? getDefaultDevices() : deviceNames;
+    for (const auto& name : names) {
+        auto device = make_unique<Device>();
+        device->scanner = makeScanner(name, bufferSize, PIPELINE_DEPTH, bufferSize);
+        device->throughput = 0.0;
+        devices.push_back(std::move(device));
+    }
+
+    if (devices.empty()) {
+        throw std::runtime_error("MultiScanner requires at least one Device.");
+    }
+    pool = make_unique<ThreadPool>(devices.size());
+}
+
+MultiScanner::~MultiScanner() = default;
+
+std::vector<std::string> MultiScanner::getDeviceNames() {
+    std::vector<std::string> names;
+    for (const auto& device : devices) {
+        names.push_back(device->scanner->getDeviceName());
+    }
+    return names;
+}
+
+std::size_t MultiScanner::getBufferSize() {
+    return bufferSize;
+}
+
+void MultiScanner::clearDictionary() {
+    dictionary->clear();
+}
+
+void MultiScanner::loadDictionary(const std::vector<char>& buffer) {
+    dictionary->load(buffer);
+}
+
+/**
+ * Every Device shares the one compiled Dictionary, which for the host scanners
+ * and OpenCL Devices using host memory means one copy of the tables in total.
+ */
+std::size_t MultiScanner::installDictionary(const bool bigramTable) {
+    auto loaded = std::make_shared<Dictionary>();
+    loaded->copyPatterns(*dictionary);
+    loaded->createHashTable(bigramTable);
+    loaded->createFailureLinks();
+    loaded->releasePatterns();
+    for (auto& device : devices) {
+        device->scanner->installDictionary(loaded);
+    }
+    return loaded->getTableBytes();
+}
+
+std::size_t MultiScanner::installCompiledDictionary(const std::string& fileName) {
+    auto compiled = std::make_shared<Dictionary>();
+    compiled->map(fileName);
+    for (auto& device : devices) {
+        device->scanner->installDictionary(compiled);
+    }
+    return compiled->getTableBytes();
+}
+
+std::size_t MultiScanner::getMaxPatternLength() {
+    const auto installed = devices[0]->scanner->getDictionary();
+    return installed ? installed->maxPatternLength : 0;
+}
+
+std::vector<double> MultiScanner::getThroughput() {
+    std::vector<double> throughput;
+    for (const auto& device : devices) {
+        throughput.push_back(device->throughput*1e-6);
+    }
+    return throughput;
+}
+
+/**
+ * Number of bytes after a piece that must also be scanned, as a match starting
+ * in the piece may end up to this many bytes beyond it.
+ */
+std::size_t MultiScanner::getOverlap() {
+    const std::size_t maxPatternLength = getMaxPatternLength();
+    const std::size_t overlap = maxPatternLength > 0 ? maxPatternLength - 1 : 0;
+    if (bufferSize <= overlap) {
+        throw std::runtime_error("MultiScanner buffer is smaller than the longest pattern.");
+    }
+    return overlap;
+}
+
+/**
+ * Run f(device, piece, begin, end) on each Device's thread for consecutive
+ * pieces [begin, end) of [0, size) until all of it has been taken, returning
+ * the number of pieces, which are numbered in order from zero. f returns the
+ * number of bytes it scanned, which updates the Device's throughput.
+ *
+ * Each free Device takes the next piece, sized as half its share of what
+ * remains, its share being its fraction of the total measured throughput (an
+ * equal share until every Device has been measured). Pieces are at least
+ * MIN_PIECE_SIZE and at most maxPiece units, so no more than
+ * size/min(MIN_PIECE_SIZE, maxPiece) + 1 pieces are produced.
+ */
+std::size_t MultiScanner::distribute(const std::size_t size, const std::size_t maxPiece,
+                                     const std::function<std::size_t(Device& device,
+                                                                     std::size_t piece,
+                                                                     std::size_t begin,
+                                                                     std::size_t end)>& f) {
+    std::mutex mutex; // Guards next, pieces and the Device throughputs.
+    std::size_t next = 0;
+    std::size_t pieces = 0;
+
+    std::vector<std::future<void>> results;
+    for (auto& entry : devices) {
+        Device* device = entry.get();
+        results.emplace_back(pool->enqueue([&, device, maxPiece, size] {
+            while (true) {
+                std::size_t piece, begin, end;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (next == size) {
+                        return;
+                    }
+
+                    double total = 0.0;
+                    bool measured = true;
+                    for (const auto& other : devices) {
+                        total += other->throughput;
+                        measured = measured && other->throughput > 0.0;
+                    }
+                    const double share = measured ? device->throughput/total :
+                                                    1.0/devices.size();
+
+                    const std::size_t remaining = size - next;
+                    std::size_t count = remaining*share/2;
+                    count = std::max(count, MIN_PIECE_SIZE);
+                    count = std::min(count, maxPiece);
+                    count = std::min(count, remaining);
+
+                    piece = pieces++;
+                    begin = next;
+                    end = next + count;
+                    next = end;
+                }
+
+                const auto start = std::chrono::steady_clock::now();
+                const std::size_t bytes = f(*device, piece, begin, end);
+                const auto finish = std::chrono::steady_clock::now();
+                const double seconds = std::chrono::duration<double>(finish - start).count();
+
+                if (bytes > 0 && seconds > 0.0) {
+                    const double rate = bytes/seconds;
+                    std::lock_guard<std::mutex> lock(mutex);
+                    device->throughput = (device->throughput > 0.0) ?
+                        (1.0 - THROUGHPUT_WEIGHT)*device->throughput + THROUGHPUT_WEIGHT*rate :
+                        rate;
+                }
+            }
+        }));
+    }
+
+    // Wait for every Device before rethrowing, as the tasks reference locals.
+    for (auto& result : results) {
+        result.wait();
+    }
+    for (auto& result : results) {
+        result.get();
+    }
+    return pieces;
+}
+
+/**
+ * Each piece is scanned together with the following overlap bytes into the
+ * Device's own output buffer, then only the results for the piece itself are
+ * copied, as those for the overlap may be cut short by the end of the scan.
+ */
+void MultiScanner::scan(const std::vector<char>& input,
+                        std::vector<std::int32_t>& output) {
+    const std::size_t size = input.size();
+    if (size == 0) {
+        throw std::runtime_error("Input vector uninitialised.");
+    }
+
+    const std::size_t overlap = getOverlap();
+    output.resize(size);
+
+    distribute(size, bufferSize - overlap,
+               [&](Device& device, std::size_t piece, std::size_t begin, std::size_t end) {
+        const std::size_t scanSize = std::min(size - begin, end - begin + overlap);
+        device.output.resize(bufferSize);
+        device.scanner->scan(input.data() + begin, scanSize, device.output.data());
+        std::copy(device.output.begin(), device.output.begin() + (end - begin),
+                  output.begin() + begin);
+        return scanSize;
+    });
+}
+
+/**
+ * Each Device's maxMatches is its bufferSize, which no piece exceeds, so the
+ * piece scans are never truncated and the total of the merged result is exact.
+ */
+CompactResult MultiScanner::scan(const std::vector<char>& input,
+                                 std::vector<MatchEntry>& output,
+                                 const std::int32_t limit) {
+    const std::size_t size = input.size();
+    if (size == 0) {
+        throw std::runtime_error("Input vector uninitialised.");
+    }
+
+    const std::size_t overlap = getOverlap();
+    const std::size_t maxPiece = bufferSize - overlap;
+    std::vector<std::vector<MatchEntry>> results(size/std::min(MIN_PIECE_SIZE, maxPiece) + 1);
+
+    const std::size_t pieces = distribute(size, maxPiece,
+               [&](Device& device, std::size_t piece, std::size_t begin, std::size_t end) {
+        const std::size_t scanSize = std::min(size - begin, end - begin + overlap);
+        auto& result = results[piece];
+        result.resize(scanSize);
+        const auto found = device.scanner->scan(input.data() + begin, scanSize,
+                                                result.data(), scanSize);
+        if (found.truncated) {
+            throw std::runtime_error("MultiScanner piece matches were truncated.");
+        }
+        result.resize(found.count);
+
+        // Keep the matches starting in the piece, offset to input positions.
+        const auto last = std::find_if(result.begin(), result.end(),
+                                       [&](const MatchEntry& entry) {
+            return static_cast<std::size_t>(entry.index) >= end - begin;
+        });
+        result.erase(last, result.end());
+        for (auto& entry : result) {
+            entry.index += begin;
+        }
+        return scanSize;
+    });
+
+    // Merge in input order, stopping at limit entries as PFAC::scan does. There
+    // is at most one match per byte, so that bounds the merged output.
+    const std::size_t maxResults = compactLimit(limit, size);
+    std::size_t total = 0;
+    output.clear();
+    for (auto i = 0u; i < pieces; i++) {
+        total += results[i].size();
+        if (output.size() < maxResults) {
+            const std::size_t count = std::min(results[i].size(),
+                                               maxResults - output.size());
+            output.insert(output.end(), results[i].begin(), results[i].begin() + count);
+        }
+    }
+    return {output.size(), total, total > maxResults};
+}
+
+/**
+ * Messages are never split, each is taken whole by the next free Device.
+ */
+CompactResult MultiScanner::scan(const std::vector<std::vector<char>>& messages,
+                                 std::vector<std::vector<MatchEntry>>& output) {
+    output.resize(messages.size());
+    std::vector<CompactResult> found(messages.size(), {0, 0, false});
+
+    distribute(messages.size(), 1,
+               [&](Device& device, std::size_t piece, std::size_t begin, std::size_t end) {
+        const auto& message = messages[begin];
+        auto& result = output[begin];
+        if (message.empty()) {
+            result.clear();
+            return std::size_t(0);
+        }
+
+        result.resize(message.size());
+        found[begin] = device.scanner->scan(message.data(), message.size(),
+                                            result.data(), message.size());
+        result.resize(found[begin].count);
+        return message.size();
+    });
+
+    CompactResult sum = {0, 0, false};
+    for (const auto& result : found) {
+        sum.count += result.count;
+        sum.total += result.total;
+        sum.truncated = sum.truncated || result.truncated;
+    }
+    return sum;
+}
+
+} // namespace gimbatuluk
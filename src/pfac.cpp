@@ -23,6 +23,7 @@
 #include "pfac.h"
 #include "dictionary.h"
 #include "scanner.h"
+#include "scanner-ac.h"
 #include "scanner-cpu.h"
 #include "scanner-opencl.h"
 
@@ -32,7 +33,10 @@
 #include <cstring>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -43,12 +47,33 @@ namespace gimbatuluk {
 #include "c++14-polyfill.h"
 
 constexpr std::size_t DEFAULT_BUFFER_SIZE = 150000000; // 150 MB
+constexpr std::size_t DEFAULT_PIPELINE_DEPTH = 3;
+
+/**
+ * Orders the Dictionary versions installed on a scanner. Each install takes a
+ * ticket when requested, in the calling thread, and once compiled installs its
+ * version only if no later ticket has already been installed, otherwise its
+ * version is discarded. So however long each swap takes to compile, the one
+ * requested last is the one left installed.
+ */
+struct DictionaryVersions {
+    std::mutex mutex;
+    std::uint64_t requested = 0;
+    std::uint64_t installed = 0;
+
+    std::uint64_t request() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ++requested;
+    }
+};
 
 //------------------------------------------------------------------------------
 // static free function prototype declarations.
-static std::unique_ptr<Scanner> makeScanner(const std::string deviceName,
-                                            const std::size_t bufferSize,
-                                            const Dictionary& dictionary);
+static std::size_t install(Scanner& scanner,
+                           DictionaryVersions& versions,
+                           const std::uint64_t ticket,
+                           std::shared_ptr<Dictionary> dictionary,
+                           const bool bigramTable);
 
 //------------------------------------------------------------------------------
 
@@ -76,6 +101,28 @@ std::vector<char> readFile(const std::string& fileName) {
     }
 }
 
+/**
+ * Utility free function to memory map a file read only, the zero copy
+ * alternative to readFile for inputs scanned via the pointer scans.
+ */
+std::shared_ptr<const MappedFile> mapFile(const std::string& fileName) {
+    return std::make_shared<const MappedFile>(fileName);
+}
+
+/**
+ * Compile a dictionary once, ahead of time, so that processes may install it
+ * via installCompiledDictionary without loading and compiling it themselves.
+ */
+std::size_t compileDictionary(const std::vector<char>& buffer,
+                              const std::string& fileName,
+                              const bool bigramTable) {
+    Dictionary dictionary;
+    dictionary.load(buffer);
+    dictionary.createHashTable(bigramTable);
+    dictionary.createFailureLinks();
+    dictionary.save(fileName);
+    return dictionary.getTableBytes();
+}
 
 //------------------------------------ PFAC ------------------------------------
 
@@ -93,17 +140,28 @@ std::vector<std::string> PFAC::getAvailableDevices() {
     std::vector<std::string> cpuDevices = CPUScanner::getAvailableDevices();
     devices.insert(devices.cend(), std::make_move_iterator(cpuDevices.cbegin()),
                                    std::make_move_iterator(cpuDevices.cend()));
+    std::vector<std::string> acDevices = AhoCorasickScanner::getAvailableDevices();
+    devices.insert(devices.cend(), std::make_move_iterator(acDevices.cbegin()),
+                                   std::make_move_iterator(acDevices.cend()));
     return devices;
 }
 
 
-static std::unique_ptr<Scanner> makeScanner(const std::string deviceName,
-                                            const std::size_t bufferSize,
-                                            const Dictionary& dictionary) {
+/**
+ * The host scanners complete each async scan before returning, so they have no
+ * pipeline and ignore pipelineDepth.
+ */
+std::unique_ptr<Scanner> makeScanner(const std::string deviceName,
+                                     const std::size_t bufferSize,
+                                     const std::size_t pipelineDepth,
+                                     const std::size_t maxMatches) {
     if (deviceName.find("OpenCL") == 0) {
-        return make_unique<OpenCLScanner>(deviceName, bufferSize, dictionary);
+        return make_unique<OpenCLScanner>(deviceName, bufferSize, pipelineDepth,
+                                          maxMatches);
     } else if (deviceName.find("Host:CPU[0]") == 0) {
-        return make_unique<CPUScanner>(deviceName, bufferSize, dictionary);
+        return make_unique<CPUScanner>(deviceName, bufferSize, maxMatches);
+    } else if (deviceName.find("Host:CPU[1]") == 0) {
+        return make_unique<AhoCorasickScanner>(deviceName, bufferSize, maxMatches);
     } else {
         std::string message = "Failed to find Device \"" +  deviceName + "\"";
         throw std::runtime_error(message);
@@ -113,14 +171,50 @@ static std::unique_ptr<Scanner> makeScanner(const std::string deviceName,
 PFAC::PFAC(): PFAC(getAvailableDevices()[0], DEFAULT_BUFFER_SIZE) {}
 PFAC::PFAC(const std::string deviceName): PFAC(deviceName, DEFAULT_BUFFER_SIZE) {}
 
+/**
+ * Compile the loaded dictionary, unless it is precompiled, and install it as
+ * the scanner's new Dictionary version if ticket is the latest requested of
+ * versions to be installed, returning the compiled table size. Once installed
+ * the Dictionary is shared with the scanner and any in-flight scans, so it is
+ * never modified.
+ */
+static std::size_t install(Scanner& scanner,
+                           DictionaryVersions& versions,
+                           const std::uint64_t ticket,
+                           std::shared_ptr<Dictionary> dictionary,
+                           const bool bigramTable) {
+    if (!dictionary->mapping) {
+        dictionary->createHashTable(bigramTable);
+        dictionary->createFailureLinks();
+        dictionary->releasePatterns();
+    }
+    const std::size_t tableBytes = dictionary->getTableBytes();
+
+    std::lock_guard<std::mutex> lock(versions.mutex);
+    if (ticket > versions.installed) {
+        scanner.installDictionary(std::move(dictionary));
+        versions.installed = ticket;
+    }
+    return tableBytes;
+}
+
 PFAC::PFAC(const std::string deviceName, const std::size_t bufferSize):
+PFAC(deviceName, bufferSize, DEFAULT_PIPELINE_DEPTH) {}
+
+PFAC::PFAC(const std::string deviceName, const std::size_t bufferSize,
+           const std::size_t pipelineDepth):
+PFAC(deviceName, bufferSize, pipelineDepth, bufferSize) {}
+
+PFAC::PFAC(const std::string deviceName, const std::size_t bufferSize,
+           const std::size_t pipelineDepth, const std::size_t maxMatches):
 dictionary(make_unique<Dictionary>()),
-scanner(makeScanner(deviceName, bufferSize, *dictionary)) {}
+scanner(makeScanner(deviceName, bufferSize, pipelineDepth, maxMatches)),
+versions(std::make_shared<DictionaryVersions>()) {}
 
 PFAC::~PFAC() = default;
 
 // Use default move and assignment special member operations, they perform a move
-// on the std::unique_ptr for dictionary and scanner, which is what we want.
+// on the smart pointers for dictionary, scanner and versions, which is what we want.
 PFAC::PFAC(PFAC&&) = default;
 PFAC& PFAC::operator=(PFAC&&) = default;
 
@@ -128,6 +222,10 @@ std::string PFAC::getDeviceName() {
     return scanner->getDeviceName();
 }
 
+std::size_t PFAC::getBufferSize() {
+    return scanner->getBufferSize();
+}
+
 void PFAC::clearDictionary() {
     dictionary->clear();
 }
@@ -136,9 +234,63 @@ void PFAC::loadDictionary(const std::vector<char>& buffer) {
     dictionary->load(buffer);
 }
 
-void PFAC::installDictionary() {
-    dictionary->createHashTable();
-    scanner->installDictionary();
+/**
+ * A copy of the loaded patterns is compiled as the installed version, as that
+ * is shared with the scanner and never modified, so the loaded Dictionary
+ * keeps its patterns and further patterns may be loaded to install with them.
+ */
+std::size_t PFAC::installDictionary(const bool bigramTable) {
+    auto next = std::make_shared<Dictionary>();
+    next->copyPatterns(*dictionary);
+    return install(*scanner, *versions, versions->request(), std::move(next),
+                   bigramTable);
+}
+
+std::size_t PFAC::installCompiledDictionary(const std::string& fileName) {
+    const auto ticket = versions->request();
+    auto compiled = std::make_shared<Dictionary>();
+    compiled->map(fileName);
+    return install(*scanner, *versions, ticket, std::move(compiled), false);
+}
+
+/**
+ * Load and compile buffer on a background thread then install it. The task
+ * shares ownership of the scanner and versions, so it remains valid if this
+ * PFAC instance is moved or destroyed before the returned future is ready.
+ * The ticket is taken now, so swaps are ordered as they are requested.
+ */
+std::future<std::size_t> PFAC::swapDictionary(const std::vector<char>& buffer,
+                                              const bool bigramTable) {
+    const std::shared_ptr<Scanner> target = scanner;
+    const std::shared_ptr<DictionaryVersions> order = versions;
+    const auto ticket = versions->request();
+    return std::async(std::launch::async, [target, order, ticket, buffer, bigramTable] {
+        auto next = std::make_shared<Dictionary>();
+        next->load(buffer);
+        return install(*target, *order, ticket, std::move(next), bigramTable);
+    });
+}
+
+std::string PFAC::getTableStorage() {
+    return scanner->getTableStorage();
+}
+
+std::size_t PFAC::getMaxPatternLength() {
+    const auto installed = scanner->getDictionary();
+    return installed ? installed->maxPatternLength : 0;
+}
+
+CompileTimings PFAC::getCompileTimings() {
+    const auto installed = scanner->getDictionary();
+    return installed ? installed->timings : dictionary->timings;
+}
+
+ScanProfile PFAC::profile(const std::vector<char>& input) {
+    const auto installed = scanner->getDictionary();
+    if (!installed) {
+        throw std::runtime_error("PFAC::profile Dictionary not installed.");
+    }
+    return installed->profile(input);
 }
 
 void PFAC::scan(const std::vector<char>& input,
@@ -151,10 +303,106 @@ void PFAC::scan(const std::vector<char>& input,
     scanner->scan(input, output, callback);
 }
 
+CompactResult PFAC::scan(const std::vector<char>& input,
+                         std::vector<MatchEntry>& output,
+                         const std::int32_t limit) {
+    return scanner->scan(input, output, limit);
+}
+
 void PFAC::scan(const std::vector<char>& input,
-                std::vector<MatchEntry>& output,
+                std::vector<MatchEntry>& output, CompactCallback callback,
                 const std::int32_t limit) {
-    return scanner->scan(input, output, limit);
+    scanner->scan(input, output, callback, limit);
+}
+
+void PFAC::scan(const char* input, const std::size_t size,
+                std::int32_t* output) {
+    scanner->scan(input, size, output);
+}
+
+CompactResult PFAC::scan(const char* input, const std::size_t size,
+                         MatchEntry* output, const std::size_t capacity) {
+    return scanner->scan(input, size, output, capacity);
+}
+
+CompactResult PFAC::scanAll(const std::vector<char>& input,
+                            std::vector<MatchEntry>& output,
+                            const std::int32_t limit) {
+    return scanner->scanAll(input, output, limit);
+}
+
+CompactResult PFAC::scanAll(const char* input, const std::size_t size,
+                            MatchEntry* output, const std::size_t capacity) {
+    return scanner->scanAll(input, size, output, capacity);
+}
+
+CompactResult PFAC::scan(const std::vector<char>& input,
+                         std::vector<MatchSpan>& output,
+                         const std::int32_t limit) {
+    return scanner->scanSpans(input, output, limit, false);
+}
+
+CompactResult PFAC::scanLeftmostLongest(const std::vector<char>& input,
+                                        std::vector<MatchSpan>& output,
+                                        const std::int32_t limit) {
+    return scanner->scanSpans(input, output, limit, true);
+}
+
+void PFAC::scan(const std::vector<std::vector<char>>& messages,
+                std::vector<std::vector<std::int32_t>>& output) {
+    scanner->scan(messages, output);
+}
+
+void PFAC::scan(const std::vector<std::vector<char>>& messages,
+                std::vector<std::vector<MatchEntry>>& output) {
+    scanner->scan(messages, output);
+}
+
+std::size_t PFAC::countMatches(const std::vector<char>& input) {
+    return scanner->countMatches(input.data(), input.size());
+}
+
+std::size_t PFAC::countMatches(const char* input, const std::size_t size) {
+    return scanner->countMatches(input, size);
+}
+
+void PFAC::matchHistogram(const std::vector<char>& input,
+                         std::vector<std::uint32_t>& output) {
+    scanner->matchHistogram(input.data(), input.size(), output);
+}
+
+void PFAC::matchHistogram(const char* input, const std::size_t size,
+                         std::vector<std::uint32_t>& output) {
+    scanner->matchHistogram(input, size, output);
+}
+
+MatchEntry PFAC::firstMatch(const std::vector<char>& input) {
+    return scanner->firstMatch(input.data(), input.size());
+}
+
+MatchEntry PFAC::firstMatch(const char* input, const std::size_t size) {
+    return scanner->firstMatch(input, size);
+}
+
+char* PFAC::getInputBuffer() {
+    return scanner->getInputBuffer();
+}
+
+const std::int32_t* PFAC::getOutputBuffer() {
+    return scanner->getOutputBuffer();
+}
+
+const MatchEntry* PFAC::getMatchBuffer() {
+    return scanner->getMatchBuffer();
+}
+
+void PFAC::scanBuffer(const std::size_t size) {
+    scanner->scanBuffer(size);
+}
+
+CompactResult PFAC::scanBufferCompact(const std::size_t size,
+                                      const std::int32_t limit) {
+    return scanner->scanBufferCompact(size, limit);
 }
 
 } // namespace gimbatuluk
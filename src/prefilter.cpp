@@ -0,0 +1,138 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "dictionary.h"
+#include "prefilter.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The SIMD implementations use GCC/Clang function target attributes so that
+ * the library itself does not need to be compiled with -mavx2, the appropriate
+ * implementation is then selected at runtime using __builtin_cpu_supports.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GIMBATULUK_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace gimbatuluk {
+
+std::uint64_t classifyScalar(const FirstBytePrefilter& prefilter,
+                             const std::uint8_t* buffer) {
+    std::uint64_t mask = 0;
+    for (auto i = 0u; i < PREFILTER_BLOCK_SIZE; i++) {
+        mask |= static_cast<std::uint64_t>(prefilter.valid[buffer[i]]) << i;
+    }
+    return mask;
+}
+
+#if defined(GIMBATULUK_X86_SIMD)
+__attribute__((target("ssse3")))
+std::uint64_t classifySSSE3(const FirstBytePrefilter& prefilter,
+                            const std::uint8_t* buffer) {
+    const __m128i low = _mm_load_si128(
+        reinterpret_cast<const __m128i*>(prefilter.lowNibble.data()));
+    const __m128i high = _mm_load_si128(
+        reinterpret_cast<const __m128i*>(prefilter.highNibble.data()));
+    const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+
+    std::uint64_t mask = 0;
+    for (auto i = 0u; i < PREFILTER_BLOCK_SIZE; i += 16) {
+        const __m128i input = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(buffer + i));
+        const __m128i lo = _mm_shuffle_epi8(low, _mm_and_si128(input, nibbleMask));
+        const __m128i hi = _mm_shuffle_epi8(high,
+            _mm_and_si128(_mm_srli_epi16(input, 4), nibbleMask));
+        const __m128i none = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero);
+        const std::uint32_t bits = ~_mm_movemask_epi8(none) & 0xFFFF;
+        mask |= static_cast<std::uint64_t>(bits) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+std::uint64_t classifyAVX2(const FirstBytePrefilter& prefilter,
+                           const std::uint8_t* buffer) {
+    // _mm256_shuffle_epi8 shuffles within each 128 bit lane, so broadcast the
+    // 16 entry tables into both lanes.
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_load_si128(
+        reinterpret_cast<const __m128i*>(prefilter.lowNibble.data())));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_load_si128(
+        reinterpret_cast<const __m128i*>(prefilter.highNibble.data())));
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+
+    std::uint64_t mask = 0;
+    for (auto i = 0u; i < PREFILTER_BLOCK_SIZE; i += 32) {
+        const __m256i input = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(buffer + i));
+        const __m256i lo = _mm256_shuffle_epi8(low, _mm256_and_si256(input, nibbleMask));
+        const __m256i hi = _mm256_shuffle_epi8(high,
+            _mm256_and_si256(_mm256_srli_epi16(input, 4), nibbleMask));
+        const __m256i none = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero);
+        const std::uint32_t bits = ~static_cast<std::uint32_t>(_mm256_movemask_epi8(none));
+        mask |= static_cast<std::uint64_t>(bits) << i;
+    }
+    return mask;
+}
+#endif
+
+//----------------------------- FirstBytePrefilter -----------------------------
+
+FirstBytePrefilter::FirstBytePrefilter():
+classifyBlock(classifyScalar),
+implementationName("scalar") {
+    valid.fill(false);
+    lowNibble.fill(0);
+    highNibble.fill(0);
+
+#if defined(GIMBATULUK_X86_SIMD)
+    if (__builtin_cpu_supports("avx2")) {
+        classifyBlock = classifyAVX2;
+        implementationName = "AVX2";
+    } else if (__builtin_cpu_supports("ssse3")) {
+        classifyBlock = classifySSSE3;
+        implementationName = "SSSE3";
+    }
+#endif
+}
+
+void FirstBytePrefilter::build(const std::array<std::int32_t, 256>& initialTransitions) {
+    valid.fill(false);
+    lowNibble.fill(0);
+    for (auto h = 0u; h < 16; h++) {
+        highNibble[h] = 1 << (h & 7);
+    }
+
+    for (auto ch = 0u; ch < 256; ch++) {
+        if (initialTransitions[ch] != INVALID) {
+            valid[ch] = true;
+            lowNibble[ch & 0x0F] |= highNibble[ch >> 4];
+        }
+    }
+}
+
+} // namespace gimbatuluk
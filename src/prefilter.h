@@ -0,0 +1,106 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Private implementation header, not part of public API
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace gimbatuluk {
+
+/**
+ * Most input positions fail on the very first transition, i.e. the input
+ * character has no transition from the initial state. The FirstBytePrefilter
+ * classifies PREFILTER_BLOCK_SIZE input bytes at a time against the set of
+ * valid first bytes using SIMD nibble lookups, returning a bitmask of the
+ * candidate start positions so that scanners only need to enter the state
+ * machine walk for set bits.
+ *
+ * The classification uses the shuffle based technique where each byte is split
+ * into its low and high nibble and each nibble indexes a 16 entry table using
+ * a byte shuffle (pshufb). The table entries are bitmasks of eight "buckets"
+ * and a byte is a candidate if the entries for its two nibbles share a bucket.
+ * The high nibble h selects bucket h & 7, so bytes 0x00-0x7F and 0x80-0xFF with
+ * equal nibbles share buckets, which may give false positives (never false
+ * negatives). The state machine walk rejects those, so results are unchanged.
+ *
+ * The implementation is chosen at runtime: AVX2 (32 bytes per instruction),
+ * SSSE3 (16 bytes per instruction) or a portable scalar table lookup.
+ */
+constexpr std::size_t PREFILTER_BLOCK_SIZE = 64;
+
+class FirstBytePrefilter {
+public:
+    FirstBytePrefilter();
+
+    void build(const std::array<std::int32_t, 256>& initialTransitions);
+
+    /**
+     * Return a bitmask with bit j set if buffer[j] may start a match, for the
+     * PREFILTER_BLOCK_SIZE bytes starting at buffer.
+     */
+    std::uint64_t classify(const std::uint8_t* buffer) const {
+        return classifyBlock(*this, buffer);
+    }
+
+    // Exact test of a single byte, used for the tail of the input.
+    bool test(const std::uint8_t ch) const {
+        return valid[ch];
+    }
+
+    const char* getImplementationName() const {
+        return implementationName;
+    }
+
+    // Index of the least significant set bit of a non-zero mask.
+    static std::size_t countTrailingZeros(const std::uint64_t mask) {
+#if defined(__GNUC__)
+        return __builtin_ctzll(mask);
+#else
+        std::size_t count = 0;
+        for (auto m = mask; (m & 1) == 0; m >>= 1) {
+            count++;
+        }
+        return count;
+#endif
+    }
+private:
+    std::array<bool, 256> valid;
+    alignas(16) std::array<std::uint8_t, 16> lowNibble;
+    alignas(16) std::array<std::uint8_t, 16> highNibble;
+
+    std::uint64_t (*classifyBlock)(const FirstBytePrefilter& prefilter,
+                                   const std::uint8_t* buffer);
+    const char* implementationName;
+
+    friend std::uint64_t classifyScalar(const FirstBytePrefilter& prefilter,
+                                        const std::uint8_t* buffer);
+    friend std::uint64_t classifySSSE3(const FirstBytePrefilter& prefilter,
+                                       const std::uint8_t* buffer);
+    friend std::uint64_t classifyAVX2(const FirstBytePrefilter& prefilter,
+                                      const std::uint8_t* buffer);
+};
+
+} // namespace gimbatuluk
@@ -0,0 +1,286 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "pfac.h"
+#include "program-cache.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gimbatuluk {
+
+// The first line of a cache file, changed if the file layout ever changes.
+constexpr auto CACHE_FILE_HEADER = "gimbatuluk OpenCL program binary 1";
+
+//------------------------------------------------------------------------------
+// static free function prototype declarations.
+static std::string defaultCacheDirectory();
+static std::uint64_t hash(const std::string& data);
+static std::string toHex(const std::uint64_t value);
+static bool makeDirectories(const std::string& path);
+static std::string cacheKey(const cl::Device& device, const std::string& source,
+                            const std::string& options);
+static bool readCache(const std::string& fileName, const std::string& key,
+                      std::vector<char>& binary);
+static void writeCache(const std::string& directory, const std::string& fileName,
+                       const std::string& key, const cl::Program& program);
+
+//------------------------------------------------------------------------------
+
+/**
+ * The cache directory is resolved from the environment on first use, after
+ * which setProgramCacheDirectory may replace it. cacheMutex guards both.
+ */
+static std::mutex cacheMutex;
+static bool cacheDirectoryResolved = false;
+static std::string cacheDirectory;
+
+void setProgramCacheDirectory(const std::string& directory) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cacheDirectory = directory;
+    cacheDirectoryResolved = true;
+}
+
+std::string getProgramCacheDirectory() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (!cacheDirectoryResolved) {
+        cacheDirectory = defaultCacheDirectory();
+        cacheDirectoryResolved = true;
+    }
+    return cacheDirectory;
+}
+
+static std::atomic<bool> specialisedPrograms(false);
+
+void setSpecialisedPrograms(const bool specialise) {
+    specialisedPrograms = specialise;
+}
+
+bool getSpecialisedPrograms() {
+    return specialisedPrograms;
+}
+
+cl::Program buildProgram(const cl::Context& context, const cl::Device& device,
+                         const std::string& source, const std::string& options) {
+    const std::vector<cl::Device> devices = {device};
+    const std::string directory = getProgramCacheDirectory();
+    const std::string key = cacheKey(device, source, options);
+    const std::string fileName = directory + "/" + toHex(hash(key)) + ".bin";
+
+    /**
+     * A binary that fails to load or build, e.g. one the driver no longer
+     * accepts despite reporting the same version, is simply rebuilt from
+     * source and replaced, as are cache files that can't be read.
+     */
+    std::vector<char> binary;
+    if (!directory.empty() && readCache(fileName, key, binary)) {
+        try {
+            const cl::Program::Binaries binaries = {{binary.data(), binary.size()}};
+            cl::Program program(context, devices, binaries);
+            program.build(devices, options.c_str());
+            return program;
+        } catch (const cl::Error& e) {
+        }
+    }
+
+    const cl::Program::Sources sources = {{source.data(), source.size()}};
+    cl::Program program(context, sources);
+
+    /**
+     * Build the OpenCL Program, if an exception occurs we retrieve the log and
+     * throw a more complete exception containing the compiler error message.
+     */
+    try {
+        program.build(devices, options.c_str());
+    } catch (const cl::Error& e) {
+        std::string message = "Failed to build OpenCL Program.\nBuild Log:\n" +
+                    program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
+        throw std::runtime_error(message);
+    }
+
+    if (!directory.empty()) {
+        writeCache(directory, fileName, key, program);
+    }
+    return program;
+}
+
+/**
+ * $GIMBATULUK_CACHE_DIR if set, which may be empty to disable the cache, else
+ * the XDG base directory convention, else no cache if there is no home.
+ */
+static std::string defaultCacheDirectory() {
+    if (const char* directory = std::getenv("GIMBATULUK_CACHE_DIR")) {
+        return directory;
+    }
+
+    if (const char* cache = std::getenv("XDG_CACHE_HOME")) {
+        if (*cache) {
+            return std::string(cache) + "/gimbatuluk";
+        }
+    }
+
+    if (const char* home = std::getenv("HOME")) {
+        if (*home) {
+            return std::string(home) + "/.cache/gimbatuluk";
+        }
+    }
+    return "";
+}
+
+// 64 bit FNV-1a, which is plenty to name cache files as readCache checks keys.
+static std::uint64_t hash(const std::string& data) {
+    std::uint64_t value = 14695981039346656037ull;
+    for (const unsigned char c : data) {
+        value = (value ^ c)*1099511628211ull;
+    }
+    return value;
+}
+
+static std::string toHex(const std::uint64_t value) {
+    std::ostringstream hex;
+    hex.width(16);
+    hex.fill('0');
+    hex << std::hex << value;
+    return hex.str();
+}
+
+// As mkdir -p, returning whether path is now a directory.
+static bool makeDirectories(const std::string& path) {
+    for (auto slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+        const std::string parent = path.substr(0, slash);
+        if (mkdir(parent.c_str(), 0755) == -1 && errno != EEXIST) {
+            return false;
+        }
+
+        if (slash == std::string::npos) {
+            break;
+        }
+    }
+
+    struct stat status;
+    return stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode);
+}
+
+/**
+ * Everything that determines the binary a build produces. The source is hashed
+ * as it's far too long to compare, and the key must be a single line.
+ */
+static std::string cacheKey(const cl::Device& device, const std::string& source,
+                            const std::string& options) {
+    std::string key = "device=" + device.getInfo<CL_DEVICE_NAME>() +
+                      ";vendor=" + device.getInfo<CL_DEVICE_VENDOR>() +
+                      ";version=" + device.getInfo<CL_DEVICE_VERSION>() +
+                      ";driver=" + device.getInfo<CL_DRIVER_VERSION>() +
+                      ";options=" + options +
+                      ";source=" + toHex(hash(source));
+    for (auto& c : key) {
+        if (c == '\n' || c == '\0') {
+            c = ' ';
+        }
+    }
+    return key;
+}
+
+/**
+ * A cache file holds CACHE_FILE_HEADER and the key, each on its own line,
+ * followed by the binary. A file whose key differs is another build whose key
+ * has the same hash, so is treated as a miss.
+ */
+static bool readCache(const std::string& fileName, const std::string& key,
+                      std::vector<char>& binary) {
+    std::ifstream file(fileName, std::ios::binary);
+    std::string header;
+    std::string fileKey;
+    if (!std::getline(file, header) || header != CACHE_FILE_HEADER ||
+        !std::getline(file, fileKey) || fileKey != key) {
+        return false;
+    }
+
+    binary.assign(std::istreambuf_iterator<char>(file),
+                  std::istreambuf_iterator<char>());
+    return !binary.empty();
+}
+
+/**
+ * The file is written under a name unique to this thread then renamed into
+ * place, so processes building concurrently never see a partial file and the
+ * last to finish wins. Any failure just leaves the cache without this build.
+ */
+static void writeCache(const std::string& directory, const std::string& fileName,
+                       const std::string& key, const cl::Program& program) {
+    /**
+     * The context has the one Device, so the Program has one binary. cl.hpp
+     * doesn't allocate the binary when getting CL_PROGRAM_BINARIES, so the
+     * C API is called directly with a buffer of the reported size.
+     */
+    std::size_t size = 0;
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size),
+                         &size, nullptr) != CL_SUCCESS || size == 0) {
+        return;
+    }
+
+    std::vector<unsigned char> binary(size);
+    unsigned char* binaries[] = {binary.data()};
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(binaries),
+                         binaries, nullptr) != CL_SUCCESS) {
+        return;
+    }
+
+    if (!makeDirectories(directory)) {
+        return;
+    }
+
+    const std::string temporary = fileName + "." + std::to_string(getpid()) + "." +
+        std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file << CACHE_FILE_HEADER << "\n" << key << "\n";
+        file.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+        if (!file.flush()) {
+            file.close();
+            std::remove(temporary.c_str());
+            return;
+        }
+    }
+
+    if (std::rename(temporary.c_str(), fileName.c_str()) != 0) {
+        std::remove(temporary.c_str());
+    }
+}
+
+} // namespace gimbatuluk
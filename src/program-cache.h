@@ -0,0 +1,61 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Private implementation header, not part of public API
+
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#if defined(__APPLE__) || defined(__MACOSX)
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+
+#include <cstddef>
+#include <string>
+
+namespace gimbatuluk {
+
+/**
+ * The OpenCL Program sources, embedded in the library at build time from
+ * pfac-opencl-gpu.cl and pfac-opencl-cpu.cl by cmake-modules/EmbedSource.cmake
+ * so that the library does not depend on the working directory.
+ */
+extern const unsigned char GPU_PROGRAM_SOURCE[];
+extern const std::size_t GPU_PROGRAM_SOURCE_SIZE;
+extern const unsigned char CPU_PROGRAM_SOURCE[];
+extern const std::size_t CPU_PROGRAM_SOURCE_SIZE;
+
+/**
+ * Build an OpenCL Program from source for device with the given build options.
+ * If the program cache holds the binary of an identical build, that is for
+ * the same Device, driver, source and options, it is loaded instead, which
+ * avoids the compile. Otherwise the source is built and its binary stored in
+ * the cache for later processes. Throws std::runtime_error, including the
+ * build log, if the build fails. The cache is best effort, so a missing,
+ * unwritable or stale cache only costs the compile.
+ */
+cl::Program buildProgram(const cl::Context& context, const cl::Device& device,
+                         const std::string& source, const std::string& options);
+
+} // namespace gimbatuluk
@@ -0,0 +1,119 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include "pfac.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace gimbatuluk {
+
+//--------------------------------- ScanStream ---------------------------------
+
+ScanStream::ScanStream(PFAC& pfac): pfac(pfac), bufferOffset(0) {}
+
+/**
+ * Append the chunk to the retained bytes and scan them, a piece at a time if
+ * necessary to stay within the PFAC buffer size. Only matches starting in the
+ * first buffer.size() - overlap bytes are complete, as any pattern starting
+ * there must end within the buffer, the remaining overlap bytes are retained
+ * and scanned again with the next piece.
+ */
+void ScanStream::scan(const std::vector<char>& chunk,
+                      std::vector<StreamMatchEntry>& output) {
+    scan(chunk.data(), chunk.size(), output);
+}
+
+void ScanStream::scan(const char* chunk, const std::size_t size,
+                      std::vector<StreamMatchEntry>& output) {
+    const std::size_t maxPatternLength = pfac.getMaxPatternLength();
+    const std::size_t overlap = maxPatternLength > 0 ? maxPatternLength - 1 : 0;
+    const std::size_t bufferSize = pfac.getBufferSize();
+    if (bufferSize <= overlap) {
+        throw std::runtime_error("ScanStream buffer is smaller than the longest pattern.");
+    }
+
+    const char* next = chunk;
+    const char* const end = chunk + size;
+    while (next != end) {
+        // Any bytes retained beyond the current overlap are complete, so the
+        // buffer never holds more than overlap bytes between scans.
+        const std::size_t room = bufferSize - buffer.size();
+        const char* last = (static_cast<std::size_t>(end - next) > room) ?
+                            next + room : end;
+        buffer.insert(buffer.end(), next, last);
+        next = last;
+
+        if (buffer.size() > overlap) {
+            scanBuffer(buffer.size() - overlap, output);
+        }
+    }
+}
+
+void ScanStream::finish(std::vector<StreamMatchEntry>& output) {
+    if (!buffer.empty()) {
+        scanBuffer(buffer.size(), output);
+    }
+}
+
+std::uint64_t ScanStream::getOffset() const {
+    return bufferOffset + buffer.size();
+}
+
+/**
+ * Scan buffer, report the matches starting in its first complete bytes then
+ * discard those bytes so that only the bytes still to be reported remain. If
+ * the PFAC's maxMatches truncated the matches, only those up to the last match
+ * returned are known to be complete, so they are reported and discarded and
+ * the remainder of the buffer scanned again.
+ */
+void ScanStream::scanBuffer(std::size_t complete,
+                            std::vector<StreamMatchEntry>& output) {
+    while (complete > 0) {
+        const auto result = pfac.scan(buffer, matches);
+        std::size_t scanned = complete;
+        if (result.truncated) {
+            if (matches.empty()) {
+                throw std::runtime_error("ScanStream PFAC maxMatches is zero.");
+            }
+            scanned = std::min<std::size_t>(complete, matches.back().index + 1);
+        }
+
+        for (const auto& match : matches) {
+            const std::size_t index = match.index;
+            if (index >= scanned) {
+                break; // Compact output is in index order, so no more are complete.
+            }
+            output.push_back({bufferOffset + index, match.value});
+        }
+
+        buffer.erase(buffer.begin(), buffer.begin() + scanned);
+        bufferOffset += scanned;
+        complete -= scanned;
+    }
+}
+
+} // namespace gimbatuluk
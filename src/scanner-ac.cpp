@@ -0,0 +1,161 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "pfac.h"
+#include "dictionary.h"
+#include "scanner.h"
+#include "scanner-ac.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gimbatuluk {
+
+//------------------------------------------------------------------------------
+// static free function prototype declarations.
+template<typename F>
+static void search(const Dictionary& dictionary,
+                   const std::uint8_t* buffer,
+                   const std::size_t size,
+                   const std::size_t begin,
+                   const std::size_t end,
+                   F&& f);
+
+//------------------------------------------------------------------------------
+
+/**
+ * Run the Aho-Corasick automaton over the segment of the buffer that may hold
+ * matches starting in [begin, end), calling f(start, patternID) for each such
+ * match. The automaton starts in the initial state at begin, so no match that
+ * starts before begin can be found, and the segment is extended by the longest
+ * pattern length so that matches starting near end are completed. Matches are
+ * found in order of their end position, so for a given start position the
+ * patterns are reported shortest first.
+ */
+template<typename F>
+static inline void search(const Dictionary& dictionary,
+                          const std::uint8_t* buffer,
+                          const std::size_t size,
+                          const std::size_t begin,
+                          const std::size_t end,
+                          F&& f) {
+    const std::int32_t initialState = dictionary.initialState;
+    const std::size_t overlap = dictionary.maxPatternLength > 0 ?
+                                dictionary.maxPatternLength - 1 : 0;
+    const std::size_t last = (end + overlap) < size ? end + overlap : size;
+
+    std::int32_t state = initialState;
+    for (auto pos = begin; pos < last; pos++) {
+        const std::int32_t inputChar = buffer[pos];
+
+        // Follow failure links until a state has a transition on inputChar.
+        std::int32_t nextState = INVALID;
+        while (state != initialState &&
+               (nextState = dictionary.lookup(state, inputChar)) == INVALID) {
+            state = dictionary.failure[state];
+        }
+
+        if (state == initialState) {
+            nextState = dictionary.initialTransitions[inputChar];
+            state = (nextState == INVALID) ? initialState : nextState;
+        } else {
+            state = nextState;
+        }
+
+        // Report the current state, if a match, then all matches on its output links.
+        std::int32_t match = (state < initialState) ? state : dictionary.outputLink[state];
+        while (match != INVALID) {
+            const std::size_t start = pos + 1 - dictionary.patternLength[match];
+            if (start < end) {
+                f(start, match);
+            }
+            match = dictionary.outputLink[match];
+        }
+    }
+}
+
+//----------------------------- AhoCorasickScanner -----------------------------
+
+std::vector<std::string> AhoCorasickScanner::getAvailableDevices() {
+    std::vector<std::string> devices;
+    devices.emplace_back("Host:CPU[1]:Aho-Corasick DPAC (" +
+                         std::to_string(getThreadCount()) + " threads)");
+    return devices;
+}
+
+AhoCorasickScanner::AhoCorasickScanner(const std::string deviceName,
+                                       const std::size_t bufferSize,
+                                       const std::size_t maxMatches):
+CPUScanner(deviceName, bufferSize, maxMatches) {}
+
+void AhoCorasickScanner::scan(const char* input, const std::size_t size,
+                              std::int32_t* output) {
+    const auto tables = checkInput(size);
+    const auto& dictionary = *tables->dictionary;
+    const auto buffer = reinterpret_cast<const std::uint8_t*>(input);
+
+    partition(size, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        std::fill(output + begin, output + end, INVALID);
+        // Longer patterns at a given start are found later, so overwrite.
+        search(dictionary, buffer, size, begin, end,
+               [&](std::size_t start, std::int32_t match) {
+            output[start] = match;
+        });
+    });
+}
+
+std::vector<std::vector<MatchEntry>>
+AhoCorasickScanner::collectMatches(const char* input, const std::size_t size) {
+    const auto tables = checkInput(size);
+    const auto& dictionary = *tables->dictionary;
+    const auto buffer = reinterpret_cast<const std::uint8_t*>(input);
+
+    std::vector<std::vector<MatchEntry>> results(chunkCount(size));
+    partition(size, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        auto& result = results[chunk];
+        search(dictionary, buffer, size, begin, end,
+               [&](std::size_t start, std::int32_t match) {
+            result.push_back({static_cast<std::int32_t>(start), match});
+        });
+
+        /**
+         * Matches were found in end position order, so stable sort them into
+         * start position order then keep only the last, i.e. longest, match
+         * for each start position, which is what the PFAC scanners report.
+         */
+        std::stable_sort(result.begin(), result.end(),
+                         [](const MatchEntry& a, const MatchEntry& b) {
+            return a.index < b.index;
+        });
+        auto last = std::unique(result.rbegin(), result.rend(),
+                                [](const MatchEntry& a, const MatchEntry& b) {
+            return a.index == b.index;
+        });
+        result.erase(result.begin(), last.base());
+    });
+    return results;
+}
+
+} // namespace gimbatuluk
@@ -0,0 +1,64 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Private implementation header, not part of public API
+
+#pragma once
+
+#include "pfac.h"
+#include "scanner.h"
+#include "scanner-cpu.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gimbatuluk {
+
+/**
+ * Host scanner using the classic (failure link) Aho-Corasick algorithm rather
+ * than PFAC. The input is partitioned into overlapping segments that are each
+ * scanned sequentially by a thread from the pool, which is the Data Parallel
+ * Aho-Corasick (DPAC) approach. The results are identical to the PFAC scanners
+ * so the two engines may be compared directly for a given dictionary and input.
+ */
+class AhoCorasickScanner: public CPUScanner {
+public:
+    static std::vector<std::string> getAvailableDevices();
+
+    AhoCorasickScanner(const std::string deviceName,
+                       const std::size_t bufferSize,
+                       const std::size_t maxMatches);
+
+    // The other scans are inherited, the dense and compact scans use these
+    // overrides.
+    using CPUScanner::scan;
+
+    void scan(const char* input, const std::size_t size,
+              std::int32_t* output) override;
+protected:
+    std::vector<std::vector<MatchEntry>> collectMatches(const char* input,
+                                                        const std::size_t size) override;
+};
+
+} // namespace gimbatuluk
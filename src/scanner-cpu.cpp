@@ -24,108 +24,641 @@
 #include "dictionary.h"
 #include "scanner.h"
 #include "scanner-cpu.h"
+#include "prefilter.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
-#include <iostream>
+#include <future>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
-// TODO CPU scan not yet implemented.
-
 namespace gimbatuluk {
 
+/**
+ * Inputs smaller than MIN_CHUNK_SIZE bytes per thread are not worth the cost
+ * of dispatching to the thread pool, so the chunk count is reduced until each
+ * chunk holds at least this many start positions.
+ */
+constexpr std::size_t MIN_CHUNK_SIZE = 64*1024;
+
+//------------------------------------------------------------------------------
+// static free function prototype declarations.
+static std::int32_t match(const Dictionary& dictionary,
+                          const std::uint8_t* buffer,
+                          std::size_t pos,
+                          const std::size_t size);
+template<typename F>
+static void forEachCandidate(const FirstBytePrefilter& prefilter,
+                             const std::uint8_t* buffer,
+                             const std::size_t begin,
+                             const std::size_t end,
+                             F&& f);
+template<typename F>
+static std::size_t findCandidate(const FirstBytePrefilter& prefilter,
+                                 const std::uint8_t* buffer,
+                                 const std::size_t begin,
+                                 const std::size_t end,
+                                 F&& f);
+template<typename T>
+static CompactResult gather(const std::vector<std::vector<T>>& results,
+                            const std::size_t maxResults,
+                            T* output);
+template<typename T>
+static CompactResult gather(const std::vector<std::vector<T>>& results,
+                            const std::size_t maxResults,
+                            std::vector<T>& output);
+
+//------------------------------------------------------------------------------
+
+/**
+ * Run the PFAC state machine from position pos until it fails or the end of the
+ * buffer is reached, returning the ID of the longest pattern matched starting
+ * at pos or INVALID if there is no match. As with the Kernels a deeper match
+ * overwrites a shallower one, so only the longest pattern is reported.
+ */
+static inline std::int32_t match(const Dictionary& dictionary,
+                                 const std::uint8_t* buffer,
+                                 std::size_t pos,
+                                 const std::size_t size) {
+    const std::int32_t initialState = dictionary.initialState;
+    std::int32_t match = INVALID;
+    std::int32_t nextState = dictionary.initialTransitions[buffer[pos]];
+    if (nextState != INVALID) {
+        if (nextState < initialState) {
+            match = nextState;
+        }
+        pos = pos + 1;
+
+        // Resolve the second character using the bigram table if present.
+        if (!dictionary.bigramTransitions.empty() && pos < size) {
+            nextState = dictionary.bigramTransitions[(buffer[pos - 1] << 8) | buffer[pos]];
+            if (nextState == INVALID) {
+                return match;
+            }
+
+            if (nextState < initialState) {
+                match = nextState;
+            }
+            pos = pos + 1;
+        }
+
+        while (pos < size) {
+            nextState = dictionary.lookup(nextState, buffer[pos]);
+            if (nextState == INVALID) {
+                break;
+            }
+
+            if (nextState < initialState) {
+                match = nextState;
+            }
+            pos = pos + 1;
+        }
+    }
+    return match;
+}
+
+/**
+ * Call f(pos) for each position in [begin, end) whose byte has a transition
+ * from the initial state, using the prefilter to classify whole blocks of
+ * input at a time. The remaining tail of the range is tested byte by byte.
+ */
+template<typename F>
+static inline void forEachCandidate(const FirstBytePrefilter& prefilter,
+                                    const std::uint8_t* buffer,
+                                    const std::size_t begin,
+                                    const std::size_t end,
+                                    F&& f) {
+    auto i = begin;
+    for (; i + PREFILTER_BLOCK_SIZE <= end; i += PREFILTER_BLOCK_SIZE) {
+        for (auto mask = prefilter.classify(buffer + i); mask; mask &= mask - 1) {
+            f(i + FirstBytePrefilter::countTrailingZeros(mask));
+        }
+    }
+
+    for (; i < end; i++) {
+        if (prefilter.test(buffer[i])) {
+            f(i);
+        }
+    }
+}
+
+/**
+ * As forEachCandidate but stopping at the first candidate position for which
+ * f(pos) returns true, which is returned, or returning end if there is none.
+ */
+template<typename F>
+static inline std::size_t findCandidate(const FirstBytePrefilter& prefilter,
+                                        const std::uint8_t* buffer,
+                                        const std::size_t begin,
+                                        const std::size_t end,
+                                        F&& f) {
+    auto i = begin;
+    for (; i + PREFILTER_BLOCK_SIZE <= end; i += PREFILTER_BLOCK_SIZE) {
+        for (auto mask = prefilter.classify(buffer + i); mask; mask &= mask - 1) {
+            const std::size_t pos = i + FirstBytePrefilter::countTrailingZeros(mask);
+            if (f(pos)) {
+                return pos;
+            }
+        }
+    }
+
+    for (; i < end; i++) {
+        if (prefilter.test(buffer[i]) && f(i)) {
+            return i;
+        }
+    }
+    return end;
+}
+
+//--------------------------------- CPUScanner ---------------------------------
+
+std::size_t CPUScanner::getThreadCount() {
+    const std::size_t threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : threads;
+}
+
+/**
+ * The host CPU is always available, so this returns a single Device whose name
+ * follows the same <Host>:<CPU>[<number>]:<name> form as the OpenCL Devices.
+ */
 std::vector<std::string> CPUScanner::getAvailableDevices() {
     std::vector<std::string> devices;
-    // devices.emplace_back("Host:CPU[0]:"); // TODO add this when implemented.
+    devices.emplace_back("Host:CPU[0]:PFAC (" +
+                         std::to_string(getThreadCount()) + " threads)");
     return devices;
 }
 
 
 CPUScanner::CPUScanner(const std::string deviceName,
                        const std::size_t bufferSize,
-                       const Dictionary& dictionary):
+                       const std::size_t maxMatches):
 deviceName(deviceName),
-dictionary(&dictionary) {
-    std::cout << "\tCPUScanner Constructor deviceName = " << deviceName << ", bufferSize " << bufferSize << std::endl;
-    std::cout << "\t\tNot yet implemented" << std::endl;
-//    std::cout << "\tthis = " << this << std::endl;
-//    std::cout << "\tDictionary = " << this->dictionary << std::endl;
-}
+bufferSize(bufferSize),
+maxMatches(maxMatches),
+pool(getThreadCount()) {}
 
 std::string CPUScanner::getDeviceName() {
     return deviceName;
 }
 
-void CPUScanner::installDictionary() {
-    std::cout << "\t\tCPUScanner::installDictionary" << std::endl;
-    std::cout << "\t\tNot yet implemented" << std::endl;
+std::size_t CPUScanner::getBufferSize() {
+    return bufferSize;
+}
+
+/**
+ * The host scanner walks the Dictionary's compiled hash tables in place so
+ * there is nothing to copy, we just build the first byte prefilter from the
+ * initial transitions then atomically replace the installed version.
+ */
+void CPUScanner::installDictionary(std::shared_ptr<const Dictionary> dictionary) {
+    auto next = std::make_shared<HostDictionary>();
+    next->prefilter.build(dictionary->initialTransitions);
+    next->dictionary = std::move(dictionary);
+    std::atomic_store(&installed, std::shared_ptr<const HostDictionary>(std::move(next)));
+}
+
+std::shared_ptr<const Dictionary> CPUScanner::getDictionary() {
+    const auto current = std::atomic_load(&installed);
+    return current ? current->dictionary : nullptr;
+}
+
+// The tables are always in host memory, there's no Device to choose for.
+std::string CPUScanner::getTableStorage() {
+    return std::atomic_load(&installed) ? "host" : "";
+}
+
+std::size_t CPUScanner::chunkCount(const std::size_t size) const {
+    const std::size_t maxChunks = (size + MIN_CHUNK_SIZE - 1)/MIN_CHUNK_SIZE;
+    return maxChunks < pool.size() ? maxChunks : pool.size();
+}
+
+void CPUScanner::partition(const std::size_t size,
+                           const std::function<void(std::size_t begin,
+                                                    std::size_t end,
+                                                    std::size_t chunk)>& f) {
+    const std::size_t chunks = chunkCount(size);
+    if (chunks <= 1) { // Not worth dispatching, run on the calling thread.
+        f(0, size, 0);
+        return;
+    }
+
+    const std::size_t chunkSize = (size + chunks - 1)/chunks;
+    std::vector<std::future<void>> results;
+    results.reserve(chunks);
+    for (auto i = 0u; i < chunks; i++) {
+        const std::size_t begin = i*chunkSize;
+        const std::size_t end = (begin + chunkSize) < size ? begin + chunkSize : size;
+        results.emplace_back(pool.enqueue([&f, begin, end, i] {f(begin, end, i);}));
+    }
+
+    // Wait for every chunk before rethrowing, as the chunks reference f.
+    for (auto& result : results) {
+        result.wait();
+    }
+    for (auto& result : results) {
+        result.get();
+    }
+}
+
+/**
+ * Concatenate the per chunk compact results in chunk order, which is also input
+ * order, stopping at maxResults entries as is done by the pfacCompact Kernel.
+ * Every chunk is scanned in full, so the total is always exact.
+ */
+template<typename T>
+static CompactResult gather(const std::vector<std::vector<T>>& results,
+                            const std::size_t maxResults,
+                            T* output) {
+    std::size_t total = 0;
+    for (const auto& result : results) {
+        const std::size_t count = total < maxResults ?
+                                  std::min(result.size(), maxResults - total) : 0;
+        std::copy(result.begin(), result.begin() + count, output + total);
+        total += result.size();
+    }
+    return {std::min(total, maxResults), total, total > maxResults};
+}
+
+// As above, sizing output to hold the entries gathered.
+template<typename T>
+static CompactResult gather(const std::vector<std::vector<T>>& results,
+                            const std::size_t maxResults,
+                            std::vector<T>& output) {
+    std::size_t total = 0;
+    for (const auto& result : results) {
+        total += result.size();
+    }
+    output.resize(std::min(total, maxResults));
+    return gather(results, maxResults, output.data());
+}
+
+std::shared_ptr<const CPUScanner::HostDictionary>
+CPUScanner::checkInput(const std::size_t size) {
+    auto current = std::atomic_load(&installed);
+    if (!current) {
+        throw std::runtime_error("CPUScanner Dictionary not installed.");
+    }
+
+    if (size == 0) {
+        throw std::runtime_error("Input vector uninitialised.");
+    }
+
+    if (size > bufferSize) {
+        throw std::runtime_error("Input vector is larger than Device buffer.");
+    }
+    return current;
 }
 
-// Needs initialState, initialTransitions, hashRow, hashVal
 void CPUScanner::scan(const std::vector<char>& input,
                       std::vector<std::int32_t>& output) {
-//    std::cout << "\t\tCPUScanner::scan, input.size() = " << input.size() << std::endl;
-/*
-    for (auto i = 0u; i < buffer.size(); i++) {
-//console.log("i = " + i);
-        std::uint32_t pos = i;
-        std::uint8_t inputChar = buffer[pos];
-//console.log("inputChar = " + String.fromCharCode(inputChar) + " (" + inputChar + ")");
-
-        std::int32_t nextState = initialTransitions[inputChar];
-        if (nextState != INVALID) {
-            if (nextState < initialState){
-                //match = nextState;
-std::cout << "xx matched pattern " << nextState << " at " << i << std::endl;
+    checkInput(input.size());
+    output.resize(input.size());
+    scan(input.data(), input.size(), output.data());
+}
+
+/**
+ * The host scan completes synchronously, so the "async" scan simply performs
+ * the scan then invokes the callback on the calling thread. Because the input
+ * and output are consistent by the time scan returns callers may safely reuse
+ * them, which is a stronger guarantee than the OpenCL async scan provides.
+ */
+void CPUScanner::scan(const std::vector<char>& input,
+                      std::vector<std::int32_t>& output, Callback callback) {
+    scan(input, output);
+    callback(input, output);
+}
+
+CompactResult CPUScanner::scan(const std::vector<char>& input,
+                               std::vector<MatchEntry>& output,
+                               const std::int32_t limit) {
+    return gather(collectMatches(input.data(), input.size()),
+                  compactLimit(limit, maxMatches), output);
+}
+
+// As the "async" dense scan, the callback is invoked on the calling thread.
+void CPUScanner::scan(const std::vector<char>& input,
+                      std::vector<MatchEntry>& output, CompactCallback callback,
+                      const std::int32_t limit) {
+    const auto result = scan(input, output, limit);
+    callback(input, output, result);
+}
+
+void CPUScanner::scan(const char* input, const std::size_t size,
+                      std::int32_t* output) {
+    const auto tables = checkInput(size);
+    const auto& dictionary = *tables->dictionary;
+    const auto buffer = reinterpret_cast<const std::uint8_t*>(input);
+
+    partition(size, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        std::fill(output + begin, output + end, INVALID);
+        forEachCandidate(tables->prefilter, buffer, begin, end, [&](std::size_t i) {
+            output[i] = match(dictionary, buffer, i, size);
+        });
+    });
+}
+
+CompactResult CPUScanner::scan(const char* input, const std::size_t size,
+                               MatchEntry* output, const std::size_t capacity) {
+    return gather(collectMatches(input, size), std::min(capacity, maxMatches), output);
+}
+
+std::vector<std::vector<MatchEntry>> CPUScanner::collectMatches(const char* input,
+                                                                const std::size_t size) {
+    const auto tables = checkInput(size);
+    const auto& dictionary = *tables->dictionary;
+    const auto buffer = reinterpret_cast<const std::uint8_t*>(input);
+
+    // Each chunk compacts its own matches, these are then concatenated in
+    // order, which yields the same ordering as the pfacCompact Kernel.
+    std::vector<std::vector<MatchEntry>> results(chunkCount(size));
+    partition(size, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        auto& result = results[chunk];
+        forEachCandidate(tables->prefilter, buffer, begin, end, [&](std::size_t i) {
+            const std::int32_t value = match(dictionary, buffer, i, size);
+            if (value != INVALID) {
+                result.push_back({static_cast<std::int32_t>(i), value});
             }
-            pos = pos + 1;
-            while (pos < buffer.size()) {
-                inputChar = buffer[pos];
-
-                // lookup next state
-                const int2& row = hashRow[nextState];
-                const std::int32_t offset = row.x;
-                nextState = INVALID;
-                if (offset >= 0) { 
-                    const std::int32_t k_sminus1 = row.y;
-                    const std::int32_t sminus1 = k_sminus1 & MASK;
-                    const std::int32_t k = k_sminus1 >> MASKBITS; 
-
-                    const std::int32_t p = mod257(k * inputChar) & sminus1;
-                    const int2& value = hashVal[offset + p];
-                    if (inputChar == value.x) {
-                        nextState = value.y;
-                    }
-                }
+        });
+    });
+    return results;
+}
 
-                if (nextState == INVALID) {
-                    break;
-                }
+/**
+ * The reduced scans accumulate per chunk results which are then combined, so
+ * no per character or per match output is ever written.
+ */
+std::size_t CPUScanner::countMatches(const char* input, const std::size_t size) {
+    const auto tables = checkInput(size);
+    const auto& dictionary = *tables->dictionary;
+    const auto buffer = reinterpret_cast<const std::uint8_t*>(input);
+
+    std::vector<std::size_t> counts(chunkCount(size), 0);
+    partition(size, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        std::size_t count = 0;
+        forEachCandidate(tables->prefilter, buffer, begin, end, [&](std::size_t i) {
+            count += (match(dictionary, buffer, i, size) != INVALID);
+        });
+        counts[chunk] = count;
+    });
+
+    std::size_t count = 0;
+    for (auto chunk : counts) {
+        count += chunk;
+    }
+    return count;
+}
+
+void CPUScanner::matchHistogram(const char* input, const std::size_t size,
+                               std::vector<std::uint32_t>& output) {
+    const auto tables = checkInput(size);
+    const auto& dictionary = *tables->dictionary;
+    const auto buffer = reinterpret_cast<const std::uint8_t*>(input);
+    const std::size_t patterns = dictionary.initialState;
+
+    std::vector<std::vector<std::uint32_t>> histograms(chunkCount(size));
+    partition(size, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        auto& histogram = histograms[chunk];
+        histogram.assign(patterns, 0);
+        forEachCandidate(tables->prefilter, buffer, begin, end, [&](std::size_t i) {
+            const std::int32_t value = match(dictionary, buffer, i, size);
+            if (value != INVALID) {
+                histogram[value]++;
+            }
+        });
+    });
+
+    output.assign(patterns, 0);
+    for (const auto& histogram : histograms) {
+        for (auto i = 0u; i < histogram.size(); i++) {
+            output[i] += histogram[i];
+        }
+    }
+}
+
+/**
+ * Each chunk stops at its own first match, the earliest chunk with a match
+ * then holds the first match of the whole input.
+ */
+MatchEntry CPUScanner::firstMatch(const char* input, const std::size_t size) {
+    const auto tables = checkInput(size);
+    const auto& dictionary = *tables->dictionary;
+    const auto buffer = reinterpret_cast<const std::uint8_t*>(input);
+
+    std::vector<MatchEntry> firsts(chunkCount(size), {INVALID, INVALID});
+    partition(size, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        auto& first = firsts[chunk];
+        findCandidate(tables->prefilter, buffer, begin, end, [&](std::size_t i) {
+            first = {static_cast<std::int32_t>(i), match(dictionary, buffer, i, size)};
+            return first.value != INVALID;
+        });
+        if (first.value == INVALID) {
+            first.index = INVALID;
+        }
+    });
+
+    for (const auto& first : firsts) {
+        if (first.index != INVALID) {
+            return first;
+        }
+    }
+    return {INVALID, INVALID};
+}
+
+/**
+ * Find every match of size bytes of input for scanAll, per chunk as for the
+ * pointer compact scan, but each longest match is followed by the
+ * Dictionary's prefixLink chain to report the shorter patterns matching at
+ * the same position too, which are then reversed so shorter come first.
+ */
+std::vector<std::vector<MatchEntry>> CPUScanner::collectAll(const char* input,
+                                                            const std::size_t size) {
+    const auto tables = checkInput(size);
+    const auto& dictionary = *tables->dictionary;
+    const auto buffer = reinterpret_cast<const std::uint8_t*>(input);
+
+    std::vector<std::vector<MatchEntry>> results(chunkCount(size));
+    partition(size, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        auto& result = results[chunk];
+        forEachCandidate(tables->prefilter, buffer, begin, end, [&](std::size_t i) {
+            const auto first = result.size();
+            const auto index = static_cast<std::int32_t>(i);
+            for (auto value = match(dictionary, buffer, i, size); value != INVALID;
+                 value = dictionary.prefixLink[value]) {
+                result.push_back({index, value});
+            }
+            std::reverse(result.begin() + first, result.end());
+        });
+    });
+    return results;
+}
+
+/**
+ * A position may match several patterns, so the output is sized from the
+ * matches found rather than the input.
+ */
+CompactResult CPUScanner::scanAll(const std::vector<char>& input,
+                                  std::vector<MatchEntry>& output,
+                                  const std::int32_t limit) {
+    return gather(collectAll(input.data(), input.size()),
+                  compactLimit(limit, maxMatches), output);
+}
+
+CompactResult CPUScanner::scanAll(const char* input, const std::size_t size,
+                                  MatchEntry* output, const std::size_t capacity) {
+    return gather(collectAll(input, size), std::min(capacity, maxMatches), output);
+}
+
+/**
+ * As the pointer compact scan, adding the end of each match from the compiled
+ * pattern lengths. The leftmost-longest selection is inherently sequential,
+ * each choice depending on the end of the last, but only needs a single pass
+ * over the per chunk results, which are in input order.
+ */
+CompactResult CPUScanner::scanSpans(const std::vector<char>& input,
+                                    std::vector<MatchSpan>& output,
+                                    const std::int32_t limit,
+                                    const bool leftmostLongest) {
+    const std::size_t size = input.size();
+    const auto tables = checkInput(size);
+    const auto& dictionary = *tables->dictionary;
+    const auto buffer = reinterpret_cast<const std::uint8_t*>(input.data());
+
+    std::vector<std::vector<MatchSpan>> results(chunkCount(size));
+    partition(size, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        auto& result = results[chunk];
+        forEachCandidate(tables->prefilter, buffer, begin, end, [&](std::size_t i) {
+            const std::int32_t value = match(dictionary, buffer, i, size);
+            if (value != INVALID) {
+                const auto index = static_cast<std::int32_t>(i);
+                result.push_back({index, index + dictionary.patternLength[value], value});
+            }
+        });
+    });
 
-                if (nextState < initialState) {
-                    //match = nextState;
-std::cout << "matched pattern " << nextState << " at " << i << std::endl;
+    if (leftmostLongest) {
+        std::int32_t end = 0;
+        for (auto& result : results) {
+            auto selected = result.begin();
+            for (const auto& span : result) {
+                if (span.index >= end) {
+                    *selected++ = span;
+                    end = span.end;
                 }
-                pos = pos + 1;
             }
+            result.erase(selected, result.end());
         }
     }
-*/
+
+    return gather(results, compactLimit(limit, maxMatches), output);
 }
 
-void CPUScanner::scan(const std::vector<char>& input,
-                      std::vector<std::int32_t>& output, Callback callback) {
-//    std::cout << "\t\tCPUScanner::scanAsync" << std::endl;
-//    std::cout << "\t\tNot yet implemented" << std::endl;
+/**
+ * Call f(i) for each non-empty message i of a batch. Messages of at most
+ * MIN_CHUNK_SIZE bytes, which each scan on the calling thread, are shared
+ * between the thread pool by their offset in the batch. Larger messages are
+ * then passed to f in turn, as their scans partition them across the pool.
+ */
+void CPUScanner::forEachMessage(const std::vector<std::vector<char>>& messages,
+                                const std::function<void(std::size_t i)>& f) {
+    std::vector<std::size_t> small;
+    std::vector<std::size_t> offsets;
+    std::size_t size = 0;
+    for (auto i = 0u; i < messages.size(); i++) {
+        if (!messages[i].empty() && messages[i].size() <= MIN_CHUNK_SIZE) {
+            small.push_back(i);
+            offsets.push_back(size);
+            size += messages[i].size();
+        }
+    }
+
+    partition(size, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        std::size_t k = std::lower_bound(offsets.begin(), offsets.end(), begin) -
+                        offsets.begin();
+        for (; k < offsets.size() && offsets[k] < end; k++) {
+            f(small[k]);
+        }
+    });
+
+    for (auto i = 0u; i < messages.size(); i++) {
+        if (messages[i].size() > MIN_CHUNK_SIZE) {
+            f(i);
+        }
+    }
 }
 
-void CPUScanner::scan(const std::vector<char>& input,
-                      std::vector<MatchEntry>& output,
-                      const std::int32_t limit) {
-//    std::cout << "\t\tCPUScanner::scan compact" << std::endl;
-//    std::cout << "\t\tNot yet implemented" << std::endl;
+/**
+ * The host scanners have no per scan transfer or launch cost to amortise, so
+ * a batch needs no packing, the messages are simply scanned in parallel.
+ */
+void CPUScanner::scan(const std::vector<std::vector<char>>& messages,
+                      std::vector<std::vector<std::int32_t>>& output) {
+    output.resize(messages.size());
+    for (auto i = 0u; i < messages.size(); i++) {
+        output[i].resize(messages[i].size());
+    }
+
+    forEachMessage(messages, [&](std::size_t i) {
+        scan(messages[i].data(), messages[i].size(), output[i].data());
+    });
 }
 
-} // namespace gimbatuluk
+/**
+ * As for the OpenCL batch scan, which rescans dense rather than truncate, each
+ * message reports all its matches regardless of maxMatches.
+ */
+void CPUScanner::scan(const std::vector<std::vector<char>>& messages,
+                      std::vector<std::vector<MatchEntry>>& output) {
+    output.resize(messages.size());
+    for (auto i = 0u; i < messages.size(); i++) {
+        output[i].clear();
+    }
+
+    forEachMessage(messages, [&](std::size_t i) {
+        gather(collectMatches(messages[i].data(), messages[i].size()),
+               messages[i].size(), output[i]);
+    });
+}
+
+/**
+ * Host memory needs no staging, so these are ordinary buffers that let code
+ * written for the OpenCL buffer API run unchanged on the host scanners.
+ */
+char* CPUScanner::getInputBuffer() {
+    if (inputBuffer.empty()) {
+        inputBuffer.resize(bufferSize);
+    }
+    return inputBuffer.data();
+}
 
+const std::int32_t* CPUScanner::getOutputBuffer() {
+    if (outputBuffer.empty()) {
+        outputBuffer.resize(bufferSize);
+    }
+    return outputBuffer.data();
+}
+
+const MatchEntry* CPUScanner::getMatchBuffer() {
+    if (matchBuffer.empty()) {
+        matchBuffer.resize(maxMatches);
+    }
+    return matchBuffer.data();
+}
+
+void CPUScanner::scanBuffer(const std::size_t size) {
+    const char* input = getInputBuffer();
+    getOutputBuffer();
+    scan(input, size, outputBuffer.data());
+}
+
+CompactResult CPUScanner::scanBufferCompact(const std::size_t size,
+                                            const std::int32_t limit) {
+    const char* input = getInputBuffer();
+    getMatchBuffer();
+    return scan(input, size, matchBuffer.data(), compactLimit(limit, maxMatches));
+}
+
+} // namespace gimbatuluk
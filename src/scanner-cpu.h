@@ -25,10 +25,14 @@
 #pragma once
 
 #include "pfac.h"
+#include "prefilter.h"
 #include "scanner.h"
+#include "thread-pool.h"
 
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -40,23 +44,113 @@ public:
 
     CPUScanner(const std::string deviceName,
                const std::size_t bufferSize,
-               const Dictionary& dictionary);
+               const std::size_t maxMatches);
 
     std::string getDeviceName() override;
-    void installDictionary() override;
+    std::size_t getBufferSize() override;
+    void installDictionary(std::shared_ptr<const Dictionary> dictionary) override;
+    std::shared_ptr<const Dictionary> getDictionary() override;
+    std::string getTableStorage() override;
 
     void scan(const std::vector<char>& input,
               std::vector<std::int32_t>& output) override;
     void scan(const std::vector<char>& input,
               std::vector<std::int32_t>& output, Callback callback) override;
 
+    CompactResult scan(const std::vector<char>& input,
+                       std::vector<MatchEntry>& output,
+                       const std::int32_t limit) override;
     void scan(const std::vector<char>& input,
-              std::vector<MatchEntry>& output,
+              std::vector<MatchEntry>& output, CompactCallback callback,
               const std::int32_t limit) override;
-private:
+
+    void scan(const char* input, const std::size_t size,
+              std::int32_t* output) override;
+    CompactResult scan(const char* input, const std::size_t size,
+                       MatchEntry* output, const std::size_t capacity) override;
+
+    CompactResult scanAll(const std::vector<char>& input,
+                          std::vector<MatchEntry>& output,
+                          const std::int32_t limit) override;
+    CompactResult scanAll(const char* input, const std::size_t size,
+                          MatchEntry* output, const std::size_t capacity) override;
+
+    CompactResult scanSpans(const std::vector<char>& input,
+                            std::vector<MatchSpan>& output,
+                            const std::int32_t limit,
+                            const bool leftmostLongest) override;
+
+    void scan(const std::vector<std::vector<char>>& messages,
+              std::vector<std::vector<std::int32_t>>& output) override;
+    void scan(const std::vector<std::vector<char>>& messages,
+              std::vector<std::vector<MatchEntry>>& output) override;
+
+    std::size_t countMatches(const char* input, const std::size_t size) override;
+    void matchHistogram(const char* input, const std::size_t size,
+                       std::vector<std::uint32_t>& output) override;
+    MatchEntry firstMatch(const char* input, const std::size_t size) override;
+
+    char* getInputBuffer() override;
+    const std::int32_t* getOutputBuffer() override;
+    const MatchEntry* getMatchBuffer() override;
+    void scanBuffer(const std::size_t size) override;
+    CompactResult scanBufferCompact(const std::size_t size,
+                                    const std::int32_t limit) override;
+protected:
+    /**
+     * An installed Dictionary version together with the host side tables built
+     * from it. Installing a new version replaces the installed pointer, scans
+     * in progress keep their own reference so continue with the old version.
+     */
+    struct HostDictionary {
+        std::shared_ptr<const Dictionary> dictionary;
+        FirstBytePrefilter prefilter;
+    };
+
+    static std::size_t getThreadCount();
+
+    std::size_t chunkCount(const std::size_t size) const;
+
+    /**
+     * Partition the input into chunkCount(size) chunks and run f(begin, end,
+     * chunk) for each chunk on the thread pool, blocking until all complete.
+     * Each chunk owns the start positions [begin, end) but the PFAC walk from
+     * those positions may read up to maxPatternLength - 1 bytes past end, so
+     * consecutive chunks effectively overlap by the longest pattern.
+     */
+    void partition(const std::size_t size,
+                   const std::function<void(std::size_t begin,
+                                            std::size_t end,
+                                            std::size_t chunk)>& f);
+
+    void forEachMessage(const std::vector<std::vector<char>>& messages,
+                        const std::function<void(std::size_t i)>& f);
+
+    /**
+     * Find the longest match at each position of size bytes of input, as the
+     * compact scans report, in per chunk results concatenated by the scans.
+     */
+    virtual std::vector<std::vector<MatchEntry>> collectMatches(const char* input,
+                                                                const std::size_t size);
+    std::vector<std::vector<MatchEntry>> collectAll(const char* input,
+                                                    const std::size_t size);
+
+    // Check input is valid and return the Dictionary version to scan it with.
+    std::shared_ptr<const HostDictionary> checkInput(const std::size_t size);
+
     const std::string deviceName;
-    const Dictionary* dictionary; // *Non-owned* association to Dictionary.
+    const std::size_t bufferSize;
+    const std::size_t maxMatches; // The most matches a compact scan may return.
+
+    // Accessed via std::atomic_load/std::atomic_store as swaps may be concurrent.
+    std::shared_ptr<const HostDictionary> installed;
+
+    // I/O buffers returned by getInputBuffer etc. allocated on first use.
+    std::vector<char> inputBuffer;
+    std::vector<std::int32_t> outputBuffer;
+    std::vector<MatchEntry> matchBuffer;
+
+    ThreadPool pool;
 };
 
 } // namespace gimbatuluk
-
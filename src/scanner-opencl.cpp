@@ -20,11 +20,12 @@
  *
  */
 
-#include "circular-store.h"
 #include "pfac.h"
 #include "dictionary.h"
+#include "program-cache.h"
 #include "scanner.h"
 #include "scanner-opencl.h"
+#include "slot-pool.h"
 
 /**
  * Include OpenCl using the C++ Wrapper API defined here:
@@ -67,18 +68,19 @@ namespace cl {
 } // namespace cl
 #endif
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
 namespace gimbatuluk {
 
-constexpr auto PROGRAM_PATH = "./";
-constexpr auto GPU_PROGRAM_NAME = "pfac-opencl-gpu.cl";
-constexpr auto CPU_PROGRAM_NAME = "pfac-opencl-cpu.cl";
-
 /**
  * See https://www.khronos.org/registry/cl/sdk/1.0/docs/man/xhtml/clBuildProgram.html
  * We probably don't need floating point optimisations so keep it simple for now.
@@ -89,12 +91,66 @@ constexpr auto PROGRAM_BUILD_OPTIONS = "-Werror";
  * N.B. The kernel expects WORK_GROUP_SIZE to equal the maximum number of
  * transitions for a state e.g. 256. If the WORK_GROUP_SIZE needs to be another
  * value then the kernel code to load initialTransitionsCache will need updating.
- * MAX_PATTERN_SIZE should be greater than the maximum pattern length
- * divided by sizeof(int), so 128 would support a maximum pattern length of 512.
+ * MAX_PATTERN_SIZE is the number of ints of input beyond its own that each Work
+ * Group holds in local memory, so 128 covers patterns of up to 512 bytes. Walks
+ * for longer patterns continue from global memory, see pfacMatch, which is
+ * only enabled for dictionaries that need it. A Program specialised for a
+ * Dictionary holds just enough ints for its longest pattern, up to this many.
  */
 constexpr auto WORK_GROUP_SIZE = 256;
 constexpr auto MAX_PATTERN_SIZE = 128;
 
+/**
+ * The messageEnds Device buffer has an entry per BATCH_MESSAGE_SIZE bytes of
+ * bufferSize, so a quarter of its size. A batch of messages smaller than this
+ * on average fills it before the input buffer, and is scanned in more parts.
+ */
+constexpr auto BATCH_MESSAGE_SIZE = 16;
+
+// Reductions performed by the pfacReduce Kernel, passed to the OpenCL Program.
+constexpr cl_int REDUCE_COUNT = 0;
+constexpr cl_int REDUCE_HISTOGRAM = 1;
+constexpr cl_int REDUCE_FIRST = 2;
+
+/**
+ * Where the Kernels hold the state machine tables, see chooseStorage, passed
+ * to the OpenCL Program. The names, indexed by strategy, are those accepted
+ * by setTableStorage, for which STORAGE_AUTOMATIC means let chooseStorage pick.
+ */
+constexpr cl_int STORAGE_AUTOMATIC = -1;
+constexpr cl_int STORAGE_IMAGE = 0;
+constexpr cl_int STORAGE_GLOBAL = 1;
+constexpr cl_int STORAGE_CONSTANT = 2;
+constexpr cl_int STORAGE_LOCAL = 3;
+constexpr const char* TABLE_STORAGE_NAMES[] = {"image", "global", "constant", "local"};
+
+/**
+ * Local memory used by the Kernels themselves, at most pfacCompact's input and
+ * scan cache, its initialTransitionsCache and a few ints, which STORAGE_LOCAL
+ * tables must fit alongside. Tables larger than LOCAL_STORAGE_LIMIT bytes are
+ * not chosen for local memory, as each Work Group copies the whole table to
+ * scan its 1024 bytes of input, so the copy would outweigh the faster reads.
+ */
+constexpr std::size_t KERNEL_LOCAL_MEMORY = (WORK_GROUP_SIZE*9 + 16)*sizeof(cl_int);
+constexpr std::size_t LOCAL_STORAGE_LIMIT = 16384;
+
+static std::atomic<cl_int> tableStorage(STORAGE_AUTOMATIC);
+
+void setTableStorage(const std::string& storage) {
+    if (storage.empty()) {
+        tableStorage = STORAGE_AUTOMATIC;
+        return;
+    }
+
+    for (cl_int i = STORAGE_IMAGE; i <= STORAGE_LOCAL; i++) {
+        if (storage == TABLE_STORAGE_NAMES[i]) {
+            tableStorage = i;
+            return;
+        }
+    }
+    throw std::runtime_error("Unknown table storage \"" + storage + "\"");
+}
+
 
 /**
  * Enumerate all available OpenCL Devices across all available OpenCL Platforms.
@@ -111,8 +167,16 @@ static std::vector<std::pair<std::string, cl::Device>> getAvailableDevices() {
     std::vector<std::pair<std::string, cl::Device>> accelerators;
     std::vector<std::pair<std::string, cl::Device>> cpus;
 
+    /**
+     * cl::Platform::get throws if no OpenCL ICD/Platform is installed, which is
+     * not an error for us as the host CPU scanner may still be used.
+     */
     std::vector<cl::Platform> clplatforms;
-    cl::Platform::get(&clplatforms);
+    try {
+        cl::Platform::get(&clplatforms);
+    } catch (...) {
+        return devices;
+    }
 
     for (auto platform : clplatforms) {
         try {
@@ -173,14 +237,41 @@ std::vector<std::string> OpenCLScanner::getAvailableDevices() {
 
 OpenCLScanner::OpenCLScanner(const std::string deviceName,
                              const std::size_t bufferSize,
-                             const Dictionary& dictionary):
+                             const std::size_t pipelineDepth,
+                             const std::size_t maxMatches):
 deviceName(deviceName),
 bufferSize(bufferSize),
-dictionary(&dictionary),
-scanCount(0) {
+maxMatches(maxMatches),
+outBufferSize(std::max(bufferSize*sizeof(cl_int), maxMatches*sizeof(MatchEntry))),
+pipelineDepth(pipelineDepth),
+slots(pipelineDepth),
+unifiedMemory(false),
+hostInput(nullptr),
+hostOutput(nullptr) {
+    if (pipelineDepth == 0) {
+        throw std::runtime_error("OpenCLScanner pipeline depth must be at least 1.");
+    }
 //    std::cout << "\tOpenCLScanner Constructor deviceName = " << deviceName << ", bufferSize " << bufferSize << std::endl;
 //    std::cout << "\tthis = " << this << std::endl;
-//    std::cout << "\tDictionary = " << this->dictionary << std::endl;
+}
+
+/**
+ * Wait for the callbacks of any async scans still in flight, as they release
+ * their ScanSlot on completion and would otherwise touch it after it has been
+ * destroyed, unmapping the slots' staging buffers as forEach takes them.
+ */
+OpenCLScanner::~OpenCLScanner() {
+    slots.forEach([](ScanSlot& slot) {
+        try {
+            if (slot.stagingInput) {
+                slot.queue.enqueueUnmapMemObject(slot.stagingInBuffer, slot.stagingInput);
+                slot.queue.enqueueUnmapMemObject(slot.stagingOutBuffer, slot.stagingOutput);
+                slot.queue.finish();
+            }
+        } catch (const cl::Error&) {
+            // Nothing useful can be done about it in a destructor.
+        }
+    });
 }
 
 /**
@@ -188,10 +279,10 @@ scanCount(0) {
  * thing to do is to find the OpenCL Device that corresponds to the specified
  * OpenCLScanner Device name. If that fails all bets are off so an exception is
  * thrown, if it succeeds the Device is used to create an OpenCL Context and
- * the OpenCL Program source is loaded the Program is built and the Kernel(s)
- * extracted. N.B. this is an expensive method as it is creating a Context and
- * loading and compiling the OpenCL Program, so it should only be called if
- * the OpenCL Device has not already been initialised.
+ * the OpenCL Program source and build options are selected. The Program itself
+ * is built by getProgram when a Dictionary is installed. N.B. this is an
+ * expensive method as it is creating a Context and the Device buffers, so it
+ * should only be called if the OpenCL Device has not already been initialised.
  */
 void OpenCLScanner::initialiseOpenCL() {
 //    std::cout << "\t\tOpenCLScanner::initialiseOpenCL" << std::endl;
@@ -217,73 +308,53 @@ void OpenCLScanner::initialiseOpenCL() {
         throw std::runtime_error(message);
     }
 
-//    const bool USE_MEMORY_MAPPING = device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() > 0;
+    // If the Device shares memory with the host the host buffers are mapped.
+    unifiedMemory = device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() > 0;
 
     // Create the OpenCL Context using the OpenCL Device that we've found.
     context = cl::Context(device);
 
     // Select the GPU or CPU optimised program. TODO GPUs other than Nvidia/AMD
-    const auto PROGRAM_NAME = (device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU) ? 
-                                CPU_PROGRAM_NAME : GPU_PROGRAM_NAME;
-
-    // TODO implement a rather more robust search path for OpenCL Program...
-    const auto sourceBytes = gimbatuluk::readFile(std::string(PROGRAM_PATH) +
-                                                  std::string(PROGRAM_NAME));
+    programSource = (device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU) ?
+        std::string(reinterpret_cast<const char*>(CPU_PROGRAM_SOURCE), CPU_PROGRAM_SOURCE_SIZE) :
+        std::string(reinterpret_cast<const char*>(GPU_PROGRAM_SOURCE), GPU_PROGRAM_SOURCE_SIZE);
 
     /**
-     * Create OpenCL Program from the sources (we only use one source but sources
-     * is actually a vector of data/length pairs so could use many source files)
+     * The options common to every Program built for the Device. MAX_PATTERN_SIZE,
+     * TABLE_STORAGE and the Dictionary constants of a specialised Program are
+     * added by installDictionary, as redefining a macro is an error with -Werror.
      */
-    const cl::Program::Sources sources = {{sourceBytes.data(), sourceBytes.size()}};
-    cl::Program program = cl::Program(context, sources);
-
-    /**
-     * Build the OpenCL Program, if an exception occurs we retrieve the log and
-     * throw a more complete exception containing the compiler error message.
-     */
-    try {
-        std::string options = PROGRAM_BUILD_OPTIONS;
-        // Pass constants to OpenCL Program.
-        options += " -DINVALID=" + std::to_string(INVALID);
-        options += " -DMASKBITS=" + std::to_string(MASKBITS);
-        options += " -DMASK=" + std::to_string(MASK);
-        options += " -DWORK_GROUP_SIZE=" + std::to_string(WORK_GROUP_SIZE);
-        options += " -DMAX_PATTERN_SIZE=" + std::to_string(MAX_PATTERN_SIZE);
-
-        // Enable Warp/Wavefront optimisations. TODO do other vendors use this approach?
-        const std::string vendor = device.getInfo<CL_DEVICE_VENDOR>();
-        if (vendor.find("NVIDIA") != std::string::npos) {
-            options += " -DWARP_SIZE=32";
-            options += " -DWARP_SHIFT=5";
-        } else if (vendor.find("Advanced Micro Devices") != std::string::npos) {
-            options += " -DWARP_SIZE=64";
-            options += " -DWARP_SHIFT=6";
-        } else {
-            options += " -DWARP_SIZE=1";
-            options += " -DWARP_SHIFT=0";
-        }
-
-        program.build(options.data());
-    } catch (const cl::Error e) {
-        std::string message = "Failed to build OpenCL Program.\nBuild Log:\n" +         
-                    program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
-        throw std::runtime_error(message);
-    }
-
-//std::cout << "\n" << program.getInfo<CL_PROGRAM_BINARIES>()[0] << std::endl;
-
-    // Extract the Kernels we're going to execute from the Program.
-    pfacKernel = cl::Kernel(program, "pfac");
-    pfacCompactKernel = cl::Kernel(program, "pfacCompact");
-
-    /**
-     * Create the OpenCL CommandQueues to which we push commands for the Device.
-     * Note that we have multiple distinct CommandQueue instances so that we may
-     * overlap the write, execute, read operations thus optimising data transfers.
-     */
-    for (auto i = 0u; i < COMMAND_QUEUES; i++) {
-        queue[i] = cl::CommandQueue(context, device);
+    std::string options = PROGRAM_BUILD_OPTIONS;
+    // Pass constants to OpenCL Program.
+    options += " -DINVALID=" + std::to_string(INVALID);
+    options += " -DROW_OFFSET_SHIFT=" + std::to_string(ROW_OFFSET_SHIFT);
+    options += " -DROW_K_SHIFT=" + std::to_string(ROW_K_SHIFT);
+    options += " -DROW_FIELD_MASK=" + std::to_string(ROW_FIELD_MASK);
+    options += " -DNO_TRANSITIONS=" + std::to_string(NO_TRANSITIONS) + "u";
+    options += " -DVAL_STATE_SHIFT=" + std::to_string(VAL_STATE_SHIFT);
+    options += " -DVAL_CHAR_MASK=" + std::to_string(VAL_CHAR_MASK);
+    options += " -DWORK_GROUP_SIZE=" + std::to_string(WORK_GROUP_SIZE);
+    options += " -DREDUCE_COUNT=" + std::to_string(REDUCE_COUNT);
+    options += " -DREDUCE_HISTOGRAM=" + std::to_string(REDUCE_HISTOGRAM);
+    options += " -DREDUCE_FIRST=" + std::to_string(REDUCE_FIRST);
+    options += " -DSTORAGE_IMAGE=" + std::to_string(STORAGE_IMAGE);
+    options += " -DSTORAGE_GLOBAL=" + std::to_string(STORAGE_GLOBAL);
+    options += " -DSTORAGE_CONSTANT=" + std::to_string(STORAGE_CONSTANT);
+    options += " -DSTORAGE_LOCAL=" + std::to_string(STORAGE_LOCAL);
+
+    // Enable Warp/Wavefront optimisations. TODO do other vendors use this approach?
+    const std::string vendor = device.getInfo<CL_DEVICE_VENDOR>();
+    if (vendor.find("NVIDIA") != std::string::npos) {
+        options += " -DWARP_SIZE=32";
+        options += " -DWARP_SHIFT=5";
+    } else if (vendor.find("Advanced Micro Devices") != std::string::npos) {
+        options += " -DWARP_SIZE=64";
+        options += " -DWARP_SHIFT=6";
+    } else {
+        options += " -DWARP_SIZE=1";
+        options += " -DWARP_SHIFT=0";
     }
+    programOptions = options;
 
     /**
      * Compute the number of Work Groups required to process bufferSize
@@ -292,52 +363,82 @@ void OpenCLScanner::initialiseOpenCL() {
      */
     const cl_int n = (bufferSize + sizeof(cl_int) - 1)/sizeof(cl_int);
     const auto workGroups = (n + WORK_GROUP_SIZE - 1)/WORK_GROUP_SIZE;
-    sharedMemoryInitialValue.resize(workGroups*2, INVALID); // Struct of two ints.
 
 //std::cout << "bufferSize = " << bufferSize << std::endl;
 //std::cout << "workGroups = " << workGroups << std::endl;
 
-    // Pre-allocate device buffers.
-    for (auto i = 0u; i < BUFFERS; i++) {
+    /**
+     * Give each ScanSlot its own CommandQueue, so that scans in different slots
+     * may overlap their write, execute and read operations, thus optimising
+     * data transfers, and its own pre-allocated Device buffers. Its Kernels,
+     * which are its own as setArg is not thread safe, are created by useProgram
+     * from the Program of the Dictionary version its scan uses.
+     */
+    slots.forEach([&](ScanSlot& slot) {
+        slot.queue = cl::CommandQueue(context, device);
+
         // inBuffer is a char sequence.
-        inBuffer[i] = cl::Buffer(context, CL_MEM_READ_ONLY,
-                                 bufferSize);
+        slot.inBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, bufferSize);
         /**
-         * outBuffer is an int sequence. It has a size of bufferSize*2 because
-         * pfacCompactKernel returns an array of pairs of ints representing
-         * the position and pattern ID of matches. In practice as the point of
-         * using the pfacCompactKernel is to reduce output bandwidth if the
-         * number of matching results exceeds ~bufferSize/2 then the system
-         * performance will actually be worse than the plain pfacKernel.
-         * TODO if Device Buffer size is an issue providing an optional global 
-         * limit on number of results returned by pfacCompactKernel may be an option.
+         * outBuffer is an int sequence holding either the pfacKernel pattern
+         * ID per byte or the pfacCompactKernel pairs of ints representing the
+         * position and pattern ID of matches. The pfacCompactKernel writes at
+         * most maxMatches pairs, which for scanAll may be more than one per
+         * byte, so the buffer is the larger of the two.
          */  
-        outBuffer[i] = cl::Buffer(context, CL_MEM_WRITE_ONLY,
-                                  bufferSize*2*sizeof(cl_int));
+        slot.outBuffer = cl::Buffer(context, CL_MEM_WRITE_ONLY, outBufferSize);
         /**
          * sharedMemory is an int sequence. It is used in the pfacCompactKernel
          * as a mechanism for synchronising/communicating between Work Groups.
-         * It comprises a struct of two ints: workGroupSum and inclusivePrefix.
+         * It comprises a struct of two ints: workGroupSum and inclusivePrefix
+         * per Work Group, then the stop group used to end the scan early.
          */
-        sharedMemory[i] = cl::Buffer(context, CL_MEM_READ_WRITE,
-                                     workGroups*2*sizeof(cl_int));
-    }
+        slot.sharedMemory = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                       (workGroups*2 + 1)*sizeof(cl_int));
+
+        slot.messageEnds = cl::Buffer(context, CL_MEM_READ_ONLY,
+                                      (bufferSize/BATCH_MESSAGE_SIZE + 1)*sizeof(cl_int));
+    });
 }
 
 std::string OpenCLScanner::getDeviceName() {
     return deviceName;
 }
 
-void OpenCLScanner::installDictionary() {
-//    std::cout << "\t\tOpenCLScanner::installDictionary" << std::endl;
+std::size_t OpenCLScanner::getBufferSize() {
+    return bufferSize;
+}
 
-    /**
-     * The function call operator on cl::Device returns the underlying OpenCL
-     * Object, which can be used to determine if the Device is initialised.
-     */
-    if (device() == nullptr) {
-        initialiseOpenCL();
-    }
+/**
+ * The installed Dictionary version, or null if there is none. The first install
+ * initialises OpenCL, so if there are tables so are the Device and ScanSlots.
+ */
+std::shared_ptr<const DeviceDictionary> OpenCLScanner::getTables() {
+    return std::atomic_load(&installed);
+}
+
+std::shared_ptr<const Dictionary> OpenCLScanner::getDictionary() {
+    const auto tables = getTables();
+    return tables ? tables->dictionary : nullptr;
+}
+
+std::string OpenCLScanner::getTableStorage() {
+    const auto tables = getTables();
+    return tables ? TABLE_STORAGE_NAMES[tables->storage] : "";
+}
+
+/**
+ * Choose where the Kernels hold dictionary's state machine tables, unless
+ * setTableStorage has forced a strategy, in which case check it is possible.
+ * CPU Devices emulate images, and their local and constant memory is ordinary
+ * memory, so global buffers are best there. Otherwise tables small enough are
+ * copied to local memory by each Work Group, those that fit are held in
+ * constant memory and the rest in images, as texture memory is cached, unless
+ * they exceed the largest image, when only global memory is left.
+ */
+cl_int OpenCLScanner::chooseStorage(const Dictionary& dictionary) {
+    const std::size_t tableSize = sizeof(std::uint32_t)*
+        (dictionary.hashRow.size() + dictionary.hashVal.size());
 
     /**
      * Query maximum number of pixels for a 1D image created from a buffer object. 
@@ -347,29 +448,117 @@ void OpenCLScanner::installDictionary() {
      */
     const std::size_t IMAGE1D_MAX_BUFFER_SIZE = 
         device.getInfo<CL_DEVICE_IMAGE_MAX_BUFFER_SIZE>();
-//std::cout << "CL_DEVICE_IMAGE_MAX_BUFFER_SIZE" << std::endl;
-//std::cout << IMAGE1D_MAX_BUFFER_SIZE << std::endl;
+    const std::size_t largestTable = std::max(dictionary.hashRow.size(),
+                                              dictionary.hashVal.size());
+    const bool imageFits = device.getInfo<CL_DEVICE_IMAGE_SUPPORT>() &&
+                           largestTable <= IMAGE1D_MAX_BUFFER_SIZE;
+
+    const std::size_t localMemory = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+    const std::size_t localAvailable = localMemory > KERNEL_LOCAL_MEMORY ?
+                                       localMemory - KERNEL_LOCAL_MEMORY : 0;
+    const bool localFits = tableSize <= localAvailable;
+    const bool constantFits =
+        tableSize <= device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>();
+
+    const cl_int storage = tableStorage;
+    if ((storage == STORAGE_IMAGE && !imageFits) ||
+        (storage == STORAGE_LOCAL && !localFits) ||
+        (storage == STORAGE_CONSTANT && !constantFits)) {
+        std::string message = "Compiled dictionary size: " +
+                               std::to_string(tableSize) +
+                              " bytes does not fit in " +
+                               TABLE_STORAGE_NAMES[storage] + " memory";
+        throw std::runtime_error(message);
+    }
+
+    if (storage != STORAGE_AUTOMATIC) {
+        return storage;
+    }
+
+    if (device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU) {
+        return STORAGE_GLOBAL;
+    } else if (localFits && tableSize <= LOCAL_STORAGE_LIMIT) {
+        return STORAGE_LOCAL;
+    } else if (constantFits) {
+        return STORAGE_CONSTANT;
+    } else if (imageFits) {
+        return STORAGE_IMAGE;
+    }
+    return STORAGE_GLOBAL;
+}
+
+/**
+ * The Program built with the common options plus specialisation, which is
+ * loaded from the program cache if it holds an identical build. Programs that
+ * aren't specific to one Dictionary, i.e. not specialised and not holding its
+ * tables in local memory, are kept once built, and a Dictionary specific one
+ * is reused by the next Dictionary version needing the same specialisation,
+ * e.g. a swap to a new version of the same rules, so only changes rebuild.
+ */
+cl::Program OpenCLScanner::getProgram(const std::string& specialisation,
+                                      const bool reusable) {
+    const auto current = getTables();
+    if (current && current->specialisation == specialisation) {
+        return current->program;
+    }
+
+    if (reusable) {
+        auto& program = programs[specialisation];
+        if (program() == nullptr) {
+            program = buildProgram(context, device, programSource,
+                                   programOptions + specialisation);
+        }
+        return program;
+    }
+    return buildProgram(context, device, programSource,
+                        programOptions + specialisation);
+}
+
+/**
+ * Create slot's Kernels from the Program of the Dictionary version its scan
+ * uses, unless they were already created from it. Scans hold their slot
+ * exclusively, so a scan may safely replace its slot's Kernels, and once every
+ * slot has been used after a Dictionary install this check is all that's left.
+ */
+static void useProgram(ScanSlot& slot, const DeviceDictionary& tables) {
+    if (slot.program() == tables.program()) {
+        return;
+    }
+
+    slot.pfacKernel = cl::Kernel(tables.program, "pfac");
+    slot.pfacCompactKernel = cl::Kernel(tables.program, "pfacCompact");
+    slot.pfacReduceKernel = cl::Kernel(tables.program, "pfacReduce");
+    slot.pfacSpansKernel = cl::Kernel(tables.program, "pfacSpans");
+    slot.program = tables.program;
+}
+
+/**
+ * Create the hash table objects for dictionary on the Device then atomically
+ * replace the installed Dictionary version. This may be called while scans
+ * are in progress, those scans continue to use the previous version's objects.
+ */
+void OpenCLScanner::installDictionary(std::shared_ptr<const Dictionary> dictionary) {
+//    std::cout << "\t\tOpenCLScanner::installDictionary" << std::endl;
+    std::lock_guard<std::mutex> lock(installMutex);
 
     /**
-     * TODO rather than throw an exception here it is probably better to fall
-     * back to using (uncached) global memory rather than using Image1DBuffer.
+     * The function call operator on cl::Device returns the underlying OpenCL
+     * Object, which can be used to determine if the Device is initialised.
      */
-    if (dictionary->hashVal.size() > IMAGE1D_MAX_BUFFER_SIZE) {
-        std::string message = "Compiled dictionary size: " +
-                               std::to_string(dictionary->hashVal.size()) +
-                              " exceeds CL_DEVICE_IMAGE_MAX_BUFFER_SIZE: " +         
-                               std::to_string(IMAGE1D_MAX_BUFFER_SIZE);
-        throw std::runtime_error(message);
+    if (device() == nullptr) {
+        initialiseOpenCL();
     }
 
     /**
-     * Create initialTransitions, hashRow and hashVal tables on the OpenCL Device.
-     * We use OpenCL 1.2 Image1DBuffers for the look-up tables this is because
-     * texture memory is cached whereas global memory is not, so is likely slower.
-     * Create an Image1DBuffer using the format of CL_RG, CL_SIGNED_INT32 which
-     * is the equivalent of an int2 using the R and G pixel channels or for the
-     * initialTransitions buffer using the format of CL_R, CL_SIGNED_INT32 which
-     * is the equivalent of an int in the R pixel channel.
+     * Create initialTransitions, hashRow and hashVal tables on the OpenCL Device,
+     * held as chooseStorage selects for this Dictionary. By default we use
+     * OpenCL 1.2 Image1DBuffers for the look-up tables this is because texture
+     * memory is cached whereas global memory is not, so is likely slower.
+     * The packed hashRow and hashVal tables use the format CL_R, CL_UNSIGNED_INT32
+     * which is the equivalent of a uint in the R pixel channel, and the
+     * initialTransitions buffer uses the format of CL_R, CL_SIGNED_INT32 which
+     * is the equivalent of an int in the R pixel channel. The other strategies
+     * pass the Kernels the underlying Buffers.
      *
      * Note that we create cl::Buffer supplying host_ptr and CL_MEM_USE_HOST_PTR
      * which loads the data directly onto the device, so we don't need to call
@@ -379,7 +568,10 @@ void OpenCLScanner::installDictionary() {
      * for its 4th argument, so we have to const_cast hashVal.data()
      */
 
-    // Host side hashRow, hashVal and initialTransitions
+    auto next = std::make_shared<DeviceDictionary>();
+    next->storage = chooseStorage(*dictionary);
+
+    // Host side hashRow, hashVal, initialTransitions (and bigramTransitions below)
     const auto& hashRowH = dictionary->hashRow;
     const auto& hashValH = dictionary->hashVal;
     const auto& initialTransitionsH = dictionary->initialTransitions;
@@ -389,63 +581,83 @@ void OpenCLScanner::installDictionary() {
     // Display the first few hashRow/hashVal values to check Image1DBuffer works.
     std::cout << "hashRowH" << std::endl;
     for (int i = 0; i < 10; i++){
-        std::cout << hashRowH[i].offset << " " << hashRowH[i].k_sminus1 << " ";
+        std::cout << (hashRowH[i] >> ROW_OFFSET_SHIFT) << " " << (hashRowH[i] & 0xFF) << " ";
     }
     std::cout << std::endl;
     std::cout << "hashValH" << std::endl;
     for (int i = 0; i < 10; i++){
-        std::cout << hashValH[i].ch << " " << hashValH[i].nextState << " ";
+        std::cout << (hashValH[i] & VAL_CHAR_MASK) << " " << (hashValH[i] >> VAL_STATE_SHIFT) << " ";
     }
     std::cout << std::endl;
     // TODO remove later.
 */
 
     // N.B. The cl::Buffer sizes are bytes and cl::Image1DBuffer sizes are pixels
+    const auto table = [&](const void* tableH, const std::size_t entries,
+                           const cl_uint type) -> cl::Memory {
+        cl::Buffer buffer(
+            context,
+            CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+            sizeof(std::int32_t)*entries,
+            const_cast<void*>(tableH)
+        );
+
+        if (next->storage != STORAGE_IMAGE) {
+            return buffer;
+        }
 
-    cl::Buffer initialTransitionsBuffer(
-        context,
-        CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-        sizeof(std::int32_t)*initialTransitionsH.size(),
-        const_cast<std::int32_t*>(initialTransitionsH.data())
-    );
-
-    initialTransitions = cl::Image1DBuffer(
-        context,
-        CL_MEM_READ_ONLY,
-        cl::ImageFormat(CL_R, CL_SIGNED_INT32),
-        initialTransitionsH.size(),
-        initialTransitionsBuffer
-    );
-
-    cl::Buffer hashRowBuffer(
-        context,
-        CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-        sizeof(HashRow)*hashRowH.size(),
-        const_cast<HashRow*>(hashRowH.data())
-    );
+        return cl::Image1DBuffer(
+            context,
+            CL_MEM_READ_ONLY,
+            cl::ImageFormat(CL_R, type),
+            entries,
+            buffer
+        );
+    };
 
-    hashRow = cl::Image1DBuffer(
-        context,
-        CL_MEM_READ_ONLY,
-        cl::ImageFormat(CL_RG, CL_SIGNED_INT32),
-        hashRowH.size(),
-        hashRowBuffer
-    );
+    next->initialTransitions = table(initialTransitionsH.data(),
+                                     initialTransitionsH.size(), CL_SIGNED_INT32);
 
-    cl::Buffer hashValBuffer(
-        context,
-        CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-        sizeof(Transition)*hashValH.size(),
-        const_cast<Transition*>(hashValH.data())
-    );
+    /**
+     * The Kernels always take a bigramTransitions argument, so if the Dictionary
+     * was compiled without a bigram table we create a single entry placeholder
+     * and the Kernels are told not to use it via the useBigramTable argument.
+     */
+    static const std::vector<std::int32_t> bigramTransitionsPlaceholder = {INVALID};
+    const bool useBigramTable = !dictionary->bigramTransitions.empty();
+    const std::int32_t* bigramTransitionsH = useBigramTable ?
+                                             dictionary->bigramTransitions.data() :
+                                             bigramTransitionsPlaceholder.data();
+    const std::size_t bigramTransitionsSize = useBigramTable ?
+                                              dictionary->bigramTransitions.size() :
+                                              bigramTransitionsPlaceholder.size();
+
+    next->bigramTransitions = table(bigramTransitionsH, bigramTransitionsSize,
+                                    CL_SIGNED_INT32);
+    next->hashRow = table(hashRowH.data(), hashRowH.size(), CL_UNSIGNED_INT32);
+    next->hashVal = table(hashValH.data(), hashValH.size(), CL_UNSIGNED_INT32);
 
-    hashVal = cl::Image1DBuffer(
-        context,
-        CL_MEM_READ_ONLY,
-        cl::ImageFormat(CL_RG, CL_SIGNED_INT32),
-        hashValH.size(),
-        hashValBuffer
-    );
+    /**
+     * The prefixLink and patternLength tables, indexed by pattern ID, are only
+     * read by the all matches and span scans and are far smaller than the hash
+     * tables, so are simply held in global memory. As for bigramTransitions an
+     * empty table is given a single entry placeholder.
+     */
+    static const std::vector<std::int32_t> patternTablePlaceholder = {INVALID};
+    const auto patternTable = [this](const CompiledTable<std::int32_t>& table) {
+        const std::int32_t* tableH = table.empty() ? patternTablePlaceholder.data() :
+                                                     table.data();
+        const std::size_t tableSize = table.empty() ? patternTablePlaceholder.size() :
+                                                      table.size();
+        return cl::Buffer(
+            context,
+            CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+            sizeof(std::int32_t)*tableSize,
+            const_cast<std::int32_t*>(tableH)
+        );
+    };
+    next->prefixLink = patternTable(dictionary->prefixLink);
+    next->patternLength = patternTable(dictionary->patternLength);
 
 /*
 // These callbacks are temporary so I know that things are being deleted when I think.
@@ -458,22 +670,72 @@ hashRow.setDestructorCallback([](cl_mem X, void *userData) {std::cout << "hashRo
 hashValBuffer.setDestructorCallback([](cl_mem X, void *userData) {std::cout << "hashValBuffer destroyed\n";});
 hashVal.setDestructorCallback([](cl_mem X, void *userData) {std::cout << "hashVal destroyed\n";});
 */
+
+    /**
+     * A specialised Program sizes the local buffer overlap to the longest
+     * pattern, in whole ints, up to MAX_PATTERN_SIZE. Only dictionaries with
+     * patterns too long for the local buffers need the Kernels to check for
+     * walks continuing past their end.
+     */
+    const bool specialise = getSpecialisedPrograms();
+    const std::int32_t maxPatternLength = dictionary->maxPatternLength;
+    const std::int32_t patternInts = (maxPatternLength + sizeof(cl_int) - 1)/sizeof(cl_int);
+    const std::int32_t patternSize = !specialise ? MAX_PATTERN_SIZE :
+                                     std::max(1, std::min(patternInts, MAX_PATTERN_SIZE));
+    next->longPatterns = maxPatternLength >
+                         static_cast<std::int32_t>(patternSize*sizeof(cl_int));
+
+    next->specialisation = " -DMAX_PATTERN_SIZE=" + std::to_string(patternSize) +
+                           " -DTABLE_STORAGE=" + std::to_string(next->storage);
+    if (next->storage == STORAGE_LOCAL) {
+        next->specialisation +=
+            " -DHASH_ROW_SIZE=" + std::to_string(hashRowH.size()) +
+            " -DHASH_VAL_SIZE=" + std::to_string(hashValH.size());
+    }
+
+    if (specialise) {
+        next->specialisation +=
+            " -DDICTIONARY_INITIAL_STATE=" + std::to_string(dictionary->initialState) +
+            " -DDICTIONARY_BIGRAM_TABLE=" + std::to_string(useBigramTable) +
+            " -DDICTIONARY_LONG_PATTERNS=" + std::to_string(next->longPatterns);
+    }
+    next->program = getProgram(next->specialisation,
+                               !specialise && next->storage != STORAGE_LOCAL);
+
+    next->dictionary = std::move(dictionary);
+    std::atomic_store(&installed, std::shared_ptr<const DeviceDictionary>(std::move(next)));
 }
 
 
 // Needs initialState, initialTransitions, hashRow, hashVal
 void OpenCLScanner::scan(const std::vector<char>& input,
                          std::vector<std::int32_t>& output) {
-    /**
-     * The function call operator on cl::Kernel returns the underlying OpenCL
-     * Object, which can be used to determine if the Kernel is initialised.
-     */
-    if (pfacKernel() == nullptr) {
+    output.resize(input.size());
+    scan(input.data(), input.size(), output.data());
+}
+
+/**
+ * The input is written to the Device directly from, and the results are read
+ * directly into, the caller's memory so e.g. a mapped file is never copied.
+ */
+void OpenCLScanner::scan(const char* input, const std::size_t inputSize,
+                         std::int32_t* output) {
+    const auto tables = getTables();
+    if (!tables) {
         throw std::runtime_error("OpenCL pfacKernel uninitialised.");
     }
 
-    // TODO scan size currently limited to cl_int (~2GB) - could support larger.
-    const cl_int size = input.size();
+    const cl_int size = checkSize(inputSize);
+
+    SlotLease<ScanSlot> slot(slots);
+    writeInput(*slot, input, size);
+    enqueuePfac(*tables, *slot, slot->inBuffer, slot->outBuffer, size, 0);
+    readOutput(*slot, slot->outBuffer, size*sizeof(cl_int), output);
+}
+
+// TODO scan size currently limited to cl_int (~2GB) - could support larger.
+cl_int OpenCLScanner::checkSize(const std::size_t inputSize) {
+    const cl_int size = inputSize;
     if (size == 0) {
         throw std::runtime_error("Input vector uninitialised.");
     }
@@ -481,9 +743,107 @@ void OpenCLScanner::scan(const std::vector<char>& input,
     if (static_cast<std::size_t>(size) > bufferSize) {
         throw std::runtime_error("Input vector is larger than Device buffer.");
     }
+    return size;
+}
 
-    queue[0].enqueueWriteBuffer(inBuffer[0], CL_TRUE, 0, size, input.data());
+/**
+ * Allocate slot's page locked staging buffers on its first transfer of caller
+ * memory and return whether it has them. Devices with unified memory transfer
+ * host memory without a DMA, so staging would only add a copy. Page locked
+ * memory is a scarce resource, so if it cannot be allocated the slot simply
+ * transfers caller memory directly, leaving the driver to stage it.
+ */
+bool OpenCLScanner::allocateStaging(ScanSlot& slot) {
+    if (slot.stagingChecked) {
+        return slot.stagingInput != nullptr;
+    }
+
+    slot.stagingChecked = true;
+    if (unifiedMemory) {
+        return false;
+    }
+
+    try {
+        slot.stagingInBuffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                          bufferSize);
+        slot.stagingOutBuffer = cl::Buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                           outBufferSize);
+        slot.stagingInput = static_cast<char*>(
+            slot.queue.enqueueMapBuffer(slot.stagingInBuffer, CL_TRUE, CL_MAP_WRITE,
+                                        0, bufferSize)
+        );
+        slot.stagingOutput = slot.queue.enqueueMapBuffer(slot.stagingOutBuffer, CL_TRUE,
+                                                         CL_MAP_READ, 0, outBufferSize);
+    } catch (const cl::Error&) {
+        slot.stagingInBuffer = cl::Buffer();
+        slot.stagingOutBuffer = cl::Buffer();
+        slot.stagingInput = nullptr;
+        slot.stagingOutput = nullptr;
+    }
+    return slot.stagingInput != nullptr;
+}
+
+/**
+ * Enqueue a write of size bytes of caller memory at input to slot's inBuffer.
+ * The input is copied to the slot's staging buffer, if it has one, so the
+ * write is a DMA from page locked memory. The write is not blocking, the
+ * queue being in order the blocking read that ends each synchronous scan, or
+ * the read completing an async scan, also completes it.
+ */
+void OpenCLScanner::writeInput(ScanSlot& slot, const char* input, const cl_int size) {
+    if (allocateStaging(slot)) {
+        std::memcpy(slot.stagingInput, input, size);
+        input = slot.stagingInput;
+    }
+    slot.queue.enqueueWriteBuffer(slot.inBuffer, CL_FALSE, 0, size, input);
+}
+
+/**
+ * Read bytes from the Device buffer to caller memory at output, blocking until
+ * it is complete. With staging the read is a DMA to the slot's staging buffer
+ * from which the results are copied, in pieces if they are larger than it.
+ */
+void OpenCLScanner::readOutput(ScanSlot& slot, const cl::Buffer& buffer,
+                               const std::size_t bytes, void* output) {
+    if (!allocateStaging(slot)) {
+        slot.queue.enqueueReadBuffer(buffer, CL_TRUE, 0, bytes, output);
+        return;
+    }
+
+    for (std::size_t offset = 0; offset < bytes; offset += outBufferSize) {
+        const std::size_t piece = std::min(bytes - offset, outBufferSize);
+        slot.queue.enqueueReadBuffer(buffer, CL_TRUE, offset, piece, slot.stagingOutput);
+        std::memcpy(static_cast<char*>(output) + offset, slot.stagingOutput, piece);
+    }
+}
 
+/**
+ * Where an async scan should read its results, which are destined for output,
+ * recorded as slot's readTarget: its staging buffer, or output itself if it
+ * has none, as decided by the scan's writeInput. This makes no OpenCL calls,
+ * so may be used from an event callback. Once the read completes
+ * unstageOutput copies the results to output.
+ */
+static void* outputStaging(ScanSlot& slot, void* output) {
+    slot.readTarget = slot.stagingOutput ? slot.stagingOutput : output;
+    return slot.readTarget;
+}
+
+static void unstageOutput(const ScanSlot& slot, void* output, const std::size_t bytes) {
+    if (slot.readTarget != output) {
+        std::memcpy(output, slot.readTarget, bytes);
+    }
+}
+
+/**
+ * Enqueue slot's pfac Kernel on its queue to scan the first size bytes of the
+ * input Device buffer writing a pattern ID (or INVALID) for each byte to output.
+ * If messageCount is not zero the input is a batch of that many messages
+ * whose end offsets have been written to the slot's messageEnds.
+ */
+void OpenCLScanner::enqueuePfac(const DeviceDictionary& tables, ScanSlot& slot,
+                                const cl::Buffer& input, const cl::Buffer& output,
+                                const cl_int size, const cl_int messageCount) {
     /**
      * The kernel processes the input characters in groups of four (OpenCL int),
      * so we therefore need to calculate our global work size in terms of how
@@ -503,28 +863,45 @@ void OpenCLScanner::scan(const std::vector<char>& input,
 //std::cout << "r = " << r << std::endl;
 //std::cout << "global = " << global << std::endl;
 
-    const cl_int initialState = dictionary->initialState;
-
-    pfacKernel.setArg(0, initialTransitions);
-    pfacKernel.setArg(1, hashRow);
-    pfacKernel.setArg(2, hashVal);
-    pfacKernel.setArg(3, initialState);
-    pfacKernel.setArg(4, inBuffer[0]);
-    pfacKernel.setArg(5, outBuffer[0]);
-    pfacKernel.setArg(6, size);
-    pfacKernel.setArg(7, n);
+    const cl_int initialState = tables.dictionary->initialState;
+    const cl_int useBigramTable = !tables.dictionary->bigramTransitions.empty();
+
+    useProgram(slot, tables);
+    slot.pfacKernel.setArg(0, tables.initialTransitions);
+    slot.pfacKernel.setArg(1, tables.bigramTransitions);
+    slot.pfacKernel.setArg(2, tables.hashRow);
+    slot.pfacKernel.setArg(3, tables.hashVal);
+    slot.pfacKernel.setArg(4, initialState);
+    slot.pfacKernel.setArg(5, useBigramTable);
+    slot.pfacKernel.setArg(6, input);
+    slot.pfacKernel.setArg(7, output);
+    slot.pfacKernel.setArg(8, size);
+    slot.pfacKernel.setArg(9, n);
+    slot.pfacKernel.setArg(10, slot.messageEnds);
+    slot.pfacKernel.setArg(11, messageCount);
+    slot.pfacKernel.setArg(12, tables.longPatterns);
+
+    slot.queue.enqueueNDRangeKernel(slot.pfacKernel,
+                                    cl::NullRange, // Offset value is zero.
+                                    cl::NDRange(global),
+                                    cl::NDRange(WORK_GROUP_SIZE));
+}
 
-    queue[0].enqueueNDRangeKernel(pfacKernel,
-                                  cl::NullRange, // Offset value is zero.
-                                  cl::NDRange(global),
-                                  cl::NDRange(WORK_GROUP_SIZE));
 
-    output.resize(size);
-    queue[0].enqueueReadBuffer(outBuffer[0], CL_TRUE, 0,
-                               size*sizeof(cl_int), output.data());
+/**
+ * Tidy up after an async scan failed to start, before its slot is released.
+ * Whatever was enqueued may still use the slot's buffers and the caller's
+ * output, so wait for it, and drop the Dictionary version the scan held.
+ */
+static void abandon(ScanSlot& slot) {
+    try {
+        slot.queue.finish();
+    } catch (const cl::Error& e) {
+        // The queue is unusable, so nothing enqueued on it will run.
+    }
+    slot.tables.reset();
 }
 
-
 // Async scan
 void OpenCLScanner::scan(const std::vector<char>& input,
                          std::vector<std::int32_t>& output, Callback f) {
@@ -534,108 +911,327 @@ void OpenCLScanner::scan(const std::vector<char>& input,
      * higher overall throughput than the synchronous scan.
      */
 
-    /**
-     * The function call operator on cl::Kernel returns the underlying OpenCL
-     * Object, which can be used to determine if the Kernel is initialised.
-     */
-    if (pfacKernel() == nullptr) {
+    const auto tables = getTables();
+    if (!tables) {
         throw std::runtime_error("OpenCL pfacKernel uninitialised.");
     }
 
-    // TODO scan size currently limited to cl_int (~2GB) - could support larger.
-    const cl_int size = input.size();
-    if (size == 0) {
-        throw std::runtime_error("Input vector uninitialised.");
-    }
+    const cl_int size = checkSize(input.size());
 
-    if (static_cast<std::size_t>(size) > bufferSize) {
-        throw std::runtime_error("Input vector is larger than Device buffer.");
+    // Held until the callback returns, so no other scan can use its buffers.
+    SlotLease<ScanSlot> lease(slots);
+    auto& slot = *lease;
+    slot.callback = std::move(f);
+    slot.input = &input;
+    slot.output = &output;
+    slot.store = &slots;
+    slot.tables = tables;
+
+    try {
+        writeInput(slot, input.data(), size);
+
+        enqueuePfac(*tables, slot, slot.inBuffer, slot.outBuffer, size, 0);
+
+        output.resize(size);
+        slot.queue.enqueueReadBuffer(slot.outBuffer, CL_FALSE, 0,
+                                     size*sizeof(cl_int),
+                                     outputStaging(slot, output.data()),
+                                     NULL, &slot.bufferReadEvent);
+        slot.queue.flush();
+
+        /**
+         * The callback is also called if the scan fails on the Device, when
+         * the output may not have been written, so it then delivers none. If
+         * the read has already completed it is called straight away.
+         */
+        slot.bufferReadEvent.setCallback(CL_COMPLETE,
+                                    [](cl_event event, cl_int status, void* s) {
+            auto& slot = *static_cast<ScanSlot*>(s);
+            if (status == CL_COMPLETE) {
+                unstageOutput(slot, slot.output->data(),
+                              slot.output->size()*sizeof(std::int32_t));
+            } else {
+                slot.output->clear();
+            }
+            slot.callback(*slot.input, *slot.output);
+            slot.tables.reset(); // The scan no longer needs this Dictionary version.
+            slot.store->release(slot);
+        }, static_cast<void*>(&slot));
+    } catch (...) {
+        abandon(slot);
+        throw;
     }
+    lease.release(); // The callback now releases the slot.
+}
 
-    auto& callback = callbackStore.get();
-    callback.callback = std::move(f);
-    callback.input = &input;
-    callback.output = &output;
-    callback.store = &callbackStore;
+/**
+ * Deliver the matches of an async compact scan to its callback then release
+ * its slot, and with it the CommandQueue and buffers the scan used.
+ */
+static void completeCompact(ScanSlot& slot) {
+    if (!slot.matches->empty()) {
+        unstageOutput(slot, slot.matches->data(),
+                      slot.matches->size()*sizeof(MatchEntry));
+    }
+    slot.compactCallback(*slot.input, *slot.matches, slot.result);
+    slot.tables.reset(); // The scan no longer needs this Dictionary version.
+    slot.store->release(slot);
+}
 
-    auto qid = scanCount % COMMAND_QUEUES; // CommandQueue ID
-    auto bid = scanCount % BUFFERS;        // Buffer ID
-    scanCount++;
+/**
+ * The countReadEvent callback of the async compact scan. Both it and the
+ * chained read's callback are also called if the scan fails on the Device,
+ * when the count or matches may not have been read, so they then deliver no
+ * matches, flagged as truncated, and the total only if it was read.
+ */
+static void countRead(cl_event event, cl_int status, void* s) {
+    auto& slot = *static_cast<ScanSlot*>(s);
+    if (status != CL_COMPLETE) {
+        slot.matches->clear();
+        slot.result = {0, 0, true};
+        completeCompact(slot);
+        return;
+    }
 
-    queue[qid].enqueueWriteBuffer(inBuffer[bid], CL_FALSE, 0, size, input.data());
+    const cl_int total = slot.total;
+    const cl_int count = slot.maxResults < total ? slot.maxResults : total;
+    slot.result = {static_cast<std::size_t>(count),
+                   static_cast<std::size_t>(total),
+                   total > slot.maxResults};
+    slot.matches->resize(count);
+    if (count == 0) {
+        completeCompact(slot);
+        return;
+    }
 
     /**
-     * The kernel processes the input characters in groups of four (OpenCL int),
-     * so we therefore need to calculate our global work size in terms of how
-     * many OpenCL integers it comprises. The computed global work size is then
-     * rounded up to a multiple of the local work-group size (thread block size).
+     * Only non-blocking OpenCL calls are permitted in an event callback, so
+     * enqueue the read and flush so that it is submitted, then deliver the
+     * matches from its own callback. Should that fail there's no caller to
+     * throw to, so deliver no matches, flagged as truncated. Once the read's
+     * callback is set it completes the scan, so nothing may follow it here.
      */
+    try {
+        slot.queue.enqueueReadBuffer(slot.outBuffer, CL_FALSE, 0,
+                                     count*sizeof(MatchEntry),
+                                     outputStaging(slot, slot.matches->data()),
+                                     NULL, &slot.bufferReadEvent);
+        slot.queue.flush();
+        slot.bufferReadEvent.setCallback(CL_COMPLETE,
+                                    [](cl_event event, cl_int status, void* s) {
+            auto& slot = *static_cast<ScanSlot*>(s);
+            if (status != CL_COMPLETE) {
+                slot.matches->clear();
+                slot.result.count = 0;
+                slot.result.truncated = true;
+            }
+            completeCompact(slot);
+        }, s);
+    } catch (const cl::Error& e) {
+        slot.matches->clear();
+        slot.result = {0, static_cast<std::size_t>(total), true};
+        completeCompact(slot);
+    }
+}
 
-    // Number of OpenCL integers that would completely contain the input bytes.
-    const cl_int n = (size + sizeof(cl_int) - 1)/sizeof(cl_int);
-
-    // Given n round up if necessary to a multiple of WORK_GROUP_SIZE.
-    const auto r = n % WORK_GROUP_SIZE;
-    const auto global = (r == 0) ? n : n + WORK_GROUP_SIZE - r;
+// Async compact scan
+void OpenCLScanner::scan(const std::vector<char>& input,
+                         std::vector<MatchEntry>& output, CompactCallback f,
+                         const std::int32_t limit) {
+    /**
+     * As the async dense scan, but the size of the results isn't known until
+     * the Kernel has run, so rather than reading the whole output buffer we
+     * read just the match count and, when that completes, chain a read of
+     * exactly that many matches. Nothing blocks the calling thread, and the
+     * sharedMemory reset is a fill on the Device rather than a host write.
+     * As the slot is held until the callback returns, no later scan can
+     * overwrite its output buffer before the chained read.
+     */
+    const auto tables = getTables();
+    if (!tables) {
+        throw std::runtime_error("OpenCL pfacCompactKernel uninitialised.");
+    }
 
-//std::cout << "size = " << size << std::endl;
-//std::cout << "n = " << n << std::endl;
-//std::cout << "r = " << r << std::endl;
-//std::cout << "global = " << global << std::endl;
+    const cl_int size = checkSize(input.size());
 
-    const cl_int initialState = dictionary->initialState;
+    SlotLease<ScanSlot> lease(slots);
+    auto& slot = *lease;
+    slot.compactCallback = std::move(f);
+    slot.input = &input;
+    slot.matches = &output;
+    slot.store = &slots;
+    slot.tables = tables;
+    slot.maxResults = static_cast<cl_int>(compactLimit(limit, maxMatches));
 
-    pfacKernel.setArg(0, initialTransitions);
-    pfacKernel.setArg(1, hashRow);
-    pfacKernel.setArg(2, hashVal);
-    pfacKernel.setArg(3, initialState);
-    pfacKernel.setArg(4, inBuffer[bid]);
-    pfacKernel.setArg(5, outBuffer[bid]);
-    pfacKernel.setArg(6, size);
-    pfacKernel.setArg(7, n);
+    try {
+        writeInput(slot, input.data(), size);
+
+        const auto workGroups = enqueuePfacCompact(*tables, slot, slot.inBuffer,
+                                                   slot.outBuffer, size,
+                                                   slot.maxResults, 0, 0);
+
+        // The last Work Group's inclusivePrefix is the total, see runPfacCompact.
+        slot.queue.enqueueReadBuffer(slot.sharedMemory, CL_FALSE,
+                                     ((workGroups - 1)*2 + 1)*sizeof(cl_int),
+                                     sizeof(cl_int), &slot.total,
+                                     NULL, &slot.countReadEvent);
+        slot.queue.flush();
+
+        // The slot may be reused as soon as the callbacks release it, so once
+        // the first is set nothing here may touch the slot again.
+        slot.countReadEvent.setCallback(CL_COMPLETE, countRead,
+                                        static_cast<void*>(&slot));
+    } catch (...) {
+        abandon(slot);
+        throw;
+    }
+    lease.release(); // The callbacks now release the slot.
+}
 
-    queue[qid].enqueueNDRangeKernel(pfacKernel,
-                                    cl::NullRange, // Offset value is zero.
-                                    cl::NDRange(global),
-                                    cl::NDRange(WORK_GROUP_SIZE));
+CompactResult OpenCLScanner::scan(const std::vector<char>& input,
+                                  std::vector<MatchEntry>& output,
+                                  const std::int32_t limit) {
+    SlotLease<ScanSlot> slot(slots);
+    const auto result = runCompact(*slot, input.data(), input.size(),
+                                   compactLimit(limit, maxMatches), 0);
+    output.resize(result.count);
+    readOutput(*slot, slot->outBuffer, result.count*sizeof(MatchEntry), output.data());
+    return result;
+}
 
-    output.resize(size);
-    queue[qid].enqueueReadBuffer(outBuffer[bid], CL_FALSE, 0,
-                                 size*sizeof(cl_int), output.data(),
-                                 NULL, &callback.bufferReadEvent);
+CompactResult OpenCLScanner::scan(const char* input, const std::size_t size,
+                                  MatchEntry* output, const std::size_t capacity) {
+    SlotLease<ScanSlot> slot(slots);
+    const auto result = runCompact(*slot, input, size,
+                                   std::min(capacity, maxMatches), 0);
+    readOutput(*slot, slot->outBuffer, result.count*sizeof(MatchEntry), output);
+    return result;
+}
 
-    callback.bufferReadEvent.setCallback(CL_COMPLETE,
-                                [](cl_event event, cl_int status, void* c) {
-        auto& callback = *static_cast<CallbackWrapper<COMMAND_QUEUES>*>(c);
-        callback.callback(*callback.input, *callback.output);
-        callback.store->release(callback);
-    }, static_cast<void*>(&callback));
+CompactResult OpenCLScanner::scanAll(const std::vector<char>& input,
+                                     std::vector<MatchEntry>& output,
+                                     const std::int32_t limit) {
+    SlotLease<ScanSlot> slot(slots);
+    const auto result = runCompact(*slot, input.data(), input.size(),
+                                   compactLimit(limit, maxMatches), 1);
+    output.resize(result.count);
+    readOutput(*slot, slot->outBuffer, result.count*sizeof(MatchEntry), output.data());
+    return result;
 }
 
+CompactResult OpenCLScanner::scanAll(const char* input, const std::size_t size,
+                                     MatchEntry* output, const std::size_t capacity) {
+    SlotLease<ScanSlot> slot(slots);
+    const auto result = runCompact(*slot, input, size,
+                                   std::min(capacity, maxMatches), 1);
+    readOutput(*slot, slot->outBuffer, result.count*sizeof(MatchEntry), output);
+    return result;
+}
 
-void OpenCLScanner::scan(const std::vector<char>& input,
-                         std::vector<MatchEntry>& output,
-                         const std::int32_t limit) {
-    /**
-     * The function call operator on cl::Kernel returns the underlying OpenCL
-     * Object, which can be used to determine if the Kernel is initialised.
-     */
-    if (pfacCompactKernel() == nullptr) {
+/**
+ * Compact the matches on the Device as for the compact scan, then run the
+ * pfacSpans Kernel over them so only the final spans are read back. For the
+ * leftmost-longest selection the compaction is limited only by maxMatches, as
+ * the selected spans are a subset of it and it is they that limit bounds.
+ */
+CompactResult OpenCLScanner::scanSpans(const std::vector<char>& input,
+                                       std::vector<MatchSpan>& output,
+                                       const std::int32_t limit,
+                                       const bool leftmostLongest) {
+    const auto tables = getTables();
+    if (!tables) {
         throw std::runtime_error("OpenCL pfacCompactKernel uninitialised.");
     }
 
-    // TODO scan size currently limited to cl_int (~2GB) - could support larger.
-    const cl_int size = input.size();
-    if (size == 0) {
-        throw std::runtime_error("Input vector uninitialised.");
+    const cl_int size = checkSize(input.size());
+    const std::size_t maxResults = compactLimit(limit, maxMatches);
+
+    SlotLease<ScanSlot> slot(slots);
+    writeInput(*slot, input.data(), size);
+    auto result = runPfacCompact(*tables, *slot, slot->inBuffer, slot->outBuffer,
+                                 size, leftmostLongest ? maxMatches : maxResults, 0, 0);
+    output.resize(result.count);
+    if (result.count == 0) {
+        return result;
     }
 
-    if (static_cast<std::size_t>(size) > bufferSize) {
-        throw std::runtime_error("Input vector is larger than Device buffer.");
+    if (slot->spanBuffer() == nullptr) {
+        slot->spanBuffer = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                      maxMatches*sizeof(MatchSpan));
+        slot->spanNext = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                    (maxMatches + 1)*sizeof(cl_int));
     }
 
-    queue[0].enqueueWriteBuffer(inBuffer[0], CL_TRUE, 0, size, input.data());
+    const cl_int count = result.count;
+    slot->pfacSpansKernel.setArg(0, slot->outBuffer);
+    slot->pfacSpansKernel.setArg(1, count);
+    slot->pfacSpansKernel.setArg(2, tables->patternLength);
+    slot->pfacSpansKernel.setArg(3, slot->spanBuffer);
+    slot->pfacSpansKernel.setArg(4, slot->spanNext);
+    slot->pfacSpansKernel.setArg(5, static_cast<cl_int>(leftmostLongest));
+
+    // Given count round up if necessary to a multiple of WORK_GROUP_SIZE.
+    const auto r = count % WORK_GROUP_SIZE;
+    const auto global = leftmostLongest ? WORK_GROUP_SIZE :
+                        (r == 0) ? count : count + WORK_GROUP_SIZE - r;
+    slot->queue.enqueueNDRangeKernel(slot->pfacSpansKernel,
+                                     cl::NullRange, // Offset value is zero.
+                                     cl::NDRange(global),
+                                     cl::NDRange(WORK_GROUP_SIZE));
+
+    if (leftmostLongest) {
+        cl_int selected;
+        slot->queue.enqueueReadBuffer(slot->spanNext, CL_TRUE, count*sizeof(cl_int),
+                                      sizeof(cl_int), &selected);
+        result.total = selected;
+        result.count = std::min<std::size_t>(selected, maxResults);
+        result.truncated = result.truncated || result.total > maxResults;
+        output.resize(result.count);
+    }
 
+    readOutput(*slot, slot->spanBuffer, result.count*sizeof(MatchSpan), output.data());
+    return result;
+}
+
+/**
+ * Run slot's pfacCompact Kernel over size bytes of input and return the number
+ * of matches found, limited to maxResults. The matches are left
+ * in the slot's outBuffer so that the caller may read them to wherever it
+ * chooses. If allMatches is set every pattern matching at each position is
+ * reported as described in PFAC::scanAll, otherwise just the longest.
+ */
+CompactResult OpenCLScanner::runCompact(ScanSlot& slot,
+                                        const char* input, const std::size_t inputSize,
+                                        const std::size_t maxResults,
+                                        const cl_int allMatches) {
+    const auto tables = getTables();
+    if (!tables) {
+        throw std::runtime_error("OpenCL pfacCompactKernel uninitialised.");
+    }
+
+    const cl_int size = checkSize(inputSize);
+
+    writeInput(slot, input, size);
+    return runPfacCompact(*tables, slot, slot.inBuffer, slot.outBuffer, size,
+                          maxResults, 0, allMatches);
+}
+
+/**
+ * Enqueue slot's pfacCompact Kernel on its queue to scan the first size bytes
+ * of the input Device buffer, writing at most maxResults matches to output,
+ * using the slot's sharedMemory for the communication between Work Groups.
+ * Returns the number of Work Groups, as the total number of matches follows
+ * from that, see runPfacCompact. messageCount is as for enqueuePfac and
+ * allMatches as for runCompact.
+ */
+cl_int OpenCLScanner::enqueuePfacCompact(const DeviceDictionary& tables,
+                                         ScanSlot& slot,
+                                         const cl::Buffer& input,
+                                         const cl::Buffer& output,
+                                         const cl_int size,
+                                         const cl_int maxResults,
+                                         const cl_int messageCount,
+                                         const cl_int allMatches) {
     /**
      * The kernel processes the input characters in groups of four (OpenCL int),
      * so we therefore need to calculate our global work size in terms of how
@@ -652,7 +1248,7 @@ void OpenCLScanner::scan(const std::vector<char>& input,
 
     // We need the number of Work Groups in order to identify which sharedMemory
     // item contains the total number of matches.
-    const auto workGroups = (n + WORK_GROUP_SIZE - 1)/WORK_GROUP_SIZE;
+    const cl_int workGroups = (n + WORK_GROUP_SIZE - 1)/WORK_GROUP_SIZE;
 
 //std::cout << "size = " << size << std::endl;
 //std::cout << "n = " << n << std::endl;
@@ -660,39 +1256,64 @@ void OpenCLScanner::scan(const std::vector<char>& input,
 //std::cout << "global = " << global << std::endl;
 //std::cout << "workGroups = " << workGroups << std::endl;
 
+    /**
+     * Initialise the Work Group shared memory, a struct of two ints per Work
+     * Group followed by the stop group, all INVALID. Filling on the Device
+     * avoids both a host to Device transfer and blocking the calling thread.
+     */
+    const cl_int initial = INVALID;
+    slot.queue.enqueueFillBuffer(slot.sharedMemory, initial, 0,
+                                 (workGroups*2 + 1)*sizeof(cl_int));
+
+    const cl_int initialState = tables.dictionary->initialState;
+    const cl_int useBigramTable = !tables.dictionary->bigramTransitions.empty();
+
+    useProgram(slot, tables);
+    slot.pfacCompactKernel.setArg(0, tables.initialTransitions);
+    slot.pfacCompactKernel.setArg(1, tables.bigramTransitions);
+    slot.pfacCompactKernel.setArg(2, tables.hashRow);
+    slot.pfacCompactKernel.setArg(3, tables.hashVal);
+    slot.pfacCompactKernel.setArg(4, initialState);
+    slot.pfacCompactKernel.setArg(5, useBigramTable);
+    slot.pfacCompactKernel.setArg(6, input);
+    slot.pfacCompactKernel.setArg(7, output);
+    slot.pfacCompactKernel.setArg(8, slot.sharedMemory);
+    slot.pfacCompactKernel.setArg(9, size);
+    slot.pfacCompactKernel.setArg(10, n);
+    slot.pfacCompactKernel.setArg(11, slot.messageEnds);
+    slot.pfacCompactKernel.setArg(12, messageCount);
+    slot.pfacCompactKernel.setArg(13, maxResults);
+    slot.pfacCompactKernel.setArg(14, tables.prefixLink);
+    slot.pfacCompactKernel.setArg(15, allMatches);
+    slot.pfacCompactKernel.setArg(16, tables.longPatterns);
+
+    slot.queue.enqueueNDRangeKernel(slot.pfacCompactKernel,
+                                    cl::NullRange, // Offset value is zero.
+                                    cl::NDRange(global),
+                                    cl::NDRange(WORK_GROUP_SIZE));
+    return workGroups;
+}
 
-    // Initialise the Work Group shared memory buffer. TODO Question, for
-    // large numbers of Work Groups is it more efficient to launch a simple
-    // Kernel that initialises the sharedMemory initial semaphore value?
-    // TODO perhaps create a Device buffer holding the initial state then do
-    // copy buffer to copy to sharedMemory is the fastest approach?
-    queue[0].enqueueWriteBuffer(sharedMemory[0], CL_TRUE, 0,
-                                workGroups*2*sizeof(cl_int), 
-                                sharedMemoryInitialValue.data());
-
-
-
-
-    const cl_int initialState = dictionary->initialState;
-
-    const cl_int maxResults = (limit < 0 || limit > size) ? size : limit;
+/**
+ * Run slot's pfacCompact Kernel on its queue to scan the first size bytes of the
+ * input Device buffer, writing the matches to output, and return the number
+ * of matches, limited to maxResults which is at most maxMatches, along with
+ * the number found. messageCount is as for enqueuePfac and allMatches as for
+ * runCompact.
+ */
+CompactResult OpenCLScanner::runPfacCompact(const DeviceDictionary& tables,
+                                            ScanSlot& slot,
+                                            const cl::Buffer& input,
+                                            const cl::Buffer& output,
+                                            const cl_int size,
+                                            const std::size_t maxResults,
+                                            const cl_int messageCount,
+                                            const cl_int allMatches) {
 //std::cout << "maxResults = " << maxResults << std::endl;
 
-    pfacCompactKernel.setArg(0, initialTransitions);
-    pfacCompactKernel.setArg(1, hashRow);
-    pfacCompactKernel.setArg(2, hashVal);
-    pfacCompactKernel.setArg(3, initialState);
-    pfacCompactKernel.setArg(4, inBuffer[0]);
-    pfacCompactKernel.setArg(5, outBuffer[0]);
-    pfacCompactKernel.setArg(6, sharedMemory[0]);
-    pfacCompactKernel.setArg(7, size);
-    pfacCompactKernel.setArg(8, n);
-    pfacCompactKernel.setArg(9, maxResults);
-
-    queue[0].enqueueNDRangeKernel(pfacCompactKernel,
-                                  cl::NullRange, // Offset value is zero.
-                                  cl::NDRange(global),
-                                  cl::NDRange(WORK_GROUP_SIZE));
+    const auto workGroups = enqueuePfacCompact(tables, slot, input, output, size,
+                                               static_cast<cl_int>(maxResults),
+                                               messageCount, allMatches);
 
     /**
      * Retrieve the total number of matched values. This value is computed as
@@ -704,19 +1325,441 @@ void OpenCLScanner::scan(const std::vector<char>& input,
      * scan result, that is the sum of workGroupSum for all the preceeding
      * Work Groups plus the workGroupSum for the current Work Group. This means
      * that the inclusivePrefix value for the last Work Group holds the total
-     * number of matched values.
+     * number of matched values, less any skipped by Work Groups that stopped
+     * early once the total had passed maxResults.
      */
-    cl_int outputSize;
-    queue[0].enqueueReadBuffer(sharedMemory[0], CL_TRUE,
-                               ((workGroups - 1)*2 + 1)*sizeof(cl_int),
-                               sizeof(cl_int), &outputSize);
+    cl_int total;
+    slot.queue.enqueueReadBuffer(slot.sharedMemory, CL_TRUE,
+                                 ((workGroups - 1)*2 + 1)*sizeof(cl_int),
+                                 sizeof(cl_int), &total);
 
-    outputSize = maxResults < outputSize ? maxResults : outputSize;
+    const std::size_t found = total;
+    const std::size_t outputSize = maxResults < found ? maxResults : found;
 //std::cout << "outputSize = " << outputSize << std::endl;
 
-    output.resize(outputSize);
-    queue[0].enqueueReadBuffer(outBuffer[0], CL_TRUE, 0,
-                               outputSize*sizeof(MatchEntry), output.data());
+    return {outputSize, found, found > maxResults};
+}
+
+/**
+ * A batch is packed into as few Kernel launches as possible, each scanning as
+ * many of the messages as fit into the Device buffers, with the per message
+ * results split out of the one read of the output. Without the end offsets
+ * the Kernels would also report matches spanning consecutive messages.
+ */
+void OpenCLScanner::scan(const std::vector<std::vector<char>>& messages,
+                         std::vector<std::vector<std::int32_t>>& output) {
+    const auto tables = getTables();
+    if (!tables) {
+        throw std::runtime_error("OpenCL pfacKernel uninitialised.");
+    }
+
+    SlotLease<ScanSlot> slot(slots);
+    auto& batchEnds = slot->batchEnds;
+    auto& batchMessages = slot->batchMessages;
+    auto& batchOutput = slot->batchOutput;
+
+    output.resize(messages.size());
+    for (std::size_t first = 0; first < messages.size();) {
+        const std::size_t last = packBatch(*slot, messages, first);
+        for (auto i = first; i < last; i++) {
+            output[i].resize(messages[i].size());
+        }
+        first = last;
+
+        if (batchEnds.empty()) {
+            continue; // Nothing but empty messages.
+        }
+
+        const cl_int size = writeBatch(*slot);
+        enqueuePfac(*tables, *slot, slot->inBuffer, slot->outBuffer, size,
+                    batchEnds.size());
+        batchOutput.resize(size);
+        readOutput(*slot, slot->outBuffer, size*sizeof(cl_int), batchOutput.data());
+
+        cl_int begin = 0;
+        for (auto i = 0u; i < batchEnds.size(); i++) {
+            std::copy(batchOutput.begin() + begin, batchOutput.begin() + batchEnds[i],
+                      output[batchMessages[i]].begin());
+            begin = batchEnds[i];
+        }
+    }
+}
+
+void OpenCLScanner::scan(const std::vector<std::vector<char>>& messages,
+                         std::vector<std::vector<MatchEntry>>& output) {
+    const auto tables = getTables();
+    if (!tables) {
+        throw std::runtime_error("OpenCL pfacCompactKernel uninitialised.");
+    }
+
+    SlotLease<ScanSlot> slot(slots);
+    auto& batchEnds = slot->batchEnds;
+    auto& batchMessages = slot->batchMessages;
+    auto& batchOutput = slot->batchOutput;
+    auto& batchMatches = slot->batchMatches;
+
+    output.resize(messages.size());
+    for (std::size_t first = 0; first < messages.size();) {
+        const std::size_t last = packBatch(*slot, messages, first);
+        for (auto i = first; i < last; i++) {
+            output[i].clear();
+        }
+        first = last;
+
+        if (batchEnds.empty()) {
+            continue; // Nothing but empty messages.
+        }
+
+        const cl_int size = writeBatch(*slot);
+        const auto result = runPfacCompact(*tables, *slot, slot->inBuffer,
+                                           slot->outBuffer, size, maxMatches,
+                                           batchEnds.size(), 0);
+        if (result.truncated) {
+            /**
+             * More matches than maxMatches, which can't be split between the
+             * messages, so rescan this part dense, whose output always fits.
+             */
+            enqueuePfac(*tables, *slot, slot->inBuffer, slot->outBuffer, size,
+                        batchEnds.size());
+            batchOutput.resize(size);
+            readOutput(*slot, slot->outBuffer, size*sizeof(cl_int), batchOutput.data());
+            batchMatches.clear();
+            for (cl_int i = 0; i < size; i++) {
+                if (batchOutput[i] != INVALID) {
+                    batchMatches.push_back({i, batchOutput[i]});
+                }
+            }
+        } else {
+            batchMatches.resize(result.count);
+            readOutput(*slot, slot->outBuffer, result.count*sizeof(MatchEntry),
+                       batchMatches.data());
+        }
+
+        // The matches are in input order, so in message order too.
+        std::size_t message = 0;
+        cl_int begin = 0;
+        for (const auto& match : batchMatches) {
+            while (match.index >= batchEnds[message]) {
+                begin = batchEnds[message++];
+            }
+            output[batchMessages[message]].push_back({match.index - begin, match.value});
+        }
+    }
+}
+
+/**
+ * Pack messages into slot's staging buffer, or batchInput if it has none,
+ * starting from first, until the next message would overflow the Device input
+ * buffer or messageEnds. Returns the index of the first message not packed.
+ * Throws if a message exceeds the buffer size.
+ */
+std::size_t OpenCLScanner::packBatch(ScanSlot& slot,
+                                     const std::vector<std::vector<char>>& messages,
+                                     std::size_t first) {
+    auto& batchInput = slot.batchInput;
+    auto& batchEnds = slot.batchEnds;
+    auto& batchMessages = slot.batchMessages;
+    const std::size_t maxMessages = bufferSize/BATCH_MESSAGE_SIZE + 1;
+    if (!allocateStaging(slot)) {
+        batchInput.resize(bufferSize);
+    }
+    char* const batch = slot.stagingInput ? slot.stagingInput : batchInput.data();
+    batchEnds.clear();
+    batchMessages.clear();
+
+    std::size_t size = 0;
+    for (; first < messages.size(); first++) {
+        const auto& message = messages[first];
+        if (message.size() > bufferSize) {
+            throw std::runtime_error("Message is larger than Device buffer.");
+        }
+
+        if (message.empty()) {
+            continue;
+        }
+
+        if (size + message.size() > bufferSize || batchEnds.size() == maxMessages) {
+            break;
+        }
+
+        std::copy(message.begin(), message.end(), batch + size);
+        size += message.size();
+        batchEnds.push_back(size);
+        batchMessages.push_back(first);
+    }
+    return first;
+}
+
+/**
+ * Enqueue writes of slot's packed batch and its end offsets to the Device on
+ * its queue, which is in order so the writes complete before the Kernel runs
+ * and before the blocking read that follows it returns. Returns the size.
+ */
+cl_int OpenCLScanner::writeBatch(ScanSlot& slot) {
+    const cl_int size = slot.batchEnds.back();
+    const char* batch = slot.stagingInput ? slot.stagingInput : slot.batchInput.data();
+    slot.queue.enqueueWriteBuffer(slot.inBuffer, CL_FALSE, 0, size, batch);
+    slot.queue.enqueueWriteBuffer(slot.messageEnds, CL_FALSE, 0,
+                                  slot.batchEnds.size()*sizeof(cl_int),
+                                  slot.batchEnds.data());
+    return size;
+}
+
+/**
+ * The reduced scans run the pfacReduce Kernel, which accumulates its result
+ * in the slot's reduceBuffer with atomics, so only the result itself is read back rather
+ * than an int per character, and unlike pfacCompact there is no prefix sum.
+ */
+std::size_t OpenCLScanner::countMatches(const char* input, const std::size_t size) {
+    const auto tables = getTables();
+    if (!tables) {
+        throw std::runtime_error("OpenCL pfacReduceKernel uninitialised.");
+    }
+
+    SlotLease<ScanSlot> slot(slots);
+    runReduce(*tables, *slot, input, size, REDUCE_COUNT, 1);
+
+    cl_int count;
+    slot->queue.enqueueReadBuffer(slot->reduceBuffer, CL_TRUE, 0, sizeof(cl_int),
+                                  &count);
+    return count;
+}
+
+void OpenCLScanner::matchHistogram(const char* input, const std::size_t size,
+                                   std::vector<std::uint32_t>& output) {
+    const auto tables = getTables();
+    if (!tables) {
+        throw std::runtime_error("OpenCL pfacReduceKernel uninitialised.");
+    }
+
+    const std::size_t patterns = tables->dictionary->initialState;
+    SlotLease<ScanSlot> slot(slots);
+    runReduce(*tables, *slot, input, size, REDUCE_HISTOGRAM, patterns);
+
+    output.resize(patterns);
+    slot->queue.enqueueReadBuffer(slot->reduceBuffer, CL_TRUE, 0,
+                                  patterns*sizeof(cl_int), output.data());
+}
+
+/**
+ * The index of the first match is read first, then the Work Group that found
+ * it gives the pattern ID from its entry in the slot's sharedMemory.
+ */
+MatchEntry OpenCLScanner::firstMatch(const char* input, const std::size_t size) {
+    const auto tables = getTables();
+    if (!tables) {
+        throw std::runtime_error("OpenCL pfacReduceKernel uninitialised.");
+    }
+
+    SlotLease<ScanSlot> slot(slots);
+    const cl_int checkedSize = runReduce(*tables, *slot, input, size, REDUCE_FIRST, 1);
+
+    cl_int first;
+    slot->queue.enqueueReadBuffer(slot->reduceBuffer, CL_TRUE, 0, sizeof(cl_int),
+                                  &first);
+    if (first >= checkedSize) {
+        return {INVALID, INVALID};
+    }
+
+    MatchEntry match;
+    const std::size_t group = first/(WORK_GROUP_SIZE*sizeof(cl_int));
+    slot->queue.enqueueReadBuffer(slot->sharedMemory, CL_TRUE, group*sizeof(MatchEntry),
+                                  sizeof(MatchEntry), &match);
+    return match;
+}
+
+/**
+ * Run slot's pfacReduce Kernel on its queue over size bytes of input using
+ * mode, with the result in the first resultSize ints of its reduceBuffer. These are
+ * initialised to zero, or to size for REDUCE_FIRST, which means no match.
+ * The caller's blocking read of the result also completes the input write.
+ * Returns the checked size.
+ */
+cl_int OpenCLScanner::runReduce(const DeviceDictionary& tables, ScanSlot& slot,
+                                const char* input, const std::size_t inputSize,
+                                const cl_int mode, const std::size_t resultSize) {
+    const cl_int size = checkSize(inputSize);
+
+    // A histogram needs an int per pattern, which may exceed the Device buffers.
+    if (slot.reduceBufferSize < resultSize || slot.reduceBuffer() == nullptr) {
+        slot.reduceBufferSize = resultSize > 0 ? resultSize : 1;
+        slot.reduceBuffer = cl::Buffer(context, CL_MEM_READ_WRITE,
+                                       slot.reduceBufferSize*sizeof(cl_int));
+    }
+
+    writeInput(slot, input, size);
+
+    const cl_int initial = (mode == REDUCE_FIRST) ? size : 0;
+    slot.queue.enqueueFillBuffer(slot.reduceBuffer, initial, 0,
+                                 slot.reduceBufferSize*sizeof(cl_int));
+
+    // Number of OpenCL integers that would completely contain the input bytes.
+    const cl_int n = (size + sizeof(cl_int) - 1)/sizeof(cl_int);
+
+    // Given n round up if necessary to a multiple of WORK_GROUP_SIZE.
+    const auto r = n % WORK_GROUP_SIZE;
+    const auto global = (r == 0) ? n : n + WORK_GROUP_SIZE - r;
+
+    const cl_int initialState = tables.dictionary->initialState;
+    const cl_int useBigramTable = !tables.dictionary->bigramTransitions.empty();
+
+    useProgram(slot, tables);
+    slot.pfacReduceKernel.setArg(0, tables.initialTransitions);
+    slot.pfacReduceKernel.setArg(1, tables.bigramTransitions);
+    slot.pfacReduceKernel.setArg(2, tables.hashRow);
+    slot.pfacReduceKernel.setArg(3, tables.hashVal);
+    slot.pfacReduceKernel.setArg(4, initialState);
+    slot.pfacReduceKernel.setArg(5, useBigramTable);
+    slot.pfacReduceKernel.setArg(6, slot.inBuffer);
+    slot.pfacReduceKernel.setArg(7, slot.reduceBuffer);
+    slot.pfacReduceKernel.setArg(8, slot.sharedMemory);
+    slot.pfacReduceKernel.setArg(9, size);
+    slot.pfacReduceKernel.setArg(10, n);
+    slot.pfacReduceKernel.setArg(11, mode);
+    slot.pfacReduceKernel.setArg(12, tables.longPatterns);
+
+    slot.queue.enqueueNDRangeKernel(slot.pfacReduceKernel,
+                                    cl::NullRange, // Offset value is zero.
+                                    cl::NDRange(global),
+                                    cl::NDRange(WORK_GROUP_SIZE));
+    return size;
+}
+
+/**
+ * Allocate the host I/O buffers on first use, as page locked memory is a scarce
+ * resource and most applications scan their own memory. This also initialises
+ * OpenCL if necessary, so the buffers may be filled before installDictionary.
+ */
+void OpenCLScanner::allocateHostBuffers() {
+    std::lock_guard<std::mutex> lock(installMutex);
+
+    /**
+     * The function call operator on cl::Device returns the underlying OpenCL
+     * Object, which can be used to determine if the Device is initialised.
+     */
+    if (device() == nullptr) {
+        initialiseOpenCL();
+    }
+
+    /**
+     * With unified memory the Kernels access these buffers directly so the
+     * access flags describe Kernel access, otherwise they are only staging
+     * memory for the host and the Device never accesses them.
+     */
+    if (hostInBuffer() == nullptr) {
+        hostInBuffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                  bufferSize);
+        hostOutBuffer = cl::Buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                   outBufferSize);
+    }
+
+    // The buffers are left unmapped if a unified memory scan failed.
+    if (hostInput == nullptr) {
+        SlotLease<ScanSlot> slot(slots);
+        mapHostBuffers(slot->queue);
+    }
+}
+
+/**
+ * Map the host buffers with a blocking map on queue, which is in order, so
+ * they are mapped once any Kernel already enqueued on it has completed.
+ */
+void OpenCLScanner::mapHostBuffers(cl::CommandQueue& queue) {
+    hostInput = static_cast<char*>(
+        queue.enqueueMapBuffer(hostInBuffer, CL_TRUE, CL_MAP_WRITE,
+                               0, bufferSize)
+    );
+    hostOutput = queue.enqueueMapBuffer(hostOutBuffer, CL_TRUE,
+                                        CL_MAP_READ | CL_MAP_WRITE,
+                                        0, outBufferSize);
+}
+
+void OpenCLScanner::unmapHostBuffers(cl::CommandQueue& queue) {
+    queue.enqueueUnmapMemObject(hostInBuffer, hostInput);
+    queue.enqueueUnmapMemObject(hostOutBuffer, hostOutput);
+    hostInput = nullptr;
+    hostOutput = nullptr;
+}
+
+char* OpenCLScanner::getInputBuffer() {
+    if (hostInput == nullptr) {
+        allocateHostBuffers();
+    }
+    return hostInput;
+}
+
+const std::int32_t* OpenCLScanner::getOutputBuffer() {
+    if (hostOutput == nullptr) {
+        allocateHostBuffers();
+    }
+    return static_cast<const std::int32_t*>(hostOutput);
+}
+
+const MatchEntry* OpenCLScanner::getMatchBuffer() {
+    if (hostOutput == nullptr) {
+        allocateHostBuffers();
+    }
+    return static_cast<const MatchEntry*>(hostOutput);
+}
+
+/**
+ * Without unified memory the host buffers are simply page locked memory, so
+ * they are transferred to and from the slot's Device buffers directly at full
+ * DMA speed, bypassing the slot's staging buffers. With unified memory the
+ * Kernel runs on the host buffers themselves, they are unmapped so the Device
+ * may access them and then mapped again, which synchronises them with the
+ * host once the Kernel completes.
+ */
+void OpenCLScanner::scanBuffer(const std::size_t size) {
+    const char* input = getInputBuffer();
+    const auto tables = getTables();
+    if (!tables) {
+        throw std::runtime_error("OpenCL pfacKernel uninitialised.");
+    }
+
+    const cl_int checkedSize = checkSize(size);
+
+    SlotLease<ScanSlot> slot(slots);
+    if (!unifiedMemory) {
+        slot->queue.enqueueWriteBuffer(slot->inBuffer, CL_FALSE, 0, checkedSize, input);
+        enqueuePfac(*tables, *slot, slot->inBuffer, slot->outBuffer, checkedSize, 0);
+        slot->queue.enqueueReadBuffer(slot->outBuffer, CL_TRUE, 0,
+                                      checkedSize*sizeof(cl_int), hostOutput);
+        return;
+    }
+
+    unmapHostBuffers(slot->queue);
+    enqueuePfac(*tables, *slot, hostInBuffer, hostOutBuffer, checkedSize, 0);
+    mapHostBuffers(slot->queue);
+}
+
+CompactResult OpenCLScanner::scanBufferCompact(const std::size_t size,
+                                               const std::int32_t limit) {
+    const char* input = getInputBuffer();
+    const auto tables = getTables();
+    if (!tables) {
+        throw std::runtime_error("OpenCL pfacCompactKernel uninitialised.");
+    }
+
+    const cl_int checkedSize = checkSize(size);
+
+    SlotLease<ScanSlot> slot(slots);
+    if (!unifiedMemory) {
+        slot->queue.enqueueWriteBuffer(slot->inBuffer, CL_FALSE, 0, checkedSize, input);
+        const auto result = runPfacCompact(*tables, *slot, slot->inBuffer,
+                                           slot->outBuffer, checkedSize,
+                                           compactLimit(limit, maxMatches), 0, 0);
+        slot->queue.enqueueReadBuffer(slot->outBuffer, CL_TRUE, 0,
+                                      result.count*sizeof(MatchEntry), hostOutput);
+        return result;
+    }
+
+    unmapHostBuffers(slot->queue);
+    const auto result = runPfacCompact(*tables, *slot, hostInBuffer, hostOutBuffer,
+                                       checkedSize, compactLimit(limit, maxMatches),
+                                       0, 0);
+    mapHostBuffers(slot->queue);
+    return result;
 }
 
 } // namespace gimbatuluk
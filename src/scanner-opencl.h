@@ -24,9 +24,9 @@
 
 #pragma once
 
-#include "circular-store.h"
 #include "pfac.h"
 #include "scanner.h"
+#include "slot-pool.h"
 
 #define __CL_ENABLE_EXCEPTIONS
 #if defined(__APPLE__) || defined(__MACOSX)
@@ -35,24 +35,137 @@
 #include <CL/cl.hpp>
 #endif
 
-#include <array>
 #include <cstddef>
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 namespace gimbatuluk {
 
-template<std::size_t N>
-struct CallbackWrapper {
+/**
+ * An installed Dictionary version together with its hash table objects on the
+ * Device. The Device objects use the Dictionary's host memory, so they share
+ * ownership of it. Scans take a reference to the version installed when they
+ * start, so installing a new version never affects scans already enqueued.
+ */
+struct DeviceDictionary {
+    std::shared_ptr<const Dictionary> dictionary;
+
+    /**
+     * Hash table objects, held as storage selects, see chooseStorage. For
+     * STORAGE_IMAGE they are Image1DBuffers, mapped to GPU texture memory
+     * (because it's cached), otherwise they are the Buffers themselves.
+     */
+    cl::Memory initialTransitions;
+    cl::Memory bigramTransitions;
+    cl::Memory hashRow;
+    cl::Memory hashVal;
+    cl_int storage;
+
+    // Read by pfacCompact when reporting all matches, see Dictionary::prefixLink.
+    cl::Buffer prefixLink;
+
+    // Read by pfacSpans, see Dictionary::patternLength.
+    cl::Buffer patternLength;
+
+    // Set if the longest pattern exceeds the Kernels' local buffer overlap.
+    cl_int longPatterns;
+
+    /**
+     * The Program whose Kernels scan with this version, either the generic
+     * Program or one specialised for the Dictionary, see setSpecialisedPrograms,
+     * along with the build options that select it from the common options.
+     */
+    cl::Program program;
+    std::string specialisation;
+};
+
+/**
+ * Everything one scan needs of its own on the Device, along with the state of
+ * an async scan waiting for its callback. Each scan, synchronous or async,
+ * takes a ScanSlot from the OpenCLScanner's pool and returns it on completion,
+ * so scans from any number of threads may share an OpenCLScanner. Each slot
+ * has its own Kernel objects created from the one Program, as setArg is the
+ * only OpenCL call that is not thread safe and the Kernel arguments are per
+ * scan, while the Context, Program and installed Dictionary are shared.
+ */
+struct ScanSlot {
+    cl::CommandQueue queue;
+    cl::Program program;          // The Program the Kernels were created from.
+    cl::Kernel pfacKernel;        // Kernel for running PFAC.
+    cl::Kernel pfacCompactKernel; // Kernel for running PFAC followed by compaction.
+    cl::Kernel pfacReduceKernel;  // Kernel for running PFAC followed by reduction.
+    cl::Kernel pfacSpansKernel;   // Kernel adding match ends after compaction.
+
+    // Device I/O buffers, sharedMemory is used to communicate between Work
+    // Groups in pfacCompactKernel.
+    cl::Buffer inBuffer;
+    cl::Buffer outBuffer;
+    cl::Buffer sharedMemory;
+
+    /**
+     * Batch scans pack their messages into batchInput and record the end offset
+     * of each in batchEnds, which is written to the messageEnds Device buffer,
+     * and its index in the batch in batchMessages. Empty messages are skipped.
+     * The Kernels are passed messageEnds even when not scanning a batch.
+     */
+    cl::Buffer messageEnds;
+    std::vector<char> batchInput; // Unused if the batch is packed into stagingInput.
+    std::vector<cl_int> batchEnds;
+    std::vector<std::size_t> batchMessages;
+    std::vector<std::int32_t> batchOutput;
+    std::vector<MatchEntry> batchMatches;
+
+    // The pfacReduceKernel result, resized to hold a histogram when needed.
+    cl::Buffer reduceBuffer;
+    std::size_t reduceBufferSize = 0;
+
+    // The pfacSpansKernel output and leftmost-longest links, allocated on
+    // first use to hold maxMatches spans.
+    cl::Buffer spanBuffer;
+    cl::Buffer spanNext;
+
+    /**
+     * Page locked staging buffers for transfers to and from caller memory,
+     * see allocateStaging, which stay mapped for the life of the slot, so
+     * every such transfer is a DMA at full speed rather than the driver
+     * staging pageable memory itself. stagingInput holds bufferSize bytes
+     * and stagingOutput outBufferSize bytes. Both are null if staging is not
+     * used, and stagingChecked is set once the slot has decided whether to.
+     */
+    cl::Buffer stagingInBuffer;
+    cl::Buffer stagingOutBuffer;
+    char* stagingInput = nullptr;
+    void* stagingOutput = nullptr;
+    bool stagingChecked = false;
+
+    // State of an async scan, the input and output are the caller's.
     Callback callback = [](const std::vector<char>& input,
                            std::vector<std::int32_t>& output) {};
 
     const std::vector<char>* input;
     std::vector<std::int32_t>* output;
-    CircularStore<CallbackWrapper<N>, N>* store;
+    SlotPool<ScanSlot>* store;
+    std::shared_ptr<const DeviceDictionary> tables; // Released on completion.
 
     cl::Event bufferReadEvent;
+    void* readTarget; // Where bufferReadEvent's read writes, see outputStaging.
+
+    /**
+     * State of an async compact scan. Its match count is read into total, then
+     * that many matches are read from outBuffer by a second read enqueued on
+     * queue from the count read's callback.
+     */
+    CompactCallback compactCallback;
+    std::vector<MatchEntry>* matches;
+    cl_int maxResults;
+    cl_int total;
+    CompactResult result;
+
+    cl::Event countReadEvent;
 };
 
 class OpenCLScanner: public Scanner { // Made non-copyable & non-movable by Scanner
@@ -61,63 +174,160 @@ public:
 
     OpenCLScanner(const std::string deviceName,
                   const std::size_t bufferSize,
-                  const Dictionary& dictionary);
+                  const std::size_t pipelineDepth,
+                  const std::size_t maxMatches);
+    ~OpenCLScanner();
 
     std::string getDeviceName() override;
-    void installDictionary() override;
+    std::size_t getBufferSize() override;
+    void installDictionary(std::shared_ptr<const Dictionary> dictionary) override;
+    std::shared_ptr<const Dictionary> getDictionary() override;
+    std::string getTableStorage() override;
 
     void scan(const std::vector<char>& input,
               std::vector<std::int32_t>& output) override;
     void scan(const std::vector<char>& input,
               std::vector<std::int32_t>& output, Callback callback) override;
 
+    CompactResult scan(const std::vector<char>& input,
+                       std::vector<MatchEntry>& output,
+                       const std::int32_t limit) override;
     void scan(const std::vector<char>& input,
-              std::vector<MatchEntry>& output,
+              std::vector<MatchEntry>& output, CompactCallback callback,
               const std::int32_t limit) override;
-private:
-    /**
-     * Number of OpenCL CommandQueues. For a synchronous scan we only need a
-     * single CommandQueue but for the async scan we need multiple CommandQueues
-     * and buffers so that overlapped data transfers can occur.
-     */
-    static constexpr auto COMMAND_QUEUES = 3;
-    static constexpr auto BUFFERS = 3;
 
+    void scan(const char* input, const std::size_t size,
+              std::int32_t* output) override;
+    CompactResult scan(const char* input, const std::size_t size,
+                       MatchEntry* output, const std::size_t capacity) override;
+
+    CompactResult scanAll(const std::vector<char>& input,
+                          std::vector<MatchEntry>& output,
+                          const std::int32_t limit) override;
+    CompactResult scanAll(const char* input, const std::size_t size,
+                          MatchEntry* output, const std::size_t capacity) override;
+
+    CompactResult scanSpans(const std::vector<char>& input,
+                            std::vector<MatchSpan>& output,
+                            const std::int32_t limit,
+                            const bool leftmostLongest) override;
+
+    void scan(const std::vector<std::vector<char>>& messages,
+              std::vector<std::vector<std::int32_t>>& output) override;
+    void scan(const std::vector<std::vector<char>>& messages,
+              std::vector<std::vector<MatchEntry>>& output) override;
+
+    std::size_t countMatches(const char* input, const std::size_t size) override;
+    void matchHistogram(const char* input, const std::size_t size,
+                       std::vector<std::uint32_t>& output) override;
+    MatchEntry firstMatch(const char* input, const std::size_t size) override;
+
+    char* getInputBuffer() override;
+    const std::int32_t* getOutputBuffer() override;
+    const MatchEntry* getMatchBuffer() override;
+    void scanBuffer(const std::size_t size) override;
+    CompactResult scanBufferCompact(const std::size_t size,
+                                    const std::int32_t limit) override;
+private:
     void initialiseOpenCL();
+    cl_int chooseStorage(const Dictionary& dictionary);
+    cl::Program getProgram(const std::string& specialisation, const bool reusable);
+    std::shared_ptr<const DeviceDictionary> getTables();
+    cl_int checkSize(const std::size_t size);
+    bool allocateStaging(ScanSlot& slot);
+    void writeInput(ScanSlot& slot, const char* input, const cl_int size);
+    void readOutput(ScanSlot& slot, const cl::Buffer& buffer,
+                    const std::size_t bytes, void* output);
+    void enqueuePfac(const DeviceDictionary& tables, ScanSlot& slot,
+                     const cl::Buffer& input, const cl::Buffer& output,
+                     const cl_int size, const cl_int messageCount);
+    cl_int enqueuePfacCompact(const DeviceDictionary& tables, ScanSlot& slot,
+                              const cl::Buffer& input, const cl::Buffer& output,
+                              const cl_int size, const cl_int maxResults,
+                              const cl_int messageCount, const cl_int allMatches);
+    CompactResult runPfacCompact(const DeviceDictionary& tables, ScanSlot& slot,
+                                 const cl::Buffer& input, const cl::Buffer& output,
+                                 const cl_int size, const std::size_t maxResults,
+                                 const cl_int messageCount, const cl_int allMatches);
+    std::size_t packBatch(ScanSlot& slot,
+                          const std::vector<std::vector<char>>& messages,
+                          std::size_t first);
+    cl_int writeBatch(ScanSlot& slot);
+    cl_int runReduce(const DeviceDictionary& tables, ScanSlot& slot,
+                     const char* input, const std::size_t size,
+                     const cl_int mode, const std::size_t resultSize);
+    CompactResult runCompact(ScanSlot& slot,
+                             const char* input, const std::size_t size,
+                             const std::size_t maxResults, const cl_int allMatches);
+    void allocateHostBuffers();
+    void mapHostBuffers(cl::CommandQueue& queue);
+    void unmapHostBuffers(cl::CommandQueue& queue);
 
     const std::string deviceName;
     const std::size_t bufferSize;
-    const Dictionary* dictionary; // *Non-owned* association to Dictionary.
-    int scanCount; // Count of async scan calls, used to identify CommandQueue.
+
+    /**
+     * The most matches a compact scan may write, which bounds its output, so
+     * outBufferSize is the larger of that and the dense output of bufferSize
+     * pattern IDs, as the dense and compact scans share the output buffers.
+     */
+    const std::size_t maxMatches;
+    const std::size_t outBufferSize;
+
+    /**
+     * Number of ScanSlots, each with its own CommandQueue, Kernels and Device
+     * buffers, so the number of scans that may be in flight at once, whether
+     * async scans or synchronous scans from several threads. For a single
+     * thread's synchronous scans one is enough, but the async scan needs more
+     * so that overlapped data transfers can occur. A scan holds its slot until
+     * it completes, for an async scan until its callback returns, and a scan
+     * finding none free waits for one to be released.
+     */
+    const std::size_t pipelineDepth;
 
     /**
      * OpenCL Objects used to initialise and run the OpenCL program. N.B. the
      * C++ classes are thin reference counting Wrappers round the OpenCL C types
      * as per cl.hpp, their copy and assignment functions perform a shallow copy
      * and/or manage reference counting of the underlying OpenCL Objects.
-     * Note that we have multiple distinct CommandQueue instances so that we may
-     * overlap the write, execute & read operations to optimise data transfers.
      */ 
     cl::Device device;
     cl::Context context;
-    cl::Kernel pfacKernel;        // Kernel for running PFAC.
-    cl::Kernel pfacCompactKernel; // Kernel for running PFAC followed by compaction.
-    std::array<cl::CommandQueue, COMMAND_QUEUES> queue;
-
-    // The callbackStore holds callback state wrapper objects for each CommandQueue.
-    CircularStore<CallbackWrapper<COMMAND_QUEUES>, COMMAND_QUEUES> callbackStore;
-
-    // Device I/O buffers. With multiple command queues double buffering is used.
-    // sharedMemory is used to communicate betwen Work Groups in pfacCompactKernel.
-    std::array<cl::Buffer, BUFFERS> inBuffer;
-    std::array<cl::Buffer, BUFFERS> outBuffer;
-    std::array<cl::Buffer, BUFFERS> sharedMemory;
-    std::vector<int>                sharedMemoryInitialValue;
-
-    // Hash table objects are mapped to GPU texture memory (because it's cached).
-    cl::Image1DBuffer initialTransitions;
-    cl::Image1DBuffer hashRow;
-    cl::Image1DBuffer hashVal;
+
+    /**
+     * The Program source and build options common to every Program built for
+     * the Device, and the Programs not specific to one Dictionary, keyed by
+     * the options added to the common ones, see getProgram.
+     */
+    std::string programSource;
+    std::string programOptions;
+    std::map<std::string, cl::Program> programs;
+
+    SlotPool<ScanSlot> slots;
+
+    /**
+     * Host I/O buffers returned by getInputBuffer etc. allocated on first use
+     * using CL_MEM_ALLOC_HOST_PTR, so they are page locked (pinned) memory and
+     * transfers to and from the Device buffers can use DMA directly, without
+     * even the copy to and from the slots' staging buffers. On
+     * Devices with CL_DEVICE_HOST_UNIFIED_MEMORY the Kernels use hostInBuffer
+     * and hostOutBuffer themselves, which are unmapped for the duration of each
+     * scan and mapped again afterwards, so there is no transfer at all. Unlike
+     * the other scans there is one set, so only one thread may use them.
+     */
+    bool unifiedMemory;
+    cl::Buffer hostInBuffer;
+    cl::Buffer hostOutBuffer;
+    char* hostInput;
+    void* hostOutput;
+
+    /**
+     * The installed Dictionary version, accessed via std::atomic_load and
+     * std::atomic_store. installMutex serialises concurrent installs, which
+     * also initialise OpenCL on first use.
+     */
+    std::shared_ptr<const DeviceDictionary> installed;
+    std::mutex installMutex;
 };
 
 } // namespace gimbatuluk
@@ -26,13 +26,23 @@
 
 #include "pfac.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace gimbatuluk {
 
+struct Dictionary;
+
+/**
+ * Scanners share ownership of the compiled Dictionary they scan with, so that
+ * a new Dictionary version may be installed while scans are in progress. Each
+ * scan takes a reference to the version installed when it starts and holds it
+ * until it completes (for async scans until the callback has been called).
+ */
 class Scanner {
 public:
     Scanner() = default;
@@ -45,17 +55,81 @@ public:
     Scanner& operator=(const Scanner&) = delete;
 
     virtual std::string getDeviceName() = 0;
-    virtual void installDictionary() = 0;
+    virtual std::size_t getBufferSize() = 0;
+    virtual void installDictionary(std::shared_ptr<const Dictionary> dictionary) = 0;
+    virtual std::shared_ptr<const Dictionary> getDictionary() = 0;
+
+    // Where the installed Dictionary's tables are held, see PFAC::getTableStorage.
+    virtual std::string getTableStorage() = 0;
 
     virtual void scan(const std::vector<char>& input,
                       std::vector<std::int32_t>& output) = 0;
     virtual void scan(const std::vector<char>& input,
                       std::vector<std::int32_t>& output, Callback callback) = 0;
 
+    virtual CompactResult scan(const std::vector<char>& input,
+                               std::vector<MatchEntry>& output,
+                               const std::int32_t limit) = 0;
     virtual void scan(const std::vector<char>& input,
-                      std::vector<MatchEntry>& output,
+                      std::vector<MatchEntry>& output, CompactCallback callback,
                       const std::int32_t limit) = 0;
+
+    // Scan caller owned memory in place, e.g. a mapped file, see PFAC::scan.
+    virtual void scan(const char* input, const std::size_t size,
+                      std::int32_t* output) = 0;
+    virtual CompactResult scan(const char* input, const std::size_t size,
+                               MatchEntry* output, const std::size_t capacity) = 0;
+
+    // Scan reporting every pattern matching at each position, see PFAC::scanAll.
+    virtual CompactResult scanAll(const std::vector<char>& input,
+                                  std::vector<MatchEntry>& output,
+                                  const std::int32_t limit) = 0;
+    virtual CompactResult scanAll(const char* input, const std::size_t size,
+                                  MatchEntry* output, const std::size_t capacity) = 0;
+
+    // Compact scan reporting MatchSpans, reduced to the leftmost-longest
+    // selection if leftmostLongest, see PFAC::scanLeftmostLongest.
+    virtual CompactResult scanSpans(const std::vector<char>& input,
+                                    std::vector<MatchSpan>& output,
+                                    const std::int32_t limit,
+                                    const bool leftmostLongest) = 0;
+
+    // Scan a batch of messages separately, see PFAC::scan.
+    virtual void scan(const std::vector<std::vector<char>>& messages,
+                      std::vector<std::vector<std::int32_t>>& output) = 0;
+    virtual void scan(const std::vector<std::vector<char>>& messages,
+                      std::vector<std::vector<MatchEntry>>& output) = 0;
+
+    // Reduced output scans, see PFAC::countMatches.
+    virtual std::size_t countMatches(const char* input, const std::size_t size) = 0;
+    virtual void matchHistogram(const char* input, const std::size_t size,
+                               std::vector<std::uint32_t>& output) = 0;
+    virtual MatchEntry firstMatch(const char* input, const std::size_t size) = 0;
+
+    // Scans of the Scanner owned I/O buffers, see PFAC::getInputBuffer.
+    virtual char* getInputBuffer() = 0;
+    virtual const std::int32_t* getOutputBuffer() = 0;
+    virtual const MatchEntry* getMatchBuffer() = 0;
+    virtual void scanBuffer(const std::size_t size) = 0;
+    virtual CompactResult scanBufferCompact(const std::size_t size,
+                                            const std::int32_t limit) = 0;
 };
 
+/**
+ * The most matches a compact scan may return given its limit, where a negative
+ * limit means no limit, and the maxMatches of the Scanner running it.
+ */
+inline std::size_t compactLimit(const std::int32_t limit, const std::size_t maxMatches) {
+    return (limit < 0) ? maxMatches : std::min<std::size_t>(limit, maxMatches);
+}
+
+/**
+ * Create the Scanner for the named Device, see PFAC::getAvailableDevices.
+ */
+std::unique_ptr<Scanner> makeScanner(const std::string deviceName,
+                                     const std::size_t bufferSize,
+                                     const std::size_t pipelineDepth,
+                                     const std::size_t maxMatches);
+
 } // namespace gimbatuluk
 
@@ -0,0 +1,272 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+// Private implementation header, not part of public API
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gimbatuluk {
+
+/**
+ * Bounded pool of T values shared by multiple threads, get takes a free value
+ * blocking until one is released and release returns it to the pool. The free
+ * values are held as indices in a lock-free multi-producer multi-consumer ring
+ * (Dmitry Vyukov's bounded MPMC queue) so neither get nor release take a lock
+ * while values are available. When none are, get spins SPIN_COUNT times, then
+ * yields, then finally parks on a condition variable, and release only takes
+ * the mutex to wake a parked thread if there is one.
+ */
+template<typename T>
+class SlotPool {
+public:
+    SlotPool(const std::size_t capacity):
+    cells(ringSize(capacity)), mask(cells.size() - 1), value(capacity),
+    enqueuePosition(0), dequeuePosition(0), waiters(0) {
+        for (auto i = 0u; i < cells.size(); i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        for (auto i = 0u; i < capacity; i++) {
+            push(i);
+        }
+    }
+
+    SlotPool(SlotPool&&) = delete;
+    SlotPool(const SlotPool&) = delete;
+    SlotPool& operator=(SlotPool&&) = delete;
+    SlotPool& operator=(const SlotPool&) = delete;
+
+    std::size_t size() const {
+        return value.size();
+    }
+
+    T& get() {
+        std::size_t index;
+        for (auto i = 0u; i < SPIN_COUNT + YIELD_COUNT; i++) {
+            if (pop(index)) {
+                return value[index];
+            }
+
+            if (i >= SPIN_COUNT) {
+                std::this_thread::yield();
+            }
+        }
+
+        /**
+         * Park. A releasing thread pushes then checks waiters and we increment
+         * waiters then pop, the fences order each pair so that either our pop
+         * sees the released value or the releasing thread sees our increment
+         * and, as we hold the mutex until waiting, its notify wakes us.
+         */
+        std::unique_lock<std::mutex> lock(mutex);
+        waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!pop(index)) {
+            cond.wait(lock);
+        }
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+        return value[index];
+    }
+
+    // The position of slot in the pool, so owners may pair it with resources.
+    std::size_t index(const T& slot) const {
+        return &slot - &value[0];
+    }
+
+    void release(const T& slot) {
+        push(&slot - &value[0]);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            cond.notify_one();
+        }
+    }
+
+    /**
+     * Block until every value has been released, i.e. nothing is using any of
+     * them, then return them to the pool. Owners call this before destruction
+     * so that a late release cannot touch a destroyed pool.
+     */
+    void drain() {
+        forEach([](T& slot) {});
+    }
+
+    /**
+     * Take every value, as drain does, and apply f to each before returning
+     * them to the pool, e.g. so an owner may initialise the values in place.
+     */
+    template<typename F>
+    void forEach(F f) {
+        std::vector<T*> slots;
+        for (auto i = 0u; i < value.size(); i++) {
+            slots.push_back(&get());
+        }
+
+        for (auto slot : slots) {
+            f(*slot);
+            release(*slot);
+        }
+    }
+private:
+    static constexpr unsigned SPIN_COUNT = 64;
+    static constexpr unsigned YIELD_COUNT = 64;
+    static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        std::size_t index;
+    };
+
+    // The ring must be a power of two, and at least two so pushes never fail.
+    static std::size_t ringSize(const std::size_t capacity) {
+        std::size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        return size;
+    }
+
+    /**
+     * The ring holds at most value.size() indices, which fit, so push always
+     * succeeds but pop fails if the ring is empty.
+     */
+    void push(const std::size_t index) {
+        Cell* cell;
+        std::size_t position = enqueuePosition.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[position & mask];
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const std::intptr_t difference = static_cast<std::intptr_t>(sequence) -
+                                             static_cast<std::intptr_t>(position);
+            if (difference == 0) {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1,
+                                                          std::memory_order_relaxed)) {
+                    break;
+                }
+            } else {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->index = index;
+        cell->sequence.store(position + 1, std::memory_order_release);
+    }
+
+    bool pop(std::size_t& index) {
+        Cell* cell;
+        std::size_t position = dequeuePosition.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[position & mask];
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const std::intptr_t difference = static_cast<std::intptr_t>(sequence) -
+                                             static_cast<std::intptr_t>(position + 1);
+            if (difference == 0) {
+                if (dequeuePosition.compare_exchange_weak(position, position + 1,
+                                                          std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false; // Empty.
+            } else {
+                position = dequeuePosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        index = cell->index;
+        cell->sequence.store(position + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::vector<Cell> cells;
+    const std::size_t mask;
+    std::vector<T> value;
+
+    /**
+     * Padded onto separate cache lines as they are written by different
+     * threads. Padding rather than alignas, as the C++14 operator new need
+     * not honour over-aligned types.
+     */
+    char padding0[CACHE_LINE_SIZE];
+    std::atomic<std::size_t> enqueuePosition;
+    char padding1[CACHE_LINE_SIZE];
+    std::atomic<std::size_t> dequeuePosition;
+    char padding2[CACHE_LINE_SIZE];
+    std::atomic<int> waiters;
+    char padding3[CACHE_LINE_SIZE];
+
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+/**
+ * A value held from a SlotPool for the lifetime of the SlotLease, so that it
+ * is released however the scope holding it exits, including by an exception,
+ * unless the lease has handed it on with release().
+ */
+template<typename T>
+class SlotLease {
+public:
+    SlotLease(SlotPool<T>& pool): pool(pool), slot(pool.get()), released(false) {}
+
+    ~SlotLease() {
+        if (!released) {
+            pool.release(slot);
+        }
+    }
+
+    /**
+     * Hand the value on to whatever will return it to the pool, such as the
+     * callback of an async scan, once that is certain to happen.
+     */
+    T& release() {
+        released = true;
+        return slot;
+    }
+
+    SlotLease(SlotLease&&) = delete;
+    SlotLease(const SlotLease&) = delete;
+    SlotLease& operator=(SlotLease&&) = delete;
+    SlotLease& operator=(const SlotLease&) = delete;
+
+    T& operator*() const {
+        return slot;
+    }
+
+    T* operator->() const {
+        return &slot;
+    }
+private:
+    SlotPool<T>& pool;
+    T& slot;
+    bool released;
+};
+
+} // namespace gimbatuluk
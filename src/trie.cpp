@@ -0,0 +1,180 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include "trie.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace gimbatuluk {
+
+constexpr std::size_t INITIAL_INDEX_SIZE = 1024; // Must be a power of two.
+
+//------------------------------------------------------------------------------
+// static free function prototype declarations.
+static std::size_t hash(const std::uint32_t key);
+
+//------------------------------------------------------------------------------
+
+// Fibonacci hashing, the high bits of the product are the best mixed.
+static inline std::size_t hash(const std::uint32_t key) {
+    return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+//------------------------------------------------------------------------------
+
+constexpr std::int32_t Trie::ROOT;
+constexpr std::size_t Trie::MAX_NODES;
+constexpr std::size_t Trie::LISTED_CHILDREN;
+
+Trie::Trie() {
+    clear();
+}
+
+void Trie::clear() {
+    nodes.assign(1, {-1, -1, -1, 0, false});
+    insertedBytes = 0;
+
+    index.assign(INITIAL_INDEX_SIZE, {0, ROOT});
+    indexed = 0;
+    mask = INITIAL_INDEX_SIZE - 1;
+}
+
+void Trie::reserve(const std::size_t count) {
+    const std::size_t size = std::min(nodes.size() + count, MAX_NODES);
+    if (size > nodes.capacity()) {
+        // Grow geometrically so that many small reservations stay linear.
+        nodes.reserve(std::max(size, 2*nodes.capacity()));
+    }
+}
+
+std::size_t Trie::estimateNodes(const std::size_t bytes) const {
+    if (insertedBytes == 0) { // Nothing to go on, assume half the bytes are shared.
+        return bytes/2;
+    }
+    return static_cast<std::size_t>(static_cast<double>(bytes) *
+                                    (nodes.size() - 1) / insertedBytes);
+}
+
+void Trie::insert(const std::uint8_t* pattern, const std::size_t length,
+                  const std::int32_t patternID) {
+    insertedBytes += length;
+    std::int32_t node = ROOT;
+    for (auto i = 0u; i < length; i++) {
+        node = findOrAddChild(node, pattern[i]);
+    }
+
+    if (nodes[node].patternID < 0) { // Else duplicate, the first ID is reported.
+        nodes[node].patternID = patternID;
+    }
+}
+
+std::int32_t Trie::findOrAddChild(const std::int32_t node, const std::uint8_t ch) {
+    if (nodes[node].indexed) {
+        return findOrAddIndexedChild(node, ch);
+    }
+
+    auto children = 0u;
+    for (auto child = nodes[node].firstChild; child >= 0;
+         child = nodes[child].nextSibling, children++) {
+        if (nodes[child].ch == ch) {
+            return child;
+        }
+    }
+
+    // Not found, so add a child, indexing all of node's children if it now
+    // has too many to search its child list.
+    const std::int32_t child = addChild(node, ch);
+    if (children == LISTED_CHILDREN) {
+        for (auto sibling = child; sibling >= 0;
+             sibling = nodes[sibling].nextSibling) {
+            indexChild(node, sibling);
+        }
+        nodes[node].indexed = true;
+    }
+    return child;
+}
+
+std::int32_t Trie::findOrAddIndexedChild(const std::int32_t node,
+                                         const std::uint8_t ch) {
+    const std::uint32_t key = (static_cast<std::uint32_t>(node) << 8) | ch;
+    std::size_t i = hash(key) & mask;
+    while (index[i].child != ROOT) {
+        if (index[i].key == key) {
+            return index[i].child;
+        }
+        i = (i + 1) & mask;
+    }
+
+    const std::int32_t child = addChild(node, ch);
+    indexChild(node, child);
+    return child;
+}
+
+// Allocate a new node and link it into node's child list.
+std::int32_t Trie::addChild(const std::int32_t node, const std::uint8_t ch) {
+    if (nodes.size() == MAX_NODES) {
+        throw std::runtime_error("Dictionary has too many states for compact layout.");
+    }
+    const std::int32_t child = nodes.size();
+    nodes.push_back({-1, -1, nodes[node].firstChild, ch, false});
+    nodes[node].firstChild = child;
+    return child;
+}
+
+void Trie::indexChild(const std::int32_t node, const std::int32_t child) {
+    // Keep the load factor below 1/2 so that probe sequences stay short.
+    if (2*(indexed + 1) > index.size()) {
+        grow(index.size()*2);
+    }
+
+    const std::uint32_t key = (static_cast<std::uint32_t>(node) << 8) |
+                              nodes[child].ch;
+    std::size_t i = hash(key) & mask;
+    while (index[i].child != ROOT) {
+        i = (i + 1) & mask;
+    }
+    index[i] = {key, child};
+    indexed++;
+}
+
+void Trie::grow(const std::size_t size) {
+    std::vector<Slot> oldIndex(size, {0, ROOT});
+    oldIndex.swap(index);
+    mask = index.size() - 1;
+
+    for (const auto& slot : oldIndex) {
+        if (slot.child != ROOT) {
+            std::size_t i = hash(slot.key) & mask;
+            while (index[i].child != ROOT) {
+                i = (i + 1) & mask;
+            }
+            index[i] = slot;
+        }
+    }
+}
+
+} // namespace gimbatuluk
@@ -0,0 +1,128 @@
+/**
+ * Copyright 2016 Fraser Adams
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+// Private implementation header, not part of public API
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gimbatuluk {
+
+/**
+ * Trie of dictionary patterns used to build the Dictionary stateTable. Nodes
+ * are allocated from an array indexed by node ID rather than individually, and
+ * each node keeps a first child/next sibling list so that its children may be
+ * enumerated when building the stateTable. Most nodes, particularly those far
+ * from the root, have only a few children so are searched via that list, but
+ * the children of nodes with more than LISTED_CHILDREN are also held in an
+ * open addressing hash table keyed by parent node and character, so insertion
+ * is O(pattern length) irrespective of how many children a node has. The trie
+ * persists between insertions so patterns can be added incrementally.
+ */
+class Trie {
+public:
+    static constexpr std::int32_t ROOT = 0;
+    // Node IDs must fit in the 24 high bits of a 32 bit child index key.
+    static constexpr std::size_t MAX_NODES = 1 << 24;
+
+    Trie();
+
+    void clear();
+
+    // Reserve space for at least count further nodes.
+    void reserve(const std::size_t count);
+
+    /**
+     * Estimate the number of nodes that inserting patterns totalling bytes
+     * will add, from the nodes added per byte inserted so far. That ratio only
+     * falls as patterns increasingly share prefixes, so this overestimates.
+     */
+    std::size_t estimateNodes(const std::size_t bytes) const;
+
+    /**
+     * Insert the pattern [pattern, pattern + length) with ID patternID. If the
+     * pattern was previously inserted the original ID is retained.
+     */
+    void insert(const std::uint8_t* pattern, const std::size_t length,
+                const std::int32_t patternID);
+
+    std::size_t size() const {
+        return nodes.size();
+    }
+
+    std::int32_t getPatternID(const std::int32_t node) const {
+        return nodes[node].patternID;
+    }
+
+    std::int32_t getFirstChild(const std::int32_t node) const {
+        return nodes[node].firstChild;
+    }
+
+    std::int32_t getNextSibling(const std::int32_t node) const {
+        return nodes[node].nextSibling;
+    }
+
+    std::uint8_t getChar(const std::int32_t node) const {
+        return nodes[node].ch;
+    }
+private:
+    static constexpr std::size_t LISTED_CHILDREN = 8;
+
+    std::int32_t findOrAddChild(const std::int32_t node, const std::uint8_t ch);
+    std::int32_t findOrAddIndexedChild(const std::int32_t node,
+                                       const std::uint8_t ch);
+    std::int32_t addChild(const std::int32_t node, const std::uint8_t ch);
+    void indexChild(const std::int32_t node, const std::int32_t child);
+    void grow(const std::size_t size);
+
+    /**
+     * The fields of a node are held together as building the stateTable visits
+     * the nodes breadth first, in no particular order in memory.
+     */
+    struct Node {
+        std::int32_t patternID; // Pattern ID or -1 if not a match.
+        std::int32_t firstChild;
+        std::int32_t nextSibling;
+        std::uint8_t ch;
+        bool indexed; // True if the node's children are in the child index.
+    };
+    std::vector<Node> nodes; // Node arena, indexed by node ID.
+    std::size_t insertedBytes;
+
+    /**
+     * Child index, keys are node << 8 | ch. The ROOT is never a child so a
+     * child of ROOT denotes an empty slot.
+     */
+    struct Slot {
+        std::uint32_t key;
+        std::int32_t child;
+    };
+    std::vector<Slot> index;
+    std::size_t indexed;
+    std::size_t mask;
+};
+
+} // namespace gimbatuluk